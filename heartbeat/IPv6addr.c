@@ -98,11 +98,17 @@
 #include <net/if.h> /* for if_nametoindex */
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <poll.h>
+#include <time.h>
 #include <fcntl.h>
 #include <libgen.h>
 #include <syslog.h>
 #include <signal.h>
 #include <errno.h>
+#ifdef HAVE_LINUX_RTNETLINK_H
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
 #include <clplumbing/cl_log.h>
 
 
@@ -151,14 +157,22 @@ const char*	VALIDATE_CMD 	= "validate-all";
 char		BCAST_ADDR[]	= "ff02::1";
 const int	UA_REPEAT_COUNT	= 5;
 const int	QUERY_COUNT	= 5;
+const int	DAD_TIMEOUT	= 5000;	/* msec */
 
 #define 	HWADDR_LEN 	6 /* mac address length */
 
+/* Duplicate address detection for a new address (OCF_RESKEY_dad) */
+enum { DAD_ON, DAD_OFF, DAD_OPTIMISTIC };
+static const char* dad_names[] = { "yes", "no", "optimistic" };
+static int	dad_mode	= DAD_ON;
+
+#ifndef HAVE_LINUX_RTNETLINK_H
 struct in6_ifreq {
 	struct in6_addr ifr6_addr;
 	uint32_t ifr6_prefixlen;
 	unsigned int ifr6_ifindex;
 };
+#endif
 
 static int start_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname);
 static int stop_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname);
@@ -181,6 +195,9 @@ static char* get_if(struct in6_addr* addr_target, int* plen_target, char* prov_i
 static int assign_addr6(struct in6_addr* addr6, int prefix_len, char* if_name);
 static int unassign_addr6(struct in6_addr* addr6, int prefix_len, char* if_name);
 int is_addr6_available(struct in6_addr* addr6);
+#ifdef HAVE_LINUX_RTNETLINK_H
+static int wait_addr6_ready(struct in6_addr* addr6, char* if_name, int timeout);
+#endif
 static int send_ua(struct in6_addr* src_ip, char* if_name);
 
 int
@@ -189,6 +206,7 @@ main(int argc, char* argv[])
 	char		pid_file[256];
 	char*		ipv6addr;
 	char*		cidr_netmask;
+	char*		dad;
 	int		ret;
 	int		count = UA_REPEAT_COUNT;
 	int		interval = 1000;	/* default 1000 msec */
@@ -306,6 +324,22 @@ main(int argc, char* argv[])
 		return OCF_ERR_ARGS;
 	}
 
+	/* get the duplicate address detection mode (optional) */
+	dad = senduaflg ? NULL : getenv("OCF_RESKEY_dad");
+	if (dad != NULL && *dad != 0) {
+		for (dad_mode = DAD_ON; dad_mode <= DAD_OPTIMISTIC; dad_mode++) {
+			if (strcmp(dad, dad_names[dad_mode]) == 0) {
+				break;
+			}
+		}
+		if (dad_mode > DAD_OPTIMISTIC) {
+			cl_log(LOG_ERR, "Invalid dad [%s], "
+				"should be yes, no or optimistic", dad);
+			usage(argv[0]);
+			return OCF_ERR_ARGS;
+		}
+	}
+
 	/* Check whether this system supports IPv6 */
 	if (access(IF_INET6, R_OK)) {
 		cl_log(LOG_ERR, "No support for INET6 on this system.");
@@ -385,6 +419,12 @@ start_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname)
 		return OCF_ERR_GENERIC;
 	}
 
+#ifdef HAVE_LINUX_RTNETLINK_H
+	/* Wait until the kernel has finished duplicate address detection */
+	if (0 != wait_addr6_ready(addr6, if_name, DAD_TIMEOUT)) {
+		return OCF_ERR_GENERIC;
+	}
+#else
 	/* Check whether the address available */
 	for (i = 0; i < QUERY_COUNT; i++) {
 		if (0 == is_addr6_available(addr6)) {
@@ -396,6 +436,7 @@ start_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname)
 		cl_log(LOG_ERR, "failed to ping the address");
 		return OCF_ERR_GENERIC;
 	}
+#endif
 
 	/* Send unsolicited advertisement packet to neighbor */
 	for (i = 0; i < UA_REPEAT_COUNT; i++) {
@@ -579,6 +620,239 @@ err:
 	return status;
 }
 
+/* compare two addresses, on the first plen bits only if use_mask */
+static gboolean
+same_addr6(struct in6_addr* addr, struct in6_addr* addr_target, int plen,
+	   int use_mask)
+{
+	struct in6_addr mask;
+	int		i;
+	int		n;
+	int		s;
+
+	/* Make the mask based on prefix length */
+	memset(mask.s6_addr, 0xff, 16);
+	if (use_mask && plen < 128) {
+		n = plen / 32;
+		memset(mask.s6_addr32 + n + 1, 0, (3 - n) * 4);
+		s = 32 - plen % 32;
+		if (s == 32) 
+			mask.s6_addr32[n] = 0x0;
+		else
+			mask.s6_addr32[n] = 0xffffffff << s;
+		mask.s6_addr32[n] = htonl(mask.s6_addr32[n]);
+	}
+
+	/* compare addr and addr_target */
+	for (i = 0; i < 4; i++) {
+		if ((addr->s6_addr32[i]&mask.s6_addr32[i]) !=
+		    (addr_target->s6_addr32[i]&mask.s6_addr32[i])) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+/*
+ * Addresses are managed with RTM_NEWADDR/RTM_DELADDR requests on a
+ * NETLINK_ROUTE socket, which the kernel acknowledges once the change
+ * is done, and looked up with an RTM_GETADDR dump.
+ */
+#define	NL_BUFSIZE	8192
+
+#ifndef NETLINK_GET_STRICT_CHK
+#define NETLINK_GET_STRICT_CHK	12
+#endif
+
+struct addr6_req {
+	struct nlmsghdr		nh;
+	struct ifaddrmsg	ifa;
+	char			attrs[64];
+};
+
+/*
+ * Send one request and hand every answer to the callback until the
+ * kernel is done.  The callback returns <0 to abort, 0 to continue,
+ * >0 when satisfied.  Returns the last callback result, 0 for a plain
+ * ack, or -errno on failure.
+ */
+typedef int nl_callback(struct nlmsghdr* nlh, void* arg);
+
+static int
+nl_talk(struct nlmsghdr* req, nl_callback* cb, void* arg)
+{
+	struct sockaddr_nl	nladdr;
+	char	buf[NL_BUFSIZE];
+	int	fd, rc = 0, done = 0, one = 1;
+	ssize_t	len;
+
+	if ((fd = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) {
+		return -errno;
+	}
+	/* let the kernel filter dumps by ifa_index where it can */
+	setsockopt(fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &one, sizeof(one));
+
+	memset(&nladdr, 0, sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
+	req->nlmsg_seq = 1;
+
+	if (sendto(fd, req, req->nlmsg_len, 0,
+		   (struct sockaddr *)&nladdr, sizeof(nladdr)) < 0) {
+		rc = -errno;
+		goto out;
+	}
+
+	while (!done) {
+		struct nlmsghdr *nlh;
+
+		len = recv(fd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			rc = -errno;
+			goto out;
+		}
+		if (len == 0) {
+			rc = -EIO;
+			goto out;
+		}
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (size_t)len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != req->nlmsg_seq) {
+				continue;
+			}
+			if (nlh->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				break;
+			}
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = NLMSG_DATA(nlh);
+				rc = err->error;
+				done = 1;
+				break;
+			}
+			rc = cb ? cb(nlh, arg) : 0;
+			if (rc != 0 || !(nlh->nlmsg_flags & NLM_F_MULTI)) {
+				done = 1;
+				break;
+			}
+		}
+	}
+
+out:
+	close(fd);
+	return rc;
+}
+
+static void
+add_rtattr(struct nlmsghdr* nlh, int type, const void* data, int alen)
+{
+	struct rtattr *rta;
+
+	rta = (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(alen);
+	memcpy(RTA_DATA(rta), data, alen);
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+struct scan_arg {
+	struct in6_addr*	addr_target;
+	int*			plen_target;
+	int			use_mask;
+	int			link_ok;	/* consider link-local addresses */
+	unsigned int		ifindex;	/* 0: any interface */
+	char*			devname;
+};
+
+static int
+scan_addr(struct nlmsghdr* nlh, void* arg)
+{
+	struct scan_arg*	sa = arg;
+	struct ifaddrmsg*	ifa = NLMSG_DATA(nlh);
+	struct rtattr*		rta;
+	struct in6_addr*	addr = NULL;
+	int			len;
+
+	if (nlh->nlmsg_type != RTM_NEWADDR || ifa->ifa_family != AF_INET6) {
+		return 0;
+	}
+
+	/* Consider link-local addresses only when the interface name
+	 * is provided, and global addresses.  Skip everything else.
+	 */
+	if (ifa->ifa_scope != RT_SCOPE_UNIVERSE) {
+		if (ifa->ifa_scope != RT_SCOPE_LINK || !sa->link_ok)
+			return 0;
+	}
+	if (*sa->plen_target != 0 && ifa->ifa_prefixlen != *sa->plen_target) {
+		return 0;
+	}
+	if (sa->ifindex != 0 && ifa->ifa_index != sa->ifindex) {
+		return 0;
+	}
+
+	/* IFA_LOCAL is our end of a point-to-point address */
+	len = IFA_PAYLOAD(nlh);
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (RTA_PAYLOAD(rta) < sizeof(*addr)) {
+			continue;
+		}
+		if (rta->rta_type == IFA_LOCAL
+		||  (rta->rta_type == IFA_ADDRESS && addr == NULL)) {
+			addr = RTA_DATA(rta);
+		}
+	}
+	if (addr == NULL
+	||  !same_addr6(addr, sa->addr_target, ifa->ifa_prefixlen, sa->use_mask)) {
+		return 0;
+	}
+	if (if_indextoname(ifa->ifa_index, sa->devname) == NULL) {
+		return 0;
+	}
+	*sa->plen_target = ifa->ifa_prefixlen;
+	return 1;
+}
+
+/* find the network interface associated with an address */
+char*
+scan_if(struct in6_addr* addr_target, int* plen_target, int use_mask, char* prov_ifname)
+{
+	static char		devname[IF_NAMESIZE];
+	struct addr6_req	req;
+	struct scan_arg		sa;
+	int			rc;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.addr_target = addr_target;
+	sa.plen_target = plen_target;
+	sa.use_mask = use_mask;
+	sa.devname = devname;
+	if (prov_ifname != 0 && *prov_ifname != 0) {
+		sa.link_ok = 1;
+		sa.ifindex = if_nametoindex(prov_ifname);
+		if (sa.ifindex == 0) {
+			return NULL;
+		}
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifa));
+	req.nh.nlmsg_type = RTM_GETADDR;
+	req.nh.nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+	req.ifa.ifa_family = AF_INET6;
+	req.ifa.ifa_index = sa.ifindex;
+
+	rc = nl_talk(&req.nh, scan_addr, &sa);
+	if (rc < 0) {
+		cl_log(LOG_ERR, "RTM_GETADDR failed: %s", strerror(-rc));
+		return NULL;
+	}
+	return rc > 0 ? devname : NULL;
+}
+#else
 /* find the network interface associated with an address */
 char*
 scan_if(struct in6_addr* addr_target, int* plen_target, int use_mask, char* prov_ifname)
@@ -586,7 +860,6 @@ scan_if(struct in6_addr* addr_target, int* plen_target, int use_mask, char* prov
 	FILE *f;
 	static char devname[21]="";
 	struct in6_addr addr;
-	struct in6_addr mask;
 	unsigned int plen, scope, dad_status, if_idx;
 	unsigned int addr6p[4];
 
@@ -598,9 +871,6 @@ scan_if(struct in6_addr* addr_target, int* plen_target, int use_mask, char* prov
 	/* Loop for each entry */
 	while (1) {
 		int		i;
-		int		n;
-		int		s;
-		gboolean	same = TRUE;
 
 		i = fscanf(f, "%08x%08x%08x%08x %x %02x %02x %02x %20s\n",
 		       	   &addr6p[0], &addr6p[1], &addr6p[2], &addr6p[3],
@@ -644,31 +914,8 @@ scan_if(struct in6_addr* addr_target, int* plen_target, int use_mask, char* prov
 			addr.s6_addr32[i] = htonl(addr6p[i]);
 		}
 
-		/* Make the mask based on prefix length */
-		memset(mask.s6_addr, 0xff, 16);
-		if (use_mask && plen < 128) {
-			n = plen / 32;
-			memset(mask.s6_addr32 + n + 1, 0, (3 - n) * 4);
-			s = 32 - plen % 32;
-			if (s == 32) 
-				mask.s6_addr32[n] = 0x0;
-			else
-				mask.s6_addr32[n] = 0xffffffff << s;
-			mask.s6_addr32[n] = htonl(mask.s6_addr32[n]);
-		}
-
-		/* compare addr and addr_target */
-		same = TRUE;
-		for (i = 0; i < 4; i++) {
-			if ((addr.s6_addr32[i]&mask.s6_addr32[i]) !=
-			    (addr_target->s6_addr32[i]&mask.s6_addr32[i])) {
-				same = FALSE;
-				break;
-			}
-		}
-		
 		/* We found it!	*/
-		if (same) {
+		if (same_addr6(&addr, addr_target, plen, use_mask)) {
 			fclose(f);
 			*plen_target = plen;
 			return devname;
@@ -677,6 +924,7 @@ scan_if(struct in6_addr* addr_target, int* plen_target, int use_mask, char* prov
 	fclose(f);
 	return NULL;
 }
+#endif /* HAVE_LINUX_RTNETLINK_H */
 /* find a proper network interface to assign the address */
 char*
 find_if(struct in6_addr* addr_target, int* plen_target, char* prov_ifname)
@@ -697,6 +945,248 @@ get_if(struct in6_addr* addr_target, int* plen_target, char* prov_ifname)
 {
 	return scan_if(addr_target, plen_target, 0, prov_ifname);
 }
+#ifdef HAVE_LINUX_RTNETLINK_H
+static int
+change_addr6(int type, int flags, struct in6_addr* addr6, int prefix_len,
+	     char* if_name, unsigned char ifa_flags)
+{
+	struct addr6_req	req;
+	int			rc;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifa));
+	req.nh.nlmsg_type = type;
+	req.nh.nlmsg_flags = NLM_F_REQUEST|NLM_F_ACK|flags;
+	req.ifa.ifa_family = AF_INET6;
+	req.ifa.ifa_prefixlen = prefix_len;
+	req.ifa.ifa_flags = ifa_flags;
+	req.ifa.ifa_index = if_nametoindex(if_name);
+	if (req.ifa.ifa_index == 0) {
+		cl_log(LOG_ERR, "no such interface: %s", if_name);
+		return -1;
+	}
+	add_rtattr((struct nlmsghdr *)&req, IFA_LOCAL, addr6, sizeof(*addr6));
+
+	/* the ack tells us whether the kernel has done it */
+	rc = nl_talk(&req.nh, NULL, NULL);
+	if (rc < 0) {
+		cl_log(LOG_ERR, "%s on %s failed: %s",
+		       type == RTM_NEWADDR ? "RTM_NEWADDR" : "RTM_DELADDR",
+		       if_name, strerror(-rc));
+		return -1;
+	}
+	return 0;
+}
+
+int
+assign_addr6(struct in6_addr* addr6, int prefix_len, char* if_name)
+{
+	unsigned char	ifa_flags = 0;
+
+	if (dad_mode == DAD_OFF) {
+		ifa_flags = IFA_F_NODAD;
+	} else if (dad_mode == DAD_OPTIMISTIC) {
+		ifa_flags = IFA_F_OPTIMISTIC;
+	}
+	return change_addr6(RTM_NEWADDR, NLM_F_CREATE|NLM_F_EXCL,
+			    addr6, prefix_len, if_name, ifa_flags);
+}
+
+int
+unassign_addr6(struct in6_addr* addr6, int prefix_len, char* if_name)
+{
+	return change_addr6(RTM_DELADDR, 0, addr6, prefix_len, if_name, 0);
+}
+
+/*
+ * Duplicate address detection state of addr6 on ifindex from an
+ * RTM_NEWADDR/RTM_DELADDR message: -2 if the message is about another
+ * address, -1 if DAD failed or the address is gone, 0 while it is
+ * still tentative, 1 once it is usable.  An optimistic address is
+ * usable while DAD is still running.
+ */
+static int
+addr6_dad_state(struct nlmsghdr* nlh, struct in6_addr* addr6, unsigned int ifindex)
+{
+	struct ifaddrmsg*	ifa = NLMSG_DATA(nlh);
+	struct rtattr*		rta;
+	struct in6_addr*	addr = NULL;
+	unsigned int		flags = ifa->ifa_flags;
+	int			len;
+
+	if ((nlh->nlmsg_type != RTM_NEWADDR && nlh->nlmsg_type != RTM_DELADDR)
+	||  ifa->ifa_family != AF_INET6 || ifa->ifa_index != ifindex) {
+		return -2;
+	}
+	len = IFA_PAYLOAD(nlh);
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFA_FLAGS && RTA_PAYLOAD(rta) >= sizeof(flags)) {
+			memcpy(&flags, RTA_DATA(rta), sizeof(flags));
+		} else if (RTA_PAYLOAD(rta) >= sizeof(*addr)
+		&&  (rta->rta_type == IFA_LOCAL
+		||  (rta->rta_type == IFA_ADDRESS && addr == NULL))) {
+			addr = RTA_DATA(rta);
+		}
+	}
+	if (addr == NULL || memcmp(addr, addr6, sizeof(*addr)) != 0) {
+		return -2;
+	}
+	if (nlh->nlmsg_type == RTM_DELADDR || (flags & IFA_F_DADFAILED)) {
+		return -1;
+	}
+	if ((flags & IFA_F_TENTATIVE) && !(flags & IFA_F_OPTIMISTIC)) {
+		return 0;
+	}
+	return 1;
+}
+
+struct dad_arg {
+	struct in6_addr*	addr6;
+	unsigned int		ifindex;
+	int			state;
+};
+
+static int
+dad_dump(struct nlmsghdr* nlh, void* arg)
+{
+	struct dad_arg*	da = arg;
+	int		state = addr6_dad_state(nlh, da->addr6, da->ifindex);
+
+	if (state == -2 || nlh->nlmsg_type != RTM_NEWADDR) {
+		return 0;
+	}
+	da->state = state;
+	return 1;
+}
+
+/* Current DAD state of the address, -2 if the kernel does not know it */
+static int
+dad_query(struct dad_arg* da)
+{
+	struct addr6_req	req;
+	int			rc;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifa));
+	req.nh.nlmsg_type = RTM_GETADDR;
+	req.nh.nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+	req.ifa.ifa_family = AF_INET6;
+	req.ifa.ifa_index = da->ifindex;
+
+	da->state = -2;
+	rc = nl_talk(&req.nh, dad_dump, da);
+	if (rc < 0) {
+		cl_log(LOG_ERR, "RTM_GETADDR failed: %s", strerror(-rc));
+		return -1;
+	}
+	return da->state;
+}
+
+static long
+ms_until(const struct timespec* deadline)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (deadline->tv_sec - now.tv_sec) * 1000
+	+	(deadline->tv_nsec - now.tv_nsec) / 1000000;
+}
+
+/*
+ * Wait up to timeout msec for the kernel to finish duplicate address
+ * detection on a new address.  We listen for address notifications
+ * before looking at the current state, so the change cannot slip
+ * through between the two.
+ */
+int
+wait_addr6_ready(struct in6_addr* addr6, char* if_name, int timeout)
+{
+	struct sockaddr_nl	nladdr;
+	struct dad_arg		da;
+	struct timespec		deadline;
+	struct pollfd		pfd;
+	char			buf[NL_BUFSIZE];
+	int			fd, state;
+	long			left;
+	ssize_t			len;
+
+	memset(&da, 0, sizeof(da));
+	da.addr6 = addr6;
+	da.ifindex = if_nametoindex(if_name);
+	if (da.ifindex == 0) {
+		cl_log(LOG_ERR, "no such interface: %s", if_name);
+		return -1;
+	}
+
+	if ((fd = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) {
+		cl_log(LOG_ERR, "socket(NETLINK_ROUTE) failed: %s", strerror(errno));
+		return -1;
+	}
+	memset(&nladdr, 0, sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
+	nladdr.nl_groups = RTMGRP_IPV6_IFADDR;
+	if (bind(fd, (struct sockaddr *)&nladdr, sizeof(nladdr)) < 0) {
+		cl_log(LOG_ERR, "bind(RTMGRP_IPV6_IFADDR) failed: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	state = dad_query(&da);
+	while (state == 0 || state == -2) {
+		struct nlmsghdr *nlh;
+
+		left = ms_until(&deadline);
+		if (left <= 0) {
+			break;
+		}
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, left) <= 0) {
+			continue;
+		}
+		len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (len < 0) {
+			/* notifications were dropped: ask again */
+			if (errno == ENOBUFS) {
+				state = dad_query(&da);
+			}
+			continue;
+		}
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (size_t)len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			int s = addr6_dad_state(nlh, addr6, da.ifindex);
+			if (s != -2) {
+				state = s;
+			}
+		}
+	}
+	close(fd);
+
+	switch (state) {
+	case 1:
+		return 0;
+	case -1:
+		cl_log(LOG_ERR, "duplicate address detection failed on %s", if_name);
+		break;
+	case 0:
+		cl_log(LOG_ERR, "address still tentative on %s after %d msec",
+		       if_name, timeout);
+		break;
+	default:
+		cl_log(LOG_ERR, "address not found on %s", if_name);
+		break;
+	}
+	return -1;
+}
+#else
 int
 assign_addr6(struct in6_addr* addr6, int prefix_len, char* if_name)
 {
@@ -706,6 +1196,11 @@ assign_addr6(struct in6_addr* addr6, int prefix_len, char* if_name)
 	int		fd;
 	struct ifreq	ifr;
 
+	if (dad_mode != DAD_ON) {
+		cl_log(LOG_INFO, "dad=%s needs netlink support, ignored",
+		       dad_names[dad_mode]);
+	}
+
 	fd = socket(AF_INET6, SOCK_DGRAM, 0);
 	if (fd < 0) {
 		return 1;
@@ -758,6 +1253,8 @@ unassign_addr6(struct in6_addr* addr6, int prefix_len, char* if_name)
 	return 0;
 }
 
+#endif /* HAVE_LINUX_RTNETLINK_H */
+
 #define	MINPACKSIZE	64
 int
 is_addr6_available(struct in6_addr* addr6)
@@ -795,6 +1292,7 @@ is_addr6_available(struct in6_addr* addr6)
 			   (struct sockaddr *) &addr,
 			   sizeof(struct sockaddr_in6));
 	if (0 >= ret) {
+		close(icmp_sock);
 		return -1;
 	}
 
@@ -809,6 +1307,7 @@ is_addr6_available(struct in6_addr* addr6)
 	msg.msg_controllen = 0;
 
 	ret = recvmsg(icmp_sock, &msg, MSG_DONTWAIT);
+	close(icmp_sock);
 	if (0 >= ret) {
 		return -1;
 	}
@@ -1037,6 +1536,15 @@ meta_data_addr6(void)
 	"      <shortdesc lang=\"en\">Network interface</shortdesc>\n"
 	"      <content type=\"string\" default=\"\" />\n"
 	"    </parameter>\n"
+	"    <parameter name=\"dad\" unique=\"0\">\n"
+	"      <longdesc lang=\"en\">\n"
+	"	Duplicate address detection for the new address: yes, no\n"
+	"	(the address is usable at once) or optimistic (RFC 4429,\n"
+	"	if the kernel supports it and optimistic_dad is enabled).\n"
+	"      </longdesc>\n"
+	"      <shortdesc lang=\"en\">Duplicate address detection</shortdesc>\n"
+	"      <content type=\"string\" default=\"yes\" />\n"
+	"    </parameter>\n"
 	"  </parameters>\n"
 	"  <actions>\n"
 	"    <action name=\"start\"   timeout=\"15\" />\n"
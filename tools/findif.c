@@ -3,8 +3,9 @@
  *
  *	It's really simple to write in C, but hard to write in the shell...
  *
- *	This code is dependent on IPV4 addressing conventions...
- *		Sorry.
+ *	This code was written for IPV4 addressing conventions; IPv6
+ *	addresses are resolved too, with the netmask given as prefix length
+ *	and an empty broadcast field.
  *
  * Copyright (C) 2000 Alan Robertson <alanr@unix.sh>
  * Copyright (C) 2001 Matt Soffen <matt@soffen.com>
@@ -43,6 +44,13 @@
  *	If the interface is omitted, we choose the interface associated with
  *	the route we selected.
  *
+ *	With -b, the same parameters are read as ip/cidr_netmask/nic/broadcast
+ *	lines from stdin instead, and one result line is written for each.
+ *
+ *	With -d socket, findif stays around as a resolver daemon that
+ *	tracks routing changes via netlink; with -c socket, it asks that
+ *	daemon instead of looking at the routing table itself.
+ *
  *
  *	See http://www.doom.net/docs/netmask.html for a table explaining
  *	CIDR address format and their relationship to life, the universe
@@ -57,6 +65,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <time.h>
 #include <sys/types.h>
 #ifdef HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
@@ -66,6 +75,9 @@
 #endif
 #include <net/if.h>
 #include <sys/ioctl.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
 #include <errno.h>
 #ifdef __linux__
 #undef __OPTIMIZE__
@@ -78,6 +90,10 @@
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#ifdef HAVE_LINUX_RTNETLINK_H
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
 #include <agent_config.h>
 #include <config.h>
 
@@ -128,15 +144,41 @@ typedef int SearchRoute (char *address, struct in_addr *in
 ,        unsigned long *best_netmask, char *errmsg
 ,	int errmsglen);
 
+#ifdef HAVE_LINUX_RTNETLINK_H
+static SearchRoute SearchUsingNetlink;
+#endif
 static SearchRoute SearchUsingProcRoute;
 static SearchRoute SearchUsingRouteCmd;
 
 static SearchRoute *search_mechs[] = {
+#ifdef HAVE_LINUX_RTNETLINK_H
+	&SearchUsingNetlink,
+#endif
 	&SearchUsingProcRoute,
 	&SearchUsingRouteCmd,
 	NULL
 };
 
+/*
+ * The same for IPv6, where the answer is a prefix length
+ */
+typedef int SearchRoute6 (char *address, struct in6_addr *in6
+,	char *best_if, size_t best_iflen, int *best_prefixlen
+,	char *errmsg, int errmsglen);
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+static SearchRoute6 SearchUsingNetlink6;
+#endif
+static SearchRoute6 SearchUsingProcRoute6;
+
+static SearchRoute6 *search_mechs6[] = {
+#ifdef HAVE_LINUX_RTNETLINK_H
+	&SearchUsingNetlink6,
+#endif
+	&SearchUsingProcRoute6,
+	NULL
+};
+
 void GetAddress (char **address, char **netmaskbits
 ,	 char **bcast_arg, char **if_specified);
 
@@ -170,427 +212,2317 @@ void usage(int ec);
 #define	BAD_BROADCAST	(0L)
 #define	MAXSTR	128
 
+/* Prefix length to netmask, in network byte order */
+static unsigned long
+PrefixToNetmask(int bits)
+{
+	if (bits <= 0) {
+		return 0;
+	}
+	return htonl((0xffffffffUL << (32 - bits)) & 0xffffffffUL);
+}
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+#define	NL_BUFSIZE	8192
+
+/*
+ * Send one request on a NETLINK_ROUTE socket and hand every answer
+ * message to the callback until the kernel is done with it.
+ * The callback returns <0 to abort, 0 to continue, >0 when satisfied.
+ * Returns the last callback result, or -errno on failure.
+ */
+typedef int NetlinkCallback (struct nlmsghdr *nlh, void *arg);
+
 static int
-SearchUsingProcRoute (char *address, struct in_addr *in
-, 	struct in_addr *addr_out, char *best_if, size_t best_iflen
-,	unsigned long *best_netmask
-,	char *errmsg, int errmsglen)
+NetlinkTalk(struct nlmsghdr *req, NetlinkCallback *cb, void *arg)
 {
-	unsigned long	flags, refcnt, use, gw, mask;
-	unsigned long   dest;
-	long		metric = LONG_MAX;
-	long		best_metric = LONG_MAX;
-	int		rc = OCF_SUCCESS;
-	
-	char	buf[2048];
-	char	interface[MAXSTR];
-	FILE *routefd = NULL;
+	struct sockaddr_nl	nladdr;
+	char	buf[NL_BUFSIZE];
+	int	fd, rc = 0, done = 0;
+	ssize_t	len;
 
-	if ((routefd = fopen(PROCROUTE, "r")) == NULL) {
-		snprintf(errmsg, errmsglen
-		,	"Cannot open %s for reading"
-		,	PROCROUTE);
-		rc = OCF_ERR_GENERIC; goto out;
+	if ((fd = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) {
+		return -errno;
 	}
 
-	/* Skip first (header) line */
-	if (fgets(buf, sizeof(buf), routefd) == NULL) {
-		snprintf(errmsg, errmsglen
-		,	"Cannot skip first line from %s"
-		,	PROCROUTE);
-		rc = OCF_ERR_GENERIC; goto out;
+	memset(&nladdr, 0, sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
+	req->nlmsg_seq = 1;
+
+	if (sendto(fd, req, req->nlmsg_len, 0
+	,	(struct sockaddr *)&nladdr, sizeof(nladdr)) < 0) {
+		rc = -errno;
+		goto out;
 	}
-	*best_netmask = 0;
-	while (fgets(buf, sizeof(buf), routefd) != NULL) {
-		if (sscanf(buf, "%[^\t]\t%lx%lx%lx%lx%lx%lx%lx"
-		,	interface, &dest, &gw, &flags, &refcnt, &use
-		,	&metric, &mask)
-		!= 8) {
-			snprintf(errmsg, errmsglen, "Bad line in %s: %s"
-			,	PROCROUTE, buf);
-			rc = OCF_ERR_GENERIC; goto out;
+
+	while (!done) {
+		struct nlmsghdr *nlh;
+
+		len = recv(fd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			rc = -errno;
+			goto out;
 		}
-		if ( (in->s_addr&mask) == (in_addr_t)(dest&mask)
-		&&	metric <= best_metric && mask >= *best_netmask) {
-			best_metric = metric;
-			*best_netmask = mask;
-			strncpy(best_if, interface, best_iflen);
+		if (len == 0) {
+			rc = -EIO;
+			goto out;
+		}
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (size_t)len)
+		;	nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != req->nlmsg_seq) {
+				continue;
+			}
+			if (nlh->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				break;
+			}
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = NLMSG_DATA(nlh);
+				rc = err->error;
+				done = 1;
+				break;
+			}
+			rc = cb(nlh, arg);
+			if (rc != 0 || !(nlh->nlmsg_flags & NLM_F_MULTI)) {
+				done = 1;
+				break;
+			}
 		}
-	}
-
-	if (best_metric == LONG_MAX) {
-		snprintf(errmsg, errmsglen, "No route to %s\n", address);
-		rc = OCF_ERR_GENERIC; 
 	}
 
   out:
-	if (routefd) {
-		fclose(routefd);
-	}
-
-	return(rc);
+	close(fd);
+	return rc;
 }
 
-static int
-SearchUsingRouteCmd (char *address, struct in_addr *in
-,	struct in_addr *addr_out, char *best_if, size_t best_iflen
-,	unsigned long *best_netmask
-,	char *errmsg, int errmsglen)
+static void
+AddRtAttr(struct nlmsghdr *nlh, int type, const void *data, int alen)
 {
-	char	mask[20];
-	char	routecmd[MAXSTR];
-	int	best_metric = INT_MAX;	
-	char	buf[2048];
-	char	interface[MAXSTR];
-	char  *cp, *sp;
-	int done = 0;
-	FILE *routefd = NULL;
-	uint32_t maskbits;
+	struct rtattr *rta;
 
-	
-	/* Open route and get the information */
-	snprintf (routecmd, sizeof(routecmd), "%s %s %s"
-	,	ROUTE, ROUTEPARM, address);
-	routefd = popen (routecmd, "r");
-	if (routefd == NULL)
-		return (OCF_ERR_GENERIC);
-	mask[0] = EOS;
-	interface[0] = EOS;
+	rta = (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(alen);
+	memcpy(RTA_DATA(rta), data, alen);
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
 
+struct nl_route {
+	unsigned char	type;
+	unsigned char	prefixlen;
+	unsigned int	table;
+	unsigned int	flags;
+	int		oif;
+};
 
-	while ((done < 3) && fgets(buf, sizeof(buf), routefd)) {
-		int buflen = strnlen(buf, sizeof(buf));
-		/*cp = buf;*/
+static int
+ParseRouteReply(struct nlmsghdr *nlh, void *arg)
+{
+	struct nl_route	*route = arg;
+	struct rtmsg	*rtm = NLMSG_DATA(nlh);
+	struct rtattr	*rta;
+	int		len;
 
-		sp = buf + buflen;
-		while (sp!=buf && isspace((int)*(sp-1))) {
-			--sp;
+	if (nlh->nlmsg_type != RTM_NEWROUTE) {
+		return 0;
+	}
+	route->type = rtm->rtm_type;
+	route->prefixlen = rtm->rtm_dst_len;
+	route->table = rtm->rtm_table;
+	route->flags = rtm->rtm_flags;
+
+	len = RTM_PAYLOAD(nlh);
+	for (rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == RTA_OIF) {
+			route->oif = *(int *)RTA_DATA(rta);
+		} else if (rta->rta_type == RTA_TABLE) {
+			route->table = *(unsigned int *)RTA_DATA(rta);
+		} else if (rta->rta_type == RTA_MULTIPATH && route->oif == 0
+		&&	RTA_PAYLOAD(rta) >= sizeof(struct rtnexthop)) {
+			/* Multipath route: settle for the first nexthop */
+			struct rtnexthop *rtnh = RTA_DATA(rta);
+			route->oif = rtnh->rtnh_ifindex;
 		}
-		*sp = EOS;
+	}
+	return 1;
+}
 
-		if (strstr (buf, "mask:")) {
-			/*strsep(&cp, ":");cp++;*/
-			strtok(buf, ":");
-			cp = strtok(NULL, ":");
-			if (cp) {
-				cp++;
-				strncpy(mask, cp, sizeof(mask));
-				done++;
-			}
-		}
+struct nl_addr {
+	int		family;
+	unsigned char	local[16];
+	unsigned char	prefixlen;
+	int		ifindex;
+};
 
-		if (strstr (buf, "interface:")) {
-			/*strsep(&cp, ":");cp++;*/
-			strtok(buf, ":");
-			cp = strtok(NULL, ":");
-			if (cp) {
-				cp++;
-				strncpy(interface, cp, sizeof(interface));
-				done++;
-			}
+static int
+ParseAddrReply(struct nlmsghdr *nlh, void *arg)
+{
+	struct nl_addr	*addr = arg;
+	struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+	struct rtattr	*rta;
+	int		len, alen;
+
+	if (nlh->nlmsg_type != RTM_NEWADDR || ifa->ifa_family != addr->family) {
+		return 0;
+	}
+	alen = addr->family == AF_INET6 ? 16 : 4;
+	len = IFA_PAYLOAD(nlh);
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		/*
+		 * keep draining the dump, but remember the first match;
+		 * IPv6 addresses usually come as IFA_ADDRESS only
+		 */
+		if ((rta->rta_type == IFA_LOCAL
+		||	(rta->rta_type == IFA_ADDRESS && addr->family == AF_INET6))
+		&&	addr->ifindex == 0 && (int)RTA_PAYLOAD(rta) == alen
+		&&	memcmp(RTA_DATA(rta), addr->local, alen) == 0) {
+			addr->prefixlen = ifa->ifa_prefixlen;
+			addr->ifindex = ifa->ifa_index;
+			break;
 		}
 	}
-	fclose(routefd);
+	return 0;
+}
 
-	/*
-	 * Check to see if mask isn't available.  It may not be
-	 *	returned if multiple IP's are defined.
-	 *	use 255.255.255.255 for mask then
-	 */
-	/* I'm pretty sure this is the wrong behavior...
-	 * I think the right behavior is to declare an error and give up.
-	 * The admin didn't define his routes correctly.  Fix them.
-	 * It's useless to take over an IP address with no way to
-	 * return packets to the originator.  Without the right subnet
-	 * mask, you can't reply to any packets you receive.
-	 */
-	if (strnlen(mask, sizeof(mask)) == 0) {
-		strncpy (mask, "255.255.255.255", sizeof(mask));
+#ifdef RTM_F_FIB_MATCH
+#define HAVE_NETLINK_ROUTE_LOOKUP 1
+
+/*
+ * Ask the kernel which route it would use for the address (RTM_GETROUTE
+ * with RTM_F_FIB_MATCH), instead of scanning the whole routing table.
+ * RTM_F_LOOKUP_TABLE makes it tell the table the route came from rather
+ * than always the main table.
+ * Returns 0, -errno as the kernel reported it, or -EOPNOTSUPP when the
+ * kernel does not know RTM_F_FIB_MATCH.
+ */
+static int
+NetlinkRouteLookup(int family, const void *addr, struct nl_route *route)
+{
+	struct {
+		struct nlmsghdr	nlh;
+		struct rtmsg	rtm;
+		char		attrbuf[64];
+	} req;
+	int	alen = family == AF_INET6 ? 16 : 4;
+	int	rc;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req.nlh.nlmsg_type = RTM_GETROUTE;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST;
+	req.rtm.rtm_family = family;
+	req.rtm.rtm_dst_len = 8 * alen;
+	req.rtm.rtm_flags = RTM_F_FIB_MATCH | RTM_F_LOOKUP_TABLE;
+	AddRtAttr(&req.nlh, RTA_DST, addr, alen);
+
+	memset(route, 0, sizeof(*route));
+	rc = NetlinkTalk(&req.nlh, ParseRouteReply, route);
+	if (rc < 0) {
+		return rc;
+	}
+	if (rc == 0) {
+		return -EIO;
 	}
 
 	/*
-	 * Solaris (at least) can return the word "default" for mask and dest.
-	 * For the moment, let's interpret this as:
-	 *	mask: 0.0.0.0
-	 * This was manifesting itself under "BasicSanityCheck", which tries
-	 * to use a remote IP number; these typically use the "default" route.
-	 * Better schemes are warmly invited...
+	 * Kernels without RTM_F_FIB_MATCH support answer with the cloned
+	 * host route, which carries no usable prefix length.
 	 */
-#ifdef MASK_DEFAULT_TO_ZERO
-	if (strncmp(mask, "default", sizeof("default")) == 0) {
-		strncpy (mask, "0.0.0.0", sizeof(mask));
+	if (route->flags & RTM_F_CLONED) {
+		return -EOPNOTSUPP;
 	}
-#endif
+	return 0;
+}
 
-	if (inet_pton(AF_INET, mask, &maskbits) <= 0) {
-		snprintf(errmsg, errmsglen,
-		  "mask [%s] not valid.", mask);
-		return(OCF_ERR_CONFIGURED);
-	}
+/*
+ * Turn the kernel's answer into interface and prefix length.
+ *
+ * If the address is already configured on this host, the kernel answers
+ * with the host route from the local table; we then take the prefix the
+ * address was configured with, which is what the main table would tell.
+ */
+static int
+NetlinkSearch(int family, const void *addr, char *address
+,	char *best_if, size_t best_iflen, int *best_prefixlen
+,	char *errmsg, int errmsglen)
+{
+	struct nl_route	route;
+	char	ifname[IF_NAMESIZE];
 
-	if (inet_pton(AF_INET, address, addr_out) <= 0) {
-		snprintf(errmsg, errmsglen
-		,	"IP address [%s] not valid.", address);
-		return(OCF_ERR_CONFIGURED);
+	switch (NetlinkRouteLookup(family, addr, &route)) {
+	case 0:
+		break;
+	case -ENETUNREACH:
+	case -EHOSTUNREACH:
+	case -EACCES:
+		snprintf(errmsg, errmsglen, "No route to %s\n", address);
+		return(OCF_ERR_GENERIC);
+	default:
+		/* No netlink, or something odd: let the next mechanism try */
+		return(-1);
 	}
 
-	if ((in->s_addr & maskbits) == (addr_out->s_addr & maskbits)) {
-		if (interface[0] == EOS) {
-			snprintf(errmsg, errmsglen, "No interface found.");
-			return(OCF_ERR_GENERIC);
+	switch (route.type) {
+	case RTN_UNICAST:
+		break;
+	case RTN_LOCAL:
+		if (route.prefixlen == (family == AF_INET6 ? 128 : 32)) {
+			struct {
+				struct nlmsghdr	nlh;
+				struct ifaddrmsg ifa;
+			} req;
+			struct nl_addr nladdr;
+
+			memset(&req, 0, sizeof(req));
+			req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+			req.nlh.nlmsg_type = RTM_GETADDR;
+			req.nlh.nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+			req.ifa.ifa_family = family;
+
+			memset(&nladdr, 0, sizeof(nladdr));
+			nladdr.family = family;
+			memcpy(nladdr.local, addr, family == AF_INET6 ? 16 : 4);
+			if (NetlinkTalk(&req.nlh, ParseAddrReply, &nladdr) < 0
+			||	nladdr.ifindex == 0) {
+				return(-1);
+			}
+			route.prefixlen = nladdr.prefixlen;
+			route.oif = nladdr.ifindex;
 		}
-		best_metric = 0;
-		*best_netmask = maskbits;
-		strncpy(best_if, interface, best_iflen);
-	}
-
-	if (best_metric == INT_MAX) {
+		break;
+	default:
 		snprintf(errmsg, errmsglen, "No route to %s\n", address);
 		return(OCF_ERR_GENERIC);
 	}
 
-	return (OCF_SUCCESS);
+	if (route.oif == 0 || if_indextoname(route.oif, ifname) == NULL) {
+		return(-1);
+	}
+
+	*best_prefixlen = route.prefixlen;
+	strncpy(best_if, ifname, best_iflen);
+	return(OCF_SUCCESS);
 }
 
-/*
- * Getaddress gets all its real parameters from the OCF environment
- * variables that its callers already use.
- */
-void
-GetAddress (char **address, char **netmaskbits
-,	 char **bcast_arg, char **if_specified)
+static int
+SearchUsingNetlink (char *address, struct in_addr *in
+, 	struct in_addr *addr_out, char *best_if, size_t best_iflen
+,	unsigned long *best_netmask
+,	char *errmsg, int errmsglen)
 {
-	/*
-	 *	Here are out input environment variables:
-	 *
-	 *	OCF_RESKEY_ip		ip address
-	 *	OCF_RESKEY_cidr_netmask netmask of interface
-	 *	OCF_RESKEY_broadcast	broadcast address for interface
-	 *	OCF_RESKEY_nic		interface to assign to
-	 *
-	 */
-	*address = getenv("OCF_RESKEY_ip");
-	*netmaskbits = getenv("OCF_RESKEY_cidr_netmask");
-	if (*netmaskbits == NULL || **netmaskbits == EOS) {
-		*netmaskbits = getenv("OCF_RESKEY_netmask");
+	int	prefixlen;
+	int	rc = NetlinkSearch(AF_INET, &in->s_addr, address
+	,	best_if, best_iflen, &prefixlen, errmsg, errmsglen);
+
+	if (rc == OCF_SUCCESS) {
+		*best_netmask = PrefixToNetmask(prefixlen);
 	}
-	*bcast_arg = getenv("OCF_RESKEY_broadcast");
-	*if_specified = getenv("OCF_RESKEY_nic");
+	return(rc);
 }
 
-int
-ConvertNetmaskBitsToInt(char *netmaskbits)
+static int
+SearchUsingNetlink6 (char *address, struct in6_addr *in6
+,	char *best_if, size_t best_iflen, int *best_prefixlen
+,	char *errmsg, int errmsglen)
 {
-	size_t	nmblen = strnlen(netmaskbits, 3);
-
-	/* Maximum netmask is 32 */
-
-	if (nmblen > 2 || nmblen == 0
-	||	(strspn(netmaskbits, "0123456789") != nmblen))
-		return -1;
-	else
-		return atoi(netmaskbits);
+	return NetlinkSearch(AF_INET6, in6, address
+	,	best_if, best_iflen, best_prefixlen, errmsg, errmsglen);
 }
-
-void
-ValidateNetmaskBits(int bits, unsigned long *netmask)
+#else
+static int
+SearchUsingNetlink (char *address, struct in_addr *in
+, 	struct in_addr *addr_out, char *best_if, size_t best_iflen
+,	unsigned long *best_netmask
+,	char *errmsg, int errmsglen)
 {
-	/* Maximum netmask is 32 */
+	return(-1);
+}
+
+static int
+SearchUsingNetlink6 (char *address, struct in6_addr *in6
+,	char *best_if, size_t best_iflen, int *best_prefixlen
+,	char *errmsg, int errmsglen)
+{
+	return(-1);
+}
+#endif /* RTM_F_FIB_MATCH */
+#endif /* HAVE_LINUX_RTNETLINK_H */
+
+/*
+ * In-memory copies of /proc/net/route and /proc/net/ipv6_route, read
+ * once per process no matter how many addresses we are asked about
+ * (see batch mode).
+ *
+ * Lookups go through a path-compressed binary trie keyed on the route
+ * prefixes, so finding the longest matching prefix costs at most one
+ * node per prefix bit, for 32 and 128 bit addresses alike.  Among
+ * routes with the same prefix the lowest metric wins, as it does in the
+ * kernel.  Unreachable, prohibit and blackhole routes stay in the trie
+ * and answer "no route".
+ *
+ * Routes sharing a prefix hang off their trie node as a list sorted by
+ * metric, so that the resolver daemon can add and remove single routes
+ * as the kernel reports them.
+ */
+struct route_entry {
+	unsigned char	dest[16];	/* network byte order */
+	int		prefixlen;	/* -1 once removed */
+	long		metric;
+	int		reject;
+	int		ifindex;	/* 0 when read from /proc */
+	int		next;		/* same prefix, higher metric; or -1 */
+	char		ifname[IFNAMSIZ];
+};
+
+struct trie_node {
+	unsigned char	key[16];	/* zero past len */
+	int		len;
+	int		route;		/* index into routes, or -1 */
+	struct trie_node *child[2];
+};
+
+struct route_table {
+	int		maxlen;		/* 32 or 128 */
+	struct route_entry *routes;
+	size_t		count;
+	size_t		alloced;
+	int		free_list;	/* first removed entry + 1, or 0 */
+	struct trie_node *trie;
+	int		loaded;
+};
+
+static struct route_table	route_table4 = { 32 };
+static struct route_table	route_table6 = { 128 };
+
+#ifndef RTF_REJECT
+#define RTF_REJECT	0x0200
+#endif
+#define PROCROUTE6	"/proc/net/ipv6_route"
+#define RTF6_ANYCAST	0x00100000
+#define RTF6_LOCAL	0x80000000
+
+static int
+PrefixBit(const unsigned char *key, int pos)
+{
+	return (key[pos >> 3] >> (7 - (pos & 7))) & 1;
+}
+
+/* Number of leading bits a and b have in common, at most len */
+static int
+CommonBits(const unsigned char *a, const unsigned char *b, int len)
+{
+	int	j;
+
+	for (j = 0; j < len; j += 8) {
+		unsigned char diff = a[j >> 3] ^ b[j >> 3];
+
+		if (diff) {
+			for (; !(diff & 0x80); diff <<= 1) {
+				++j;
+			}
+			break;
+		}
+	}
+	return j < len ? j : len;
+}
+
+static struct trie_node *
+NewTrieNode(const unsigned char *key, int len, int route)
+{
+	struct trie_node *n = calloc(1, sizeof(*n));
+
+	if (n != NULL) {
+		memcpy(n->key, key, (len + 7) / 8);
+		if (len & 7) {
+			n->key[len >> 3] &= 0xff << (8 - (len & 7));
+		}
+		n->len = len;
+		n->route = route;
+	}
+	return n;
+}
+
+static int
+TrieInsert(struct route_table *rt, int route)
+{
+	const unsigned char *key = rt->routes[route].dest;
+	int	len = rt->routes[route].prefixlen;
+	struct trie_node **np = &rt->trie;
+	struct trie_node *n;
+
+	while ((n = *np) != NULL) {
+		int	common = CommonBits(n->key, key
+		,	n->len < len ? n->len : len);
+
+		if (common < n->len) {
+			/* Split: new node for the part both prefixes share */
+			struct trie_node *m = NewTrieNode(key, common, -1);
+
+			if (m == NULL) {
+				return -1;
+			}
+			m->child[PrefixBit(n->key, common)] = n;
+			*np = n = m;
+		}
+		if (common == len) {
+			int	*rp = &n->route;
+
+			while (*rp >= 0 && rt->routes[*rp].metric
+			<=	rt->routes[route].metric) {
+				rp = &rt->routes[*rp].next;
+			}
+			rt->routes[route].next = *rp;
+			*rp = route;
+			return 0;
+		}
+		np = &n->child[PrefixBit(key, n->len)];
+	}
+	return (*np = NewTrieNode(key, len, route)) == NULL ? -1 : 0;
+}
+
+static void
+TrieFree(struct trie_node *n)
+{
+	if (n != NULL) {
+		TrieFree(n->child[0]);
+		TrieFree(n->child[1]);
+		free(n);
+	}
+}
+
+/* The trie node holding exactly this prefix, if any */
+static struct trie_node *
+TrieFindNode(const struct route_table *rt, const unsigned char *key, int len)
+{
+	struct trie_node *n = rt->trie;
+
+	while (n != NULL && n->len <= len
+	&&	CommonBits(n->key, key, n->len) == n->len) {
+		if (n->len == len) {
+			return n;
+		}
+		n = n->child[PrefixBit(key, n->len)];
+	}
+	return NULL;
+}
+
+static struct route_entry *
+AddRoute(struct route_table *rt)
+{
+	struct route_entry *re;
+
+	if (rt->free_list) {
+		re = &rt->routes[rt->free_list - 1];
+		rt->free_list = re->next + 1;
+		memset(re, 0, sizeof(*re));
+		re->next = -1;
+		return re;
+	}
+	if (rt->count == rt->alloced) {
+		size_t	alloced = rt->alloced ? 2 * rt->alloced : 64;
+		struct route_entry *re;
+
+		re = realloc(rt->routes, alloced * sizeof(*re));
+		if (re == NULL) {
+			return NULL;
+		}
+		rt->routes = re;
+		rt->alloced = alloced;
+	}
+	re = memset(&rt->routes[rt->count++], 0, sizeof(*rt->routes));
+	re->next = -1;
+	return re;
+}
+
+/*
+ * Take a route out of the trie and put its entry up for reuse.  The
+ * trie node stays, possibly empty, as later routes are likely to
+ * come back to the same prefix.
+ */
+static void
+RemoveRoute(struct route_table *rt, int route)
+{
+	struct route_entry *re = &rt->routes[route];
+	struct trie_node *n = TrieFindNode(rt, re->dest, re->prefixlen);
+
+	if (n != NULL) {
+		int	*rp = &n->route;
+
+		while (*rp >= 0 && *rp != route) {
+			rp = &rt->routes[*rp].next;
+		}
+		if (*rp == route) {
+			*rp = re->next;
+		}
+	}
+	re->prefixlen = -1;
+	re->next = rt->free_list - 1;
+	rt->free_list = route + 1;
+}
+
+static int
+BuildTrie(struct route_table *rt, char *errmsg, int errmsglen)
+{
+	size_t	j;
+
+	for (j = 0; j < rt->count; ++j) {
+		if (TrieInsert(rt, j) < 0) {
+			snprintf(errmsg, errmsglen, "Out of memory");
+			return(OCF_ERR_GENERIC);
+		}
+	}
+	rt->loaded = 1;
+	return(OCF_SUCCESS);
+}
+
+static void
+FreeRouteTable(struct route_table *rt)
+{
+	TrieFree(rt->trie);
+	free(rt->routes);
+	rt->trie = NULL;
+	rt->routes = NULL;
+	rt->count = rt->alloced = 0;
+	rt->free_list = 0;
+	rt->loaded = 0;
+}
+
+/* Route index for the address (network byte order), or -1 for no route */
+static int
+RouteTableLookup(const struct route_table *rt, const void *addr)
+{
+	const struct trie_node *n = rt->trie;
+	int	best = -1;
+
+	while (n != NULL && CommonBits(n->key, addr, n->len) == n->len) {
+		if (n->route >= 0) {
+			best = n->route;
+		}
+		if (n->len == rt->maxlen) {
+			break;
+		}
+		n = n->child[PrefixBit(addr, n->len)];
+	}
+	return (best >= 0 && rt->routes[best].reject) ? -1 : best;
+}
+
+static int
+LoadProcRoute(char *errmsg, int errmsglen)
+{
+	unsigned long	flags, refcnt, use, gw, mask, dest;
+	long		metric;
+	char	buf[2048];
+	char	interface[MAXSTR];
+	FILE	*routefd;
+	int	rc = OCF_SUCCESS;
+
+	if ((routefd = fopen(PROCROUTE, "r")) == NULL) {
+		snprintf(errmsg, errmsglen
+		,	"Cannot open %s for reading"
+		,	PROCROUTE);
+		return(OCF_ERR_GENERIC);
+	}
+
+	/* Skip first (header) line */
+	if (fgets(buf, sizeof(buf), routefd) == NULL) {
+		snprintf(errmsg, errmsglen
+		,	"Cannot skip first line from %s"
+		,	PROCROUTE);
+		rc = OCF_ERR_GENERIC; goto out;
+	}
+	while (fgets(buf, sizeof(buf), routefd) != NULL) {
+		struct route_entry *re;
+		in_addr_t	dst;
+
+		if (sscanf(buf, "%[^\t]\t%lx%lx%lx%lx%lx%lx%lx"
+		,	interface, &dest, &gw, &flags, &refcnt, &use
+		,	&metric, &mask)
+		!= 8) {
+			snprintf(errmsg, errmsglen, "Bad line in %s: %s"
+			,	PROCROUTE, buf);
+			rc = OCF_ERR_GENERIC; goto out;
+		}
+		if ((re = AddRoute(&route_table4)) == NULL) {
+			snprintf(errmsg, errmsglen, "Out of memory");
+			rc = OCF_ERR_GENERIC; goto out;
+		}
+		dst = (in_addr_t)(dest & mask);
+		memcpy(re->dest, &dst, sizeof(dst));
+		re->prefixlen = netmask_bits(ntohl((in_addr_t)mask));
+		re->metric = metric;
+		re->reject = (flags & RTF_REJECT) || strcmp(interface, "*") == 0;
+		strncpy(re->ifname, interface, sizeof(re->ifname));
+		re->ifname[sizeof(re->ifname)-1] = EOS;
+	}
+	rc = BuildTrie(&route_table4, errmsg, errmsglen);
+
+  out:
+	fclose(routefd);
+	return(rc);
+}
+
+/*
+ * /proc/net/ipv6_route lists the routes of all tables.  Local and anycast
+ * routes are left out: they would only tell us the /128 of an address
+ * that is already configured, not the prefix it lives in.
+ */
+static int
+LoadProcRoute6(char *errmsg, int errmsglen)
+{
+	char	buf[2048];
+	char	dest[33];
+	char	interface[MAXSTR];
+	unsigned int	prefixlen;
+	unsigned long	metric, flags;
+	FILE	*routefd;
+	int	rc = OCF_SUCCESS;
+
+	if ((routefd = fopen(PROCROUTE6, "r")) == NULL) {
+		snprintf(errmsg, errmsglen
+		,	"Cannot open %s for reading"
+		,	PROCROUTE6);
+		return(OCF_ERR_GENERIC);
+	}
+
+	while (fgets(buf, sizeof(buf), routefd) != NULL) {
+		struct route_entry *re;
+		int	j;
+
+		if (sscanf(buf, "%32s %x %*s %*x %*s %lx %*x %*x %lx %s"
+		,	dest, &prefixlen, &metric, &flags, interface) != 5
+		||	strspn(dest, "0123456789abcdefABCDEF") != 32
+		||	prefixlen > 128) {
+			snprintf(errmsg, errmsglen, "Bad line in %s: %s"
+			,	PROCROUTE6, buf);
+			rc = OCF_ERR_GENERIC; goto out;
+		}
+		if (flags & (RTF6_LOCAL|RTF6_ANYCAST)) {
+			continue;
+		}
+		if ((re = AddRoute(&route_table6)) == NULL) {
+			snprintf(errmsg, errmsglen, "Out of memory");
+			rc = OCF_ERR_GENERIC; goto out;
+		}
+		for (j = 0; j < 16; ++j) {
+			unsigned int byte;
+
+			sscanf(dest + 2 * j, "%2x", &byte);
+			re->dest[j] = byte;
+		}
+		re->prefixlen = prefixlen;
+		re->metric = metric;
+		re->reject = (flags & RTF_REJECT) != 0;
+		strncpy(re->ifname, interface, sizeof(re->ifname));
+		re->ifname[sizeof(re->ifname)-1] = EOS;
+	}
+	rc = BuildTrie(&route_table6, errmsg, errmsglen);
+
+  out:
+	fclose(routefd);
+	return(rc);
+}
+
+static int
+SearchUsingProcRoute (char *address, struct in_addr *in
+, 	struct in_addr *addr_out, char *best_if, size_t best_iflen
+,	unsigned long *best_netmask
+,	char *errmsg, int errmsglen)
+{
+	int	j;
+
+	if (!route_table4.loaded) {
+		int	rc = LoadProcRoute(errmsg, errmsglen);
+
+		if (rc != OCF_SUCCESS) {
+			FreeRouteTable(&route_table4);
+			return(rc);
+		}
+	}
+
+	if ((j = RouteTableLookup(&route_table4, &in->s_addr)) < 0) {
+		snprintf(errmsg, errmsglen, "No route to %s\n", address);
+		return(OCF_ERR_GENERIC);
+	}
+	*best_netmask = PrefixToNetmask(route_table4.routes[j].prefixlen);
+	strncpy(best_if, route_table4.routes[j].ifname, best_iflen);
+	return(OCF_SUCCESS);
+}
+
+static int
+SearchUsingProcRoute6 (char *address, struct in6_addr *in6
+,	char *best_if, size_t best_iflen, int *best_prefixlen
+,	char *errmsg, int errmsglen)
+{
+	int	j;
+
+	if (!route_table6.loaded) {
+		int	rc = LoadProcRoute6(errmsg, errmsglen);
+
+		if (rc != OCF_SUCCESS) {
+			FreeRouteTable(&route_table6);
+			return(rc);
+		}
+	}
+
+	if ((j = RouteTableLookup(&route_table6, in6)) < 0) {
+		snprintf(errmsg, errmsglen, "No route to %s\n", address);
+		return(OCF_ERR_GENERIC);
+	}
+	*best_prefixlen = route_table6.routes[j].prefixlen;
+	strncpy(best_if, route_table6.routes[j].ifname, best_iflen);
+	return(OCF_SUCCESS);
+}
+
+static int
+SearchUsingRouteCmd (char *address, struct in_addr *in
+,	struct in_addr *addr_out, char *best_if, size_t best_iflen
+,	unsigned long *best_netmask
+,	char *errmsg, int errmsglen)
+{
+	char	mask[20];
+	char	routecmd[MAXSTR];
+	int	best_metric = INT_MAX;	
+	char	buf[2048];
+	char	interface[MAXSTR];
+	char  *cp, *sp;
+	int done = 0;
+	FILE *routefd = NULL;
+	uint32_t maskbits;
+
+	
+	/* Open route and get the information */
+	snprintf (routecmd, sizeof(routecmd), "%s %s %s"
+	,	ROUTE, ROUTEPARM, address);
+	routefd = popen (routecmd, "r");
+	if (routefd == NULL)
+		return (OCF_ERR_GENERIC);
+	mask[0] = EOS;
+	interface[0] = EOS;
+
+
+	while ((done < 3) && fgets(buf, sizeof(buf), routefd)) {
+		int buflen = strnlen(buf, sizeof(buf));
+		/*cp = buf;*/
+
+		sp = buf + buflen;
+		while (sp!=buf && isspace((int)*(sp-1))) {
+			--sp;
+		}
+		*sp = EOS;
+
+		if (strstr (buf, "mask:")) {
+			/*strsep(&cp, ":");cp++;*/
+			strtok(buf, ":");
+			cp = strtok(NULL, ":");
+			if (cp) {
+				cp++;
+				strncpy(mask, cp, sizeof(mask));
+				done++;
+			}
+		}
+
+		if (strstr (buf, "interface:")) {
+			/*strsep(&cp, ":");cp++;*/
+			strtok(buf, ":");
+			cp = strtok(NULL, ":");
+			if (cp) {
+				cp++;
+				strncpy(interface, cp, sizeof(interface));
+				done++;
+			}
+		}
+	}
+	fclose(routefd);
+
+	/*
+	 * Check to see if mask isn't available.  It may not be
+	 *	returned if multiple IP's are defined.
+	 *	use 255.255.255.255 for mask then
+	 */
+	/* I'm pretty sure this is the wrong behavior...
+	 * I think the right behavior is to declare an error and give up.
+	 * The admin didn't define his routes correctly.  Fix them.
+	 * It's useless to take over an IP address with no way to
+	 * return packets to the originator.  Without the right subnet
+	 * mask, you can't reply to any packets you receive.
+	 */
+	if (strnlen(mask, sizeof(mask)) == 0) {
+		strncpy (mask, "255.255.255.255", sizeof(mask));
+	}
+
+	/*
+	 * Solaris (at least) can return the word "default" for mask and dest.
+	 * For the moment, let's interpret this as:
+	 *	mask: 0.0.0.0
+	 * This was manifesting itself under "BasicSanityCheck", which tries
+	 * to use a remote IP number; these typically use the "default" route.
+	 * Better schemes are warmly invited...
+	 */
+#ifdef MASK_DEFAULT_TO_ZERO
+	if (strncmp(mask, "default", sizeof("default")) == 0) {
+		strncpy (mask, "0.0.0.0", sizeof(mask));
+	}
+#endif
+
+	if (inet_pton(AF_INET, mask, &maskbits) <= 0) {
+		snprintf(errmsg, errmsglen,
+		  "mask [%s] not valid.", mask);
+		return(OCF_ERR_CONFIGURED);
+	}
+
+	if (inet_pton(AF_INET, address, addr_out) <= 0) {
+		snprintf(errmsg, errmsglen
+		,	"IP address [%s] not valid.", address);
+		return(OCF_ERR_CONFIGURED);
+	}
+
+	if ((in->s_addr & maskbits) == (addr_out->s_addr & maskbits)) {
+		if (interface[0] == EOS) {
+			snprintf(errmsg, errmsglen, "No interface found.");
+			return(OCF_ERR_GENERIC);
+		}
+		best_metric = 0;
+		*best_netmask = maskbits;
+		strncpy(best_if, interface, best_iflen);
+	}
+
+	if (best_metric == INT_MAX) {
+		snprintf(errmsg, errmsglen, "No route to %s\n", address);
+		return(OCF_ERR_GENERIC);
+	}
+
+	return (OCF_SUCCESS);
+}
+
+/*
+ * Getaddress gets all its real parameters from the OCF environment
+ * variables that its callers already use.
+ */
+void
+GetAddress (char **address, char **netmaskbits
+,	 char **bcast_arg, char **if_specified)
+{
+	/*
+	 *	Here are out input environment variables:
+	 *
+	 *	OCF_RESKEY_ip		ip address
+	 *	OCF_RESKEY_cidr_netmask netmask of interface
+	 *	OCF_RESKEY_broadcast	broadcast address for interface
+	 *	OCF_RESKEY_nic		interface to assign to
+	 *
+	 */
+	*address = getenv("OCF_RESKEY_ip");
+	*netmaskbits = getenv("OCF_RESKEY_cidr_netmask");
+	if (*netmaskbits == NULL || **netmaskbits == EOS) {
+		*netmaskbits = getenv("OCF_RESKEY_netmask");
+	}
+	*bcast_arg = getenv("OCF_RESKEY_broadcast");
+	*if_specified = getenv("OCF_RESKEY_nic");
+}
+
+int
+ConvertNetmaskBitsToInt(char *netmaskbits)
+{
+	size_t	nmblen = strnlen(netmaskbits, 3);
+
+	/* Maximum netmask is 32 */
+
+	if (nmblen > 2 || nmblen == 0
+	||	(strspn(netmaskbits, "0123456789") != nmblen))
+		return -1;
+	else
+		return atoi(netmaskbits);
+}
+
+void
+ValidateNetmaskBits(int bits, unsigned long *netmask)
+{
+	/* Maximum netmask is 32 */
+
+	if (bits < 1 || bits > 32) {
+		fprintf(stderr
+		,	"Invalid netmask specification [%d]"
+		,	bits);
+		usage(OCF_ERR_CONFIGURED);
+		/*not reached */
+	}
+
+	bits = 32 - bits;
+	*netmask = (1L<<(bits))-1L;
+	*netmask = ((~(*netmask))&0xffffffffUL);
+	*netmask = htonl(*netmask);
+}
+
+int
+ValidateIFName(const char *ifname, struct ifreq *ifr) 
+{
+ 	int skfd = -1;
+	char *colonptr;
+
+ 	if ( (skfd = socket(PF_INET, SOCK_DGRAM, 0)) == -1 ) {
+ 		fprintf(stderr, "%s\n", strerror(errno));
+ 		return -2;
+ 	}
+ 
+	strncpy(ifr->ifr_name, ifname, IFNAMSIZ);
+
+	/* Contain a ":"?  Probably an error, but treat as warning at present */
+	if ((colonptr = strchr(ifname, ':')) != NULL) {
+		fprintf(stderr, "%s: warning: name may be invalid\n",
+		  ifr->ifr_name);
+	}
+ 
+ 	if (ioctl(skfd, SIOCGIFFLAGS, ifr) < 0) {
+ 		fprintf(stderr, "%s: unknown interface: %s\n"
+ 			, ifr->ifr_name, strerror(errno));
+ 		close(skfd);
+		/* return -1 only if ifname is known to be invalid */
+		return -1;
+ 	}
+ 	close(skfd);
+ 	return 0;
+} 
+
+int
+netmask_bits(unsigned long netmask)
+{
+	int	j;
+
+	netmask = netmask & 0xFFFFFFFFUL;
+
+	for (j=0; j < 32; ++j) {
+		if ((netmask >> j)&0x1) {
+			break;
+		}
+	}
+
+	return 32 - j;
+}
+
+char * 
+get_first_loopback_netdev(char * output)
+{
+	char buf[512];
+	FILE * fd = NULL;
+	char *rc = NULL;
+	
+	if (!output) {
+		fprintf(stderr, "output buf is a null pointer.\n");
+		goto out;
+	}
+
+	fd = fopen(PATH_PROC_NET_DEV, "r");
+	if (!fd) {
+		fprintf(stderr, "Warning: cannot open %s (%s).\n",
+			PATH_PROC_NET_DEV, strerror(errno)); 
+		goto out;
+	}
+
+	/* Skip the first two lines */
+	if (!fgets(buf, sizeof(buf), fd) || !fgets(buf, sizeof(buf), fd)) {
+		fprintf(stderr, "Warning: cannot read header from %s.\n",
+			PATH_PROC_NET_DEV);
+		goto out;
+	}
+
+	while (fgets(buf, sizeof(buf), fd)) {
+		char name[IFNAMSIZ];
+		if (NULL == get_ifname(buf, name)) {
+			/* Maybe somethin is wrong, anyway continue */
+			continue;
+		}
+		if (is_loopback_interface(name)) {
+			strncpy(output, name, IFNAMSIZ);
+			rc = output;
+			goto out;
+		}
+	}
+
+out:
+	if (fd) {
+		fclose(fd);
+	}
+	return rc;
+}
+
+int
+is_loopback_interface(char * ifname)
+{
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	if (ValidateIFName(ifname, &ifr) < 0)
+		return 0;
+
+	if (ifr.ifr_flags & IFF_LOOPBACK) {
+		/* this is a loopback device. */
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+char *
+get_ifname(char * buf, char * ifname)
+{
+	char * start, * end, * buf_border;	
+
+	buf_border = buf + strnlen(buf, 512);
+
+	start = buf; 
+	while (isspace((int) *start) && (start != buf_border)) {
+		start++;
+	}
+	end = start;
+	while ((*end != ':') && (end != buf_border)) {
+		end++;	
+	}
+
+	if ( start == buf_border || end == buf_border ) {
+		/* Over the border of buf */ 
+		return NULL;
+	}
+
+	*end = '\0';
+	strncpy(ifname, start, IFNAMSIZ);
+	
+	return ifname;
+}
+
+int ConvertQuadToInt(char *dest)
+{
+	struct in_addr ad;
+
+	if (inet_pton(AF_INET, dest, &ad) <= 0)
+		return -1;
+
+	return netmask_bits(ntohl(ad.s_addr));
+}
+
+/*
+ * Everything we are told about one address, and what we made of it
+ */
+struct findif_req {
+	char		*address;
+	char		*netmaskbits;
+	char		*bcast_arg;
+	char		*if_specified;
+	int		family;
+	struct in_addr	in;
+	unsigned long	netmask;
+	struct in6_addr	in6;
+	int		prefixlen;	/* IPv6 only */
+};
+
+/*
+ * IPv6 flavour of CheckRequest(): netmask is a prefix length only, a
+ * link local address needs its interface, and there is no broadcast.
+ */
+static int
+CheckRequest6(struct findif_req *req, char *errmsg, int errmsglen)
+{
+	struct ifreq	ifr;
+	int		have_nic = req->if_specified != NULL
+			&&	*req->if_specified != EOS;
+
+	memset(&ifr, 0, sizeof(ifr));
+
+	if (req->netmaskbits != NULL && *req->netmaskbits != EOS) {
+		size_t	nmblen = strnlen(req->netmaskbits, 4);
+
+		if (nmblen > 3
+		||	strspn(req->netmaskbits, "0123456789") != nmblen
+		||	(req->prefixlen = atoi(req->netmaskbits)) < 1
+		||	req->prefixlen > 128) {
+			snprintf(errmsg, errmsglen
+			,	"Invalid netmask specification [%s]"
+			,	req->netmaskbits);
+			return(OCF_ERR_CONFIGURED);
+		}
+	}
+
+	if (have_nic) {
+		if(ValidateIFName(req->if_specified, &ifr) < 0) {
+			snprintf(errmsg, errmsglen
+			,	"Invalid interface [%s].", req->if_specified);
+			return(OCF_ERR_CONFIGURED);
+		}
+	}else if (IN6_IS_ADDR_LINKLOCAL(&req->in6)) {
+		snprintf(errmsg, errmsglen
+		,	"'nic' parameter is mandatory for a link local"
+			" address [%s].", req->address);
+		return(OCF_ERR_CONFIGURED);
+	}
+	return(OCF_SUCCESS);
+}
+
+/*
+ * Validate the request parameters.  Any failure here is a configuration
+ * error; errmsg tells which one.
+ */
+static int
+CheckRequest(struct findif_req *req, char *errmsg, int errmsglen)
+{
+	struct ifreq	ifr;
+	int		nmbits;
+
+	memset(&req->in, 0, sizeof(req->in));
+	memset(&req->in6, 0, sizeof(req->in6));
+	memset(&ifr, 0, sizeof(ifr));
+	req->family = AF_INET;
+	req->netmask = 0;
+	req->prefixlen = 0;
+	*errmsg = EOS;
+
+	if (req->address == NULL || *req->address == EOS) {
+		snprintf(errmsg, errmsglen
+		,	"ERROR: IP address parameter is mandatory.");
+		return(OCF_ERR_CONFIGURED);
+	}
+
+	/* Is the IP address we're supposed to find valid? */
+	 
+	if (inet_pton(AF_INET, req->address, (void *)&req->in) <= 0) {
+		if (inet_pton(AF_INET6, req->address, (void *)&req->in6) <= 0) {
+			snprintf(errmsg, errmsglen
+			,	"IP address [%s] not valid.", req->address);
+			return(OCF_ERR_CONFIGURED);
+		}
+		req->family = AF_INET6;
+	}
+
+	if (req->family == AF_INET6) {
+		return(CheckRequest6(req, errmsg, errmsglen));
+	}
+
+	if (req->netmaskbits != NULL && *req->netmaskbits != EOS) {
+		if (strchr(req->netmaskbits, '.') != NULL) {
+			nmbits = ConvertQuadToInt(req->netmaskbits);
+			fprintf(stderr, "Converted dotted-quad netmask to CIDR as: %d\n", nmbits);
+		}else{
+			nmbits = ConvertNetmaskBitsToInt(req->netmaskbits);
+		}
+
+		if (nmbits < 0) {
+			snprintf(errmsg, errmsglen
+			,	"Invalid netmask specification [%s]"
+			,	req->netmaskbits);
+			return(OCF_ERR_CONFIGURED);
+		}
+		if (nmbits < 1 || nmbits > 32) {
+			snprintf(errmsg, errmsglen
+			,	"Invalid netmask specification [%d]", nmbits);
+			return(OCF_ERR_CONFIGURED);
+		}
+
+		/* Validate the netmaskbits field */
+		ValidateNetmaskBits (nmbits, &req->netmask);
+	}
+
+	if (req->if_specified != NULL && *req->if_specified != EOS) {
+		if(ValidateIFName(req->if_specified, &ifr) < 0) {
+			snprintf(errmsg, errmsglen
+			,	"Invalid interface [%s].", req->if_specified);
+			return(OCF_ERR_CONFIGURED);
+		}
+	}
+
+	/* Did they tell us the broadcast address? */
+
+	if (req->bcast_arg && *req->bcast_arg != EOS) {
+		/* Yes, they gave us a broadcast address.
+		 * It at least should be a valid IP address
+		 */
+ 		struct in_addr bcast_addr;
+ 		if (inet_pton(AF_INET, req->bcast_arg, (void *)&bcast_addr) <= 0) {
+ 			snprintf(errmsg, errmsglen
+			,	"Invalid broadcast address [%s].", req->bcast_arg);
+			return(OCF_ERR_CONFIGURED);
+ 		}
+	}
+	return(OCF_SUCCESS);
+}
+
+/*
+ * Find the interface, netmask and broadcast address for a checked
+ * request and format them into result.
+ */
+static int
+ResolveRequest6(struct findif_req *req, SearchRoute6 **mechs
+,	char *result, size_t resultlen, char *errmsg, int errmsglen)
+{
+	char	best_if[MAXSTR];
+	int	best_prefixlen = 0;
+
+	strcpy(best_if, "UNKNOWN");
+
+	/* The route is needed for the prefix, or for the interface */
+	if (req->prefixlen == 0
+	||	req->if_specified == NULL || *req->if_specified == EOS) {
+		SearchRoute6 **sr = mechs;
+		int rc = OCF_ERR_GENERIC;
+
+		snprintf(errmsg, errmsglen, "No valid mechanisms");
+		while (*sr) {
+			errmsg[0] = '\0';
+			rc = (*sr) (req->address, &req->in6, best_if
+			,	sizeof(best_if), &best_prefixlen
+			,	errmsg, errmsglen);
+			if (!rc) {		/* Mechanism worked */
+				break;
+			}
+			sr++;
+		}
+		if (rc != 0) {	/* No route, or all mechanisms failed */
+			return(rc);
+		}
+	}
+
+	if (req->if_specified != NULL && *req->if_specified != EOS) {
+		strncpy(best_if, req->if_specified, sizeof(best_if));
+		*(best_if + sizeof(best_if) - 1) = '\0';
+	}
+	if (req->prefixlen) {
+		best_prefixlen = req->prefixlen;
+	}else if (best_prefixlen == 0) {
+		if (IN6_IS_ADDR_LOOPBACK(&req->in6)
+		&&	get_first_loopback_netdev(best_if) != NULL) {
+			best_prefixlen = 128;
+		} else {
+			snprintf(errmsg, errmsglen
+			,	"ERROR: Cannot use default route w/o netmask [%s]\n"
+			,	 req->address);
+			return(OCF_ERR_GENERIC);
+		}
+	}
+
+	/* Same layout as for IPv4, with nothing to say about broadcast */
+	snprintf(result, resultlen, "%s\tnetmask %d\tbroadcast\n"
+	,	best_if, best_prefixlen);
+	return(OCF_SUCCESS);
+}
+
+static int
+ResolveRequest(struct findif_req *req, SearchRoute **mechs
+,	SearchRoute6 **mechs6
+,	char *result, size_t resultlen, char *errmsg, int errmsglen)
+{
+	struct in_addr	addr_out;
+	char		best_if[MAXSTR];
+	unsigned long	best_netmask = INT_MAX;
+
+	memset(&addr_out, 0, sizeof(addr_out));
+	*errmsg = EOS;
+
+	if (req->family == AF_INET6) {
+		return(ResolveRequest6(req, mechs6, result, resultlen
+		,	errmsg, errmsglen));
+	}
+
+	if (req->if_specified != NULL && *req->if_specified != EOS) {
+		strncpy(best_if, req->if_specified, sizeof(best_if));
+		*(best_if + sizeof(best_if) - 1) = '\0';
+	}else{
+		SearchRoute **sr = mechs;
+		int rc = OCF_ERR_GENERIC;
+
+		strcpy(best_if, "UNKNOWN");
+		snprintf(errmsg, errmsglen, "No valid mechanisms");
+
+		while (*sr) {
+			errmsg[0] = '\0';
+			rc = (*sr) (req->address, &req->in, &addr_out, best_if
+			,	sizeof(best_if)
+			,	&best_netmask, errmsg, errmsglen);
+			if (!rc) {		/* Mechanism worked */
+				break;
+			}
+			sr++;
+		}
+		if (rc != 0) {	/* No route, or all mechanisms failed */
+			return(rc);
+		}
+	}
 
-	if (bits < 1 || bits > 32) {
-		fprintf(stderr
-		,	"Invalid netmask specification [%d]"
-		,	bits);
-		usage(OCF_ERR_CONFIGURED);
-		/*not reached */
+	if (req->netmaskbits && *req->netmaskbits != EOS) {
+		best_netmask = req->netmask;
+	}else if (best_netmask == 0L) {
+		/*
+		   On some distributions, there is no loopback related route
+		   item, this leads to the error here.
+		   My fix may be not good enough, please FIXME
+		 */
+		if (0 == strncmp(req->address, "127", 3)) {
+			if (NULL != get_first_loopback_netdev(best_if)) {
+				best_netmask = 0x000000ff;
+			} else {
+				snprintf(errmsg, errmsglen
+				,	"No loopback interface found.\n");
+				return(OCF_ERR_GENERIC);
+			}
+		} else {
+			snprintf(errmsg, errmsglen
+			,	"ERROR: Cannot use default route w/o netmask [%s]\n"
+			,	 req->address);
+			return(OCF_ERR_GENERIC);
+		}
 	}
 
-	bits = 32 - bits;
-	*netmask = (1L<<(bits))-1L;
-	*netmask = ((~(*netmask))&0xffffffffUL);
-	*netmask = htonl(*netmask);
+	if (req->bcast_arg && *req->bcast_arg != EOS) {
+		best_netmask = htonl(best_netmask);
+		if (!OutputInCIDR) {
+			snprintf(result, resultlen
+			,	"%s\tnetmask %d.%d.%d.%d\tbroadcast %s\n"
+			,	best_if
+                	,       (int)((best_netmask>>24) & 0xff)
+                	,       (int)((best_netmask>>16) & 0xff)
+                	,       (int)((best_netmask>>8) & 0xff)
+                	,       (int)(best_netmask & 0xff)
+			,	req->bcast_arg);
+		}else{
+			snprintf(result, resultlen
+			,	"%s\tnetmask %d\tbroadcast %s\n"
+			,	best_if
+			,	netmask_bits(best_netmask)
+			,	req->bcast_arg);
+		}
+	}else{
+		/* No, we use a common broadcast address convention */
+		unsigned long	def_bcast;
+
+			/* Common broadcast address */
+		def_bcast = (req->in.s_addr | (~best_netmask));
+#if DEBUG
+		fprintf(stderr, "best_netmask = %08lx, def_bcast = %08lx\n"
+		,	best_netmask,  def_bcast);
+#endif
+
+		/* Make things a bit more machine-independent */
+		best_netmask = htonl(best_netmask);
+		def_bcast = htonl(def_bcast);
+		if (!OutputInCIDR) {
+			snprintf(result, resultlen
+			,	"%s\tnetmask %d.%d.%d.%d\tbroadcast %d.%d.%d.%d\n"
+			,       best_if
+			,       (int)((best_netmask>>24) & 0xff)
+			,       (int)((best_netmask>>16) & 0xff)
+			,       (int)((best_netmask>>8) & 0xff)
+			,       (int)(best_netmask & 0xff)
+			,       (int)((def_bcast>>24) & 0xff)
+			,       (int)((def_bcast>>16) & 0xff)
+			,       (int)((def_bcast>>8) & 0xff)
+			,       (int)(def_bcast & 0xff));
+		}else{
+			snprintf(result, resultlen
+			,	"%s\tnetmask %d\tbroadcast %d.%d.%d.%d\n"
+			,       best_if
+			,	netmask_bits(best_netmask)
+			,       (int)((def_bcast>>24) & 0xff)
+			,       (int)((def_bcast>>16) & 0xff)
+			,       (int)((def_bcast>>8) & 0xff)
+			,       (int)(def_bcast & 0xff));
+		}
+	}
+	return(OCF_SUCCESS);
 }
 
-int
-ValidateIFName(const char *ifname, struct ifreq *ifr) 
+/*
+ * Batch mode: read "ip[/cidr_netmask[/nic[/broadcast]]]" lines from
+ * stdin and answer each with exactly one line on stdout, either the
+ * usual result or "ERROR<tab>rc<tab>message".  The routing table is
+ * read once up front; that is the main table only, so unlike a single
+ * lookup, policy routing rules are not applied (see -K).
+ */
+static int
+RunBatch(void)
 {
- 	int skfd = -1;
-	char *colonptr;
+	/* One pass over the routing table beats one netlink query each */
+	static SearchRoute *batch_mechs[] = {
+		&SearchUsingProcRoute,
+		&SearchUsingRouteCmd,
+		NULL
+	};
+	static SearchRoute6 *batch_mechs6[] = {
+		&SearchUsingProcRoute6,
+		NULL
+	};
+	char	line[2048];
+	char	result[2*MAXSTR];
+	char	errmsg[MAXSTR];
+	int	ret = OCF_SUCCESS;
+
+	while (fgets(line, sizeof(line), stdin) != NULL) {
+		struct findif_req req;
+		char	*fields[4] = { NULL, NULL, NULL, NULL };
+		char	*cp = line;
+		size_t	len = strlen(line);
+		int	j, rc;
+
+		while (len > 0 && isspace((int)line[len-1])) {
+			line[--len] = EOS;
+		}
+		for (j = 0; j < 4 && cp != NULL; ++j) {
+			fields[j] = cp;
+			if ((cp = strchr(cp, DELIM)) != NULL) {
+				*cp++ = EOS;
+			}
+		}
+		memset(&req, 0, sizeof(req));
+		req.address = fields[0];
+		req.netmaskbits = fields[1];
+		req.if_specified = fields[2];
+		req.bcast_arg = fields[3];
+
+		rc = CheckRequest(&req, errmsg, sizeof(errmsg));
+		if (rc == OCF_SUCCESS) {
+			rc = ResolveRequest(&req, batch_mechs, batch_mechs6
+			,	result, sizeof(result), errmsg, sizeof(errmsg));
+		}
+		if (rc == OCF_SUCCESS) {
+			fputs(result, stdout);
+		}else{
+			len = strlen(errmsg);
+			while (len > 0 && isspace((int)errmsg[len-1])) {
+				errmsg[--len] = EOS;
+			}
+			printf("ERROR\t%d\t%s\n", rc, errmsg);
+			ret = OCF_ERR_GENERIC;
+		}
+	}
+	FreeRouteTable(&route_table4);
+	FreeRouteTable(&route_table6);
+	return(ret);
+}
 
- 	if ( (skfd = socket(PF_INET, SOCK_DGRAM, 0)) == -1 ) {
- 		fprintf(stderr, "%s\n", strerror(errno));
- 		return -2;
- 	}
- 
-	strncpy(ifr->ifr_name, ifname, IFNAMSIZ);
+#ifdef HAVE_NETLINK_ROUTE_LOOKUP
+static double
+ElapsedNsec(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1e9
+	+	(to->tv_nsec - from->tv_nsec);
+}
 
-	/* Contain a ":"?  Probably an error, but treat as warning at present */
-	if ((colonptr = strchr(ifname, ':')) != NULL) {
-		fprintf(stderr, "%s: warning: name may be invalid\n",
-		  ifr->ifr_name);
+/*
+ * Self-check for the route trie: look up count addresses, every other
+ * one picked inside a prefix of the table and the rest at random, both
+ * in the trie and in the kernel, and report any disagreement along with
+ * the time either took.  Batch and daemon mode only know the main table,
+ * since that is all /proc/net/route shows, so a kernel answer from any
+ * other table (policy routing) counts as a mismatch as well.
+ */
+static int
+CheckAgainstKernel(long count)
+{
+	struct timespec	t0, t1, t2;
+	double	trie_ns = 0, kernel_ns = 0;
+	long	compared = 0, skipped = 0, mismatches = 0, j;
+	char	errmsg[MAXSTR];
+	int	ret = OCF_SUCCESS;
+
+	if (LoadProcRoute(errmsg, sizeof(errmsg)) != OCF_SUCCESS) {
+		fprintf(stderr, "%s\n", errmsg);
+		FreeRouteTable(&route_table4);
+		return(OCF_ERR_GENERIC);
 	}
- 
- 	if (ioctl(skfd, SIOCGIFFLAGS, ifr) < 0) {
- 		fprintf(stderr, "%s: unknown interface: %s\n"
- 			, ifr->ifr_name, strerror(errno));
- 		close(skfd);
-		/* return -1 only if ifname is known to be invalid */
-		return -1;
- 	}
- 	close(skfd);
- 	return 0;
-} 
+	srandom(time(NULL) ^ getpid());
+
+	for (j = 0; j < count; ++j) {
+		struct in_addr	in;
+		struct nl_route	route;
+		char	kif[IF_NAMESIZE];
+		char	addrstr[INET_ADDRSTRLEN];
+		uint32_t a = ((uint32_t)random() << 16) ^ (uint32_t)random();
+		int	t, k_rc;
+
+		if ((j & 1) && route_table4.count > 0) {
+			struct route_entry *re = &route_table4.routes[
+				random() % route_table4.count];
+			uint32_t mask = ntohl(PrefixToNetmask(re->prefixlen));
+			uint32_t dest;
+
+			memcpy(&dest, re->dest, sizeof(dest));
+			a = ntohl(dest) | (a & ~mask);
+		}
+		in.s_addr = htonl(a);
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		t = RouteTableLookup(&route_table4, &in.s_addr);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		k_rc = NetlinkRouteLookup(AF_INET, &in.s_addr, &route);
+		clock_gettime(CLOCK_MONOTONIC, &t2);
+		trie_ns += ElapsedNsec(&t0, &t1);
+		kernel_ns += ElapsedNsec(&t1, &t2);
+
+		switch (k_rc) {
+		case 0:
+			if (route.type != RTN_UNICAST) {
+				/* local, broadcast, ... */
+				++skipped;
+				continue;
+			}
+			if (if_indextoname(route.oif, kif) == NULL) {
+				strcpy(kif, "?");
+			}
+			break;
+		case -ENETUNREACH:
+		case -EHOSTUNREACH:
+		case -EACCES:
+		case -EINVAL:
+			/* unreachable, prohibit, blackhole, or no route */
+			route.prefixlen = 0;
+			strcpy(kif, "-");
+			break;
+		case -EOPNOTSUPP:
+			fprintf(stderr, "Kernel lookup lacks RTM_F_FIB_MATCH\n");
+			ret = OCF_ERR_UNIMPLEMENTED;
+			goto out;
+		default:
+			fprintf(stderr, "Kernel lookup failed: %s\n"
+			,	strerror(-k_rc));
+			ret = OCF_ERR_GENERIC;
+			goto out;
+		}
 
-int
-netmask_bits(unsigned long netmask)
+		++compared;
+		if (k_rc == 0 && route.table != RT_TABLE_MAIN) {
+			inet_ntop(AF_INET, &in, addrstr, sizeof(addrstr));
+			printf("MISMATCH %s\tkernel %s/%d table %u\ttrie %s/%d\n"
+			,	addrstr, kif, route.prefixlen, route.table
+			,	t < 0 ? "-" : route_table4.routes[t].ifname
+			,	t < 0 ? 0 : route_table4.routes[t].prefixlen);
+			++mismatches;
+		}else if (t < 0 ? strcmp(kif, "-") != 0
+		:	(strcmp(kif, route_table4.routes[t].ifname) != 0
+			||	route.prefixlen != route_table4.routes[t].prefixlen)) {
+			inet_ntop(AF_INET, &in, addrstr, sizeof(addrstr));
+			printf("MISMATCH %s\tkernel %s/%d\ttrie %s/%d\n"
+			,	addrstr, kif, route.prefixlen
+			,	t < 0 ? "-" : route_table4.routes[t].ifname
+			,	t < 0 ? 0 : route_table4.routes[t].prefixlen);
+			++mismatches;
+		}
+	}
+
+  out:
+	printf("%lu routes, %ld lookups compared, %ld skipped"
+	", %ld mismatches\n"
+	,	(unsigned long)route_table4.count, compared, skipped, mismatches);
+	if (compared + skipped > 0) {
+		printf("trie %.0f ns/lookup, kernel %.0f ns/lookup\n"
+		,	trie_ns / (compared + skipped)
+		,	kernel_ns / (compared + skipped));
+	}
+	FreeRouteTable(&route_table4);
+	if (ret == OCF_SUCCESS && mismatches > 0) {
+		ret = OCF_ERR_GENERIC;
+	}
+	return(ret);
+}
+#endif /* HAVE_NETLINK_ROUTE_LOOKUP */
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+/*
+ * Resolver daemon (-d socket): keep the main routing tables in memory,
+ * follow the kernel's route and link notifications one change at a
+ * time, and answer batch mode style requests on a Unix socket.
+ * The client side (-c socket) sends the OCF_RESKEY_* request and
+ * prints the answer, falling back to a lookup of its own when no daemon
+ * is listening.
+ *
+ * Protocol, one request per connection:
+ *	request:  ["-C "]ip/cidr_netmask/nic/broadcast\n
+ *	answer:   rc\tresult or error message\n
+ *
+ * Address changes need no subscription of their own: the kernel adds
+ * and removes the prefix routes that go with them, and those arrive as
+ * route notifications.  Not so when a link goes down or away: the
+ * kernel then flushes its IPv4 routes without a word, so we drop them
+ * from the cache ourselves.  IPv6 routes are announced as they go.
+ */
+#define	DAEMON_RCVBUF	(4*1024*1024)
+#define	DAEMON_TIMEOUT	2	/* seconds a client may take to talk */
+#define	DAEMON_CLIENTS	64	/* connections served at the same time */
+
+/* A connection whose request line has not arrived in full yet */
+struct daemon_client {
+	int	fd;
+	time_t	since;
+	size_t	len;
+	char	line[2048];
+};
+
+struct link_entry {
+	int	ifindex;
+	char	name[IFNAMSIZ];
+};
+
+static struct link_entry	*link_cache = NULL;
+static size_t			link_count = 0;
+static volatile sig_atomic_t	daemon_stop = 0;
+
+static const char *
+LinkName(int ifindex)
+{
+	size_t	j;
+
+	for (j = 0; j < link_count; ++j) {
+		if (link_cache[j].ifindex == ifindex) {
+			return link_cache[j].name;
+		}
+	}
+	return NULL;
+}
+
+static void
+RenameRoutes(struct route_table *rt, int ifindex, const char *name)
+{
+	size_t	j;
+
+	for (j = 0; j < rt->count; ++j) {
+		if (rt->routes[j].prefixlen >= 0
+		&&	rt->routes[j].ifindex == ifindex) {
+			strncpy(rt->routes[j].ifname, name, IFNAMSIZ-1);
+			rt->routes[j].ifname[IFNAMSIZ-1] = EOS;
+		}
+	}
+}
+
+/* Forget the routes through a link the kernel took them away from */
+static void
+DropRoutes(struct route_table *rt, int ifindex)
+{
+	size_t	j;
+
+	for (j = 0; j < rt->count; ++j) {
+		if (rt->routes[j].prefixlen >= 0
+		&&	rt->routes[j].ifindex == ifindex) {
+			RemoveRoute(rt, j);
+		}
+	}
+}
+
+static int
+SetLink(int ifindex, const char *name)
+{
+	struct link_entry *le;
+	size_t	j;
+
+	for (j = 0; j < link_count; ++j) {
+		if (link_cache[j].ifindex == ifindex) {
+			break;
+		}
+	}
+	if (j == link_count) {
+		le = realloc(link_cache, (link_count + 1) * sizeof(*le));
+		if (le == NULL) {
+			return -1;
+		}
+		link_cache = le;
+		link_cache[link_count++].ifindex = ifindex;
+	}else if (strncmp(link_cache[j].name, name, IFNAMSIZ) == 0) {
+		return 0;
+	}
+	strncpy(link_cache[j].name, name, IFNAMSIZ-1);
+	link_cache[j].name[IFNAMSIZ-1] = EOS;
+
+	/* New or renamed: routes may have come in before the link did */
+	RenameRoutes(&route_table4, ifindex, link_cache[j].name);
+	RenameRoutes(&route_table6, ifindex, link_cache[j].name);
+	return 0;
+}
+
+static void
+DelLink(int ifindex)
+{
+	size_t	j;
+
+	for (j = 0; j < link_count; ++j) {
+		if (link_cache[j].ifindex == ifindex) {
+			link_cache[j] = link_cache[--link_count];
+			return;
+		}
+	}
+}
+
+/*
+ * Decode a route message into re; returns the table it belongs in,
+ * or NULL for anything /proc/net/route would not list either.
+ */
+static struct route_table *
+RouteFromMsg(struct nlmsghdr *nlh, struct route_entry *re)
+{
+	struct rtmsg	*rtm = NLMSG_DATA(nlh);
+	struct route_table *rt;
+	struct rtattr	*rta;
+	unsigned int	table = rtm->rtm_table;
+	const char	*name;
+	int		len;
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*rtm))
+	||	(rtm->rtm_flags & RTM_F_CLONED)) {
+		return NULL;
+	}
+	switch (rtm->rtm_family) {
+	case AF_INET:
+		rt = &route_table4;
+		break;
+	case AF_INET6:
+		rt = &route_table6;
+		break;
+	default:
+		return NULL;
+	}
+
+	memset(re, 0, sizeof(*re));
+	re->next = -1;
+	switch (rtm->rtm_type) {
+	case RTN_UNICAST:
+		break;
+	case RTN_UNREACHABLE:
+	case RTN_PROHIBIT:
+	case RTN_BLACKHOLE:
+		re->reject = 1;
+		break;
+	default:
+		return NULL;
+	}
+	re->prefixlen = rtm->rtm_dst_len;
+
+	len = RTM_PAYLOAD(nlh);
+	for (rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case RTA_DST:
+			memcpy(re->dest, RTA_DATA(rta)
+			,	RTA_PAYLOAD(rta) < 16 ? RTA_PAYLOAD(rta) : 16);
+			break;
+		case RTA_OIF:
+			re->ifindex = *(int *)RTA_DATA(rta);
+			break;
+		case RTA_PRIORITY:
+			re->metric = *(uint32_t *)RTA_DATA(rta);
+			break;
+		case RTA_TABLE:
+			table = *(unsigned int *)RTA_DATA(rta);
+			break;
+		case RTA_MULTIPATH:
+			if (re->ifindex == 0
+			&&	RTA_PAYLOAD(rta) >= sizeof(struct rtnexthop)) {
+				struct rtnexthop *rtnh = RTA_DATA(rta);
+				re->ifindex = rtnh->rtnh_ifindex;
+			}
+			break;
+		}
+	}
+	if (table != RT_TABLE_MAIN || re->prefixlen > rt->maxlen) {
+		return NULL;
+	}
+
+	if (re->reject) {
+		strcpy(re->ifname, "*");
+	}else if ((name = LinkName(re->ifindex)) != NULL) {
+		strncpy(re->ifname, name, IFNAMSIZ);
+		re->ifname[IFNAMSIZ-1] = EOS;
+	}
+	return rt;
+}
+
+/* Index of the cached route matching re exactly, or -1 */
+static int
+FindRoute(struct route_table *rt, const struct route_entry *re, int any_nexthop)
+{
+	struct trie_node *n = TrieFindNode(rt, re->dest, re->prefixlen);
+	int	j;
+
+	for (j = n ? n->route : -1; j >= 0; j = rt->routes[j].next) {
+		if (rt->routes[j].metric == re->metric
+		&&	(any_nexthop || (rt->routes[j].ifindex == re->ifindex
+			&&	rt->routes[j].reject == re->reject))) {
+			return j;
+		}
+	}
+	return -1;
+}
+
+/* Apply one link or route message, from a dump or a notification */
+static int
+ApplyNetlinkMsg(struct nlmsghdr *nlh, void *arg)
+{
+	struct route_entry	re;
+	struct route_table	*rt;
+	int	j;
+
+	switch (nlh->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK: {
+		struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+		struct rtattr	*rta;
+		int	len = IFLA_PAYLOAD(nlh);
+
+		if (nlh->nlmsg_type == RTM_DELLINK) {
+			DropRoutes(&route_table4, ifi->ifi_index);
+			DelLink(ifi->ifi_index);
+			break;
+		}
+		if (!(ifi->ifi_flags & IFF_UP)) {
+			DropRoutes(&route_table4, ifi->ifi_index);
+		}
+		for (rta = IFLA_RTA(ifi); RTA_OK(rta, len)
+		;	rta = RTA_NEXT(rta, len)) {
+			if (rta->rta_type == IFLA_IFNAME
+			&&	SetLink(ifi->ifi_index, RTA_DATA(rta)) < 0) {
+				return -ENOMEM;
+			}
+		}
+		break;
+	}
+	case RTM_NEWROUTE:
+		if ((rt = RouteFromMsg(nlh, &re)) == NULL) {
+			break;
+		}
+		/* "ip route replace" swaps the nexthop of an existing route */
+		j = FindRoute(rt, &re, nlh->nlmsg_flags & NLM_F_REPLACE);
+		if (j >= 0) {
+			re.next = rt->routes[j].next;
+			rt->routes[j] = re;
+			break;
+		}
+		{
+			struct route_entry *nre = AddRoute(rt);
+
+			if (nre == NULL) {
+				return -ENOMEM;
+			}
+			j = nre - rt->routes;
+			*nre = re;
+			if (TrieInsert(rt, j) < 0) {
+				return -ENOMEM;
+			}
+		}
+		break;
+	case RTM_DELROUTE:
+		if ((rt = RouteFromMsg(nlh, &re)) != NULL
+		&&	(j = FindRoute(rt, &re, 0)) >= 0) {
+			RemoveRoute(rt, j);
+		}
+		break;
+	}
+	return 0;
+}
+
+static int
+DumpRequest(int type, int family)
+{
+	struct {
+		struct nlmsghdr	nlh;
+		struct rtmsg	rtm;
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req.nlh.nlmsg_type = type;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+	req.rtm.rtm_family = family;
+	return NetlinkTalk(&req.nlh, ApplyNetlinkMsg, NULL);
+}
+
+/* (Re)build the whole cache from kernel dumps */
+static int
+LoadNetlinkCache(void)
+{
+	int	rc;
+
+	FreeRouteTable(&route_table4);
+	FreeRouteTable(&route_table6);
+	link_count = 0;
+
+	if ((rc = DumpRequest(RTM_GETLINK, AF_UNSPEC)) < 0
+	||	(rc = DumpRequest(RTM_GETROUTE, AF_INET)) < 0
+	||	(rc = DumpRequest(RTM_GETROUTE, AF_INET6)) < 0) {
+		return rc;
+	}
+	route_table4.loaded = route_table6.loaded = 1;
+	return 0;
+}
+
+/*
+ * Apply whatever notifications are queued.  If we fell behind and the
+ * kernel dropped some, the cache cannot be trusted: rebuild it.
+ */
+static int
+DrainNotifications(int nlfd)
 {
-	int	j;
+	char	buf[NL_BUFSIZE];
+	ssize_t	len;
 
-	netmask = netmask & 0xFFFFFFFFUL;
+	for (;;) {
+		struct nlmsghdr *nlh;
 
-	for (j=0; j <= 32; ++j) {
-		if ((netmask >> j)&0x1) {
-			break;
+		len = recv(nlfd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			if (errno == ENOBUFS) {
+				fprintf(stderr, "%s: lost route notifications"
+				", reloading\n", cmdname);
+				if (LoadNetlinkCache() < 0) {
+					return -1;
+				}
+				continue;
+			}
+			return -1;
+		}
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (size_t)len)
+		;	nlh = NLMSG_NEXT(nlh, len)) {
+			if (ApplyNetlinkMsg(nlh, NULL) < 0) {
+				return -1;
+			}
 		}
 	}
+}
 
-	return 32 - j;
+static void
+DaemonSignal(int sig)
+{
+	daemon_stop = 1;
 }
 
-char * 
-get_first_loopback_netdev(char * output)
+/* Answer the request line of a client; line is taken apart */
+static void
+ServeClient(int fd, char *line, int nlfd)
 {
-	char buf[512];
-	FILE * fd = NULL;
-	char *rc = NULL;
-	
-	if (!output) {
-		fprintf(stderr, "output buf is a null pointer.\n");
-		goto out;
+	SearchRoute *mechs[] = { &SearchUsingProcRoute, NULL };
+	SearchRoute6 *mechs6[] = { &SearchUsingProcRoute6, NULL };
+	struct findif_req req;
+	char	result[2*MAXSTR];
+	char	errmsg[MAXSTR];
+	char	answer[3*MAXSTR];
+	char	*fields[4] = { NULL, NULL, NULL, NULL };
+	char	*cp;
+	size_t	len;
+	int	j, rc;
+
+	if ((cp = strchr(line, '\n')) != NULL) {
+		*cp = EOS;
 	}
 
-	fd = fopen(PATH_PROC_NET_DEV, "r");
-	if (!fd) {
-		fprintf(stderr, "Warning: cannot open %s (%s).\n",
-			PATH_PROC_NET_DEV, strerror(errno)); 
-		goto out;
+	/* Answer from the kernel's current view, not a stale one */
+	if (DrainNotifications(nlfd) < 0) {
+		daemon_stop = 1;
 	}
 
-	/* Skip the first two lines */
-	if (!fgets(buf, sizeof(buf), fd) || !fgets(buf, sizeof(buf), fd)) {
-		fprintf(stderr, "Warning: cannot read header from %s.\n",
-			PATH_PROC_NET_DEV);
-		goto out;
+	cp = line;
+	OutputInCIDR = 0;
+	if (strncmp(cp, "-C ", 3) == 0) {
+		OutputInCIDR = 1;
+		cp += 3;
 	}
-
-	while (fgets(buf, sizeof(buf), fd)) {
-		char name[IFNAMSIZ];
-		if (NULL == get_ifname(buf, name)) {
-			/* Maybe somethin is wrong, anyway continue */
-			continue;
+	for (j = 0; j < 4 && cp != NULL; ++j) {
+		fields[j] = cp;
+		if ((cp = strchr(cp, DELIM)) != NULL) {
+			*cp++ = EOS;
 		}
-		if (is_loopback_interface(name)) {
-			strncpy(output, name, IFNAMSIZ);
-			rc = output;
-			goto out;
+	}
+	memset(&req, 0, sizeof(req));
+	req.address = fields[0];
+	req.netmaskbits = fields[1];
+	req.if_specified = fields[2];
+	req.bcast_arg = fields[3];
+
+	rc = CheckRequest(&req, errmsg, sizeof(errmsg));
+	if (rc == OCF_SUCCESS) {
+		rc = ResolveRequest(&req, mechs, mechs6, result, sizeof(result)
+		,	errmsg, sizeof(errmsg));
+	}
+	if (rc == OCF_SUCCESS) {
+		snprintf(answer, sizeof(answer), "%d\t%s", rc, result);
+	}else{
+		len = strlen(errmsg);
+		while (len > 0 && isspace((int)errmsg[len-1])) {
+			errmsg[--len] = EOS;
 		}
+		snprintf(answer, sizeof(answer), "%d\t%s\n", rc, errmsg);
 	}
+	if (write(fd, answer, strlen(answer)) < 0) {
+		/* client gave up on us; nothing to do about it */
+	}
+}
 
-out:
-	if (fd) {
-		fclose(fd);
+/*
+ * Take in what a client has sent so far.  Returns 1 once the request
+ * line is complete (or the client stopped sending), 0 to wait for more.
+ */
+static int
+ReadClient(struct daemon_client *cl)
+{
+	ssize_t	n;
+
+	for (;;) {
+		n = read(cl->fd, cl->line + cl->len
+		,	sizeof(cl->line) - 1 - cl->len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : 1;
+		}
+		if (n == 0) {
+			return 1;
+		}
+		cl->len += n;
+		cl->line[cl->len] = EOS;
+		if (memchr(cl->line + cl->len - n, '\n', n) != NULL
+		||	cl->len == sizeof(cl->line) - 1) {
+			return 1;
+		}
 	}
-	return rc;
 }
 
-int
-is_loopback_interface(char * ifname)
+static time_t
+MonotonicSec(void)
 {
-	struct ifreq ifr;
-	memset(&ifr, 0, sizeof(ifr));
-	if (ValidateIFName(ifname, &ifr) < 0)
-		return 0;
+	struct timespec	ts;
 
-	if (ifr.ifr_flags & IFF_LOOPBACK) {
-		/* this is a loopback device. */
-		return 1;
-	} else {
-		return 0;
-	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
 }
 
-char *
-get_ifname(char * buf, char * ifname)
+/*
+ * Clients are non-blocking and polled along with everything else, so a
+ * slow or idle one delays nobody; it is dropped after DAEMON_TIMEOUT.
+ */
+static int
+RunDaemon(const char *path)
 {
-	char * start, * end, * buf_border;	
+	struct sockaddr_nl	nladdr;
+	struct sockaddr_un	sun;
+	struct sigaction	sa;
+	struct pollfd		pfd[2 + DAEMON_CLIENTS];
+	struct daemon_client	*clients = NULL;
+	int	nclients = 0;
+	int	nlfd = -1, lfd = -1;
+	int	rcvbuf = DAEMON_RCVBUF;
+	int	ret = OCF_ERR_GENERIC;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "Socket path too long [%s]\n", path);
+		return(OCF_ERR_CONFIGURED);
+	}
 
-	buf_border = buf + strnlen(buf, 512);
+	/* Subscribe before the dump so that no change falls in between */
+	nlfd = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (nlfd < 0) {
+		fprintf(stderr, "netlink socket: %s\n", strerror(errno));
+		goto out;
+	}
+	setsockopt(nlfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	memset(&nladdr, 0, sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
+	nladdr.nl_groups = RTMGRP_LINK|RTMGRP_IPV4_ROUTE|RTMGRP_IPV6_ROUTE;
+	if (bind(nlfd, (struct sockaddr *)&nladdr, sizeof(nladdr)) < 0) {
+		fprintf(stderr, "netlink bind: %s\n", strerror(errno));
+		goto out;
+	}
+	if (LoadNetlinkCache() < 0) {
+		fprintf(stderr, "Cannot read routing tables via netlink\n");
+		goto out;
+	}
 
-	start = buf; 
-	while (isspace((int) *start) && (start != buf_border)) {
-		start++;
+	lfd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if (lfd < 0) {
+		fprintf(stderr, "socket: %s\n", strerror(errno));
+		goto out;
 	}
-	end = start;
-	while ((*end != ':') && (end != buf_border)) {
-		end++;	
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+	unlink(path);
+	if (bind(lfd, (struct sockaddr *)&sun, sizeof(sun)) < 0
+	||	listen(lfd, 64) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto out;
 	}
 
-	if ( start == buf_border || end == buf_border ) {
-		/* Over the border of buf */ 
-		return NULL;
+	clients = calloc(DAEMON_CLIENTS, sizeof(*clients));
+	if (clients == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		goto out;
 	}
 
-	*end = '\0';
-	strncpy(ifname, start, IFNAMSIZ);
-	
-	return ifname;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = DaemonSignal;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	pfd[0].fd = nlfd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = lfd;
+	while (!daemon_stop) {
+		time_t	now;
+		int	j;
+
+		/* A full house leaves new connections in the listen queue */
+		pfd[1].events = nclients < DAEMON_CLIENTS ? POLLIN : 0;
+		for (j = 0; j < nclients; ++j) {
+			pfd[2 + j].fd = clients[j].fd;
+			pfd[2 + j].events = POLLIN;
+			pfd[2 + j].revents = 0;
+		}
+		if (poll(pfd, 2 + nclients, nclients ? 1000 : -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "poll: %s\n", strerror(errno));
+			break;
+		}
+		if ((pfd[0].revents & POLLIN) && DrainNotifications(nlfd) < 0) {
+			fprintf(stderr, "Lost track of the routing tables\n");
+			break;
+		}
+
+		now = MonotonicSec();
+		for (j = nclients; j-- > 0; ) {
+			struct daemon_client *cl = &clients[j];
+
+			if (pfd[2 + j].revents) {
+				if (!ReadClient(cl)) {
+					continue;
+				}
+				ServeClient(cl->fd, cl->line, nlfd);
+			}else if (now - cl->since < DAEMON_TIMEOUT) {
+				continue;
+			}
+			close(cl->fd);
+			*cl = clients[--nclients];
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			while (nclients < DAEMON_CLIENTS) {
+				int	fd = accept4(lfd, NULL, NULL
+				,	SOCK_NONBLOCK|SOCK_CLOEXEC);
+
+				if (fd < 0) {
+					break;
+				}
+				clients[nclients].fd = fd;
+				clients[nclients].since = now;
+				clients[nclients].len = 0;
+				++nclients;
+			}
+		}
+	}
+	ret = daemon_stop ? OCF_SUCCESS : OCF_ERR_GENERIC;
+	unlink(path);
+
+  out:
+	while (nclients > 0) {
+		close(clients[--nclients].fd);
+	}
+	free(clients);
+	if (lfd >= 0) {
+		close(lfd);
+	}
+	if (nlfd >= 0) {
+		close(nlfd);
+	}
+	FreeRouteTable(&route_table4);
+	FreeRouteTable(&route_table6);
+	free(link_cache);
+	return(ret);
 }
 
-int ConvertQuadToInt(char *dest)
+/*
+ * Ask a resolver daemon.  Returns <0 when there is none to ask, so the
+ * caller can resolve the request itself.
+ */
+static int
+RunClient(const char *path, struct findif_req *req)
 {
-	struct in_addr ad;
-
-	if (inet_pton(AF_INET, dest, &ad) <= 0)
+	struct sockaddr_un	sun;
+	struct timeval	tv = { DAEMON_TIMEOUT, 0 };
+	char	buf[3*MAXSTR];
+	char	*cp;
+	size_t	len = 0;
+	ssize_t	n;
+	int	fd, rc;
+
+	if (strlen(path) >= sizeof(sun.sun_path)
+	||	(fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) < 0) {
+		return -1;
+	}
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+#define	FIELD(f)	((f) ? (f) : "")
+	snprintf(buf, sizeof(buf), "%s%s/%s/%s/%s\n"
+	,	OutputInCIDR ? "-C " : ""
+	,	FIELD(req->address), FIELD(req->netmaskbits)
+	,	FIELD(req->if_specified), FIELD(req->bcast_arg));
+#undef	FIELD
+
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0
+	||	write(fd, buf, strlen(buf)) != (ssize_t)strlen(buf)) {
+		close(fd);
 		return -1;
+	}
+	while (len < sizeof(buf) - 1
+	&&	(n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0) {
+		len += n;
+	}
+	close(fd);
+	buf[len] = EOS;
 
-	return netmask_bits(ntohl(ad.s_addr));
+	if ((cp = strchr(buf, '\t')) == NULL || strchr(cp, '\n') == NULL) {
+		return -1;
+	}
+	*cp++ = EOS;
+	rc = atoi(buf);
+	fputs(cp, rc == OCF_SUCCESS ? stdout : stderr);
+	return(rc);
 }
+#endif /* HAVE_LINUX_RTNETLINK_H */
 
 int
 main(int argc, char ** argv) {
 
-	char *	address = NULL;
-	char *	bcast_arg = NULL;
-	char *	netmaskbits = NULL;
-	struct in_addr	in;
-	struct in_addr	addr_out;
-	unsigned long	netmask;
-	char	best_if[MAXSTR];
-	char *	if_specified = NULL;
-	struct ifreq	ifr;
-	unsigned long	best_netmask = INT_MAX;
-	int		argerrs	= 0;
-	int		nmbits;
+	struct findif_req	req;
+	char	result[2*MAXSTR];
+	char	errmsg[MAXSTR];
+	int	batch = 0;
+	long	check = 0;
+	char	*daemon_path = NULL;
+	char	*client_path = NULL;
+	int	argerrs	= 0;
+	int	rc, j;
 
 	cmdname=argv[0];
 
-
-	memset(&addr_out, 0, sizeof(addr_out));
-	memset(&in, 0, sizeof(in));
-	memset(&ifr, 0, sizeof(ifr));
-
-	switch (argc) {
-	case 1:	/* No -C argument */
-		break;
-	case 2: /* Hopefully a -C argument */
-		if (strncmp(argv[1], "-C", sizeof("-C")) != 0) {
+	for (j = 1; j < argc; ++j) {
+		if (strncmp(argv[j], "-C", sizeof("-C")) == 0) {
+			OutputInCIDR=1;
+		}else if (strncmp(argv[j], "-b", sizeof("-b")) == 0) {
+			batch=1;
+		}else if (strncmp(argv[j], "-K", sizeof("-K")) == 0
+		&&	j + 1 < argc && (check = atol(argv[j+1])) > 0) {
+			++j;
+		}else if (strncmp(argv[j], "-d", sizeof("-d")) == 0
+		&&	j + 1 < argc) {
+			daemon_path = argv[++j];
+		}else if (strncmp(argv[j], "-c", sizeof("-c")) == 0
+		&&	j + 1 < argc) {
+			client_path = argv[++j];
+		}else{
 			argerrs=1;
 		}
-		OutputInCIDR=1;
-		break;
-	default:
-		argerrs=1;
-		break;
 	}
 	if (argerrs) {
 		usage(OCF_ERR_ARGS);
@@ -598,160 +2530,52 @@ main(int argc, char ** argv) {
 		return(1);
 	}
 
-	GetAddress (&address, &netmaskbits, &bcast_arg
-	,	 &if_specified);
-	if (address == NULL || *address == EOS) {
-		fprintf(stderr, "ERROR: IP address parameter is mandatory.");
-		usage(OCF_ERR_CONFIGURED);
-		/* not reached */
+	if (batch) {
+		return(RunBatch());
 	}
-
-	/* Is the IP address we're supposed to find valid? */
-	 
-	if (inet_pton(AF_INET, address, (void *)&in) <= 0) {
-		fprintf(stderr, "IP address [%s] not valid.", address);
-		usage(OCF_ERR_CONFIGURED);
-		/* not reached */
+	if (check) {
+#ifdef HAVE_NETLINK_ROUTE_LOOKUP
+		return(CheckAgainstKernel(check));
+#else
+		fprintf(stderr, "No kernel route lookup to check against.\n");
+		return(OCF_ERR_UNIMPLEMENTED);
+#endif
 	}
-
-	if (netmaskbits != NULL && *netmaskbits != EOS) {
-		if (strchr(netmaskbits, '.') != NULL) {
-			nmbits = ConvertQuadToInt(netmaskbits);
-			fprintf(stderr, "Converted dotted-quad netmask to CIDR as: %d\n", nmbits);
-		}else{
-			nmbits = ConvertNetmaskBitsToInt(netmaskbits);
-		}
-
-		if (nmbits < 0) {
-			fprintf(stderr, "Invalid netmask specification"
-			" [%s]", netmaskbits);
-			usage(OCF_ERR_CONFIGURED);
-			/*not reached */
-		}
-
-		/* Validate the netmaskbits field */
-		ValidateNetmaskBits (nmbits, &netmask);
+	if (daemon_path) {
+#ifdef HAVE_LINUX_RTNETLINK_H
+		return(RunDaemon(daemon_path));
+#else
+		fprintf(stderr, "No netlink, no resolver daemon.\n");
+		return(OCF_ERR_UNIMPLEMENTED);
+#endif
 	}
 
+	memset(&req, 0, sizeof(req));
+	GetAddress (&req.address, &req.netmaskbits, &req.bcast_arg
+	,	 &req.if_specified);
 
-	if (if_specified != NULL && *if_specified != EOS) {
-		if(ValidateIFName(if_specified, &ifr) < 0) {
-			usage(OCF_ERR_CONFIGURED);
-			/* not reached */
-		}
-		strncpy(best_if, if_specified, sizeof(best_if));
-		*(best_if + sizeof(best_if) - 1) = '\0';
-	}else{
-		SearchRoute **sr = search_mechs;
-		char errmsg[MAXSTR] = "No valid mechanisms";
-		int rc = OCF_ERR_GENERIC;
-
-		strcpy(best_if, "UNKNOWN");
-
-		while (*sr) {
-			errmsg[0] = '\0';
-			rc = (*sr) (address, &in, &addr_out, best_if
-			,	sizeof(best_if)
-			,	&best_netmask, errmsg, sizeof(errmsg));
-			if (!rc) {		/* Mechanism worked */
-				break;
-			}
-			sr++;
-		}
-		if (rc != 0) {	/* No route, or all mechanisms failed */
-			if (*errmsg) {
-				fprintf(stderr, "%s", errmsg);
-			}
-			return(rc);
-		}
+	rc = CheckRequest(&req, errmsg, sizeof(errmsg));
+	if (rc != OCF_SUCCESS) {
+		fprintf(stderr, "%s", errmsg);
+		usage(rc);
+		/* not reached */
 	}
 
-	if (netmaskbits) {
-		best_netmask = netmask;
-	}else if (best_netmask == 0L) {
-		/*
-		   On some distributions, there is no loopback related route
-		   item, this leads to the error here.
-		   My fix may be not good enough, please FIXME
-		 */
-		if (0 == strncmp(address, "127", 3)) {
-			if (NULL != get_first_loopback_netdev(best_if)) {
-				best_netmask = 0x000000ff;
-			} else {
-				fprintf(stderr, "No loopback interface found.\n");
-				return(OCF_ERR_GENERIC);
-			}
-		} else {
-			fprintf(stderr
-			,	"ERROR: Cannot use default route w/o netmask [%s]\n"
-			,	 address);
-			return(OCF_ERR_GENERIC);
-		}
+#ifdef HAVE_LINUX_RTNETLINK_H
+	if (client_path && (rc = RunClient(client_path, &req)) >= 0) {
+		return(rc);
 	}
-
-	/* Did they tell us the broadcast address? */
-
-	if (bcast_arg && *bcast_arg != EOS) {
-		/* Yes, they gave us a broadcast address.
-		 * It at least should be a valid IP address
-		 */
- 		struct in_addr bcast_addr;
- 		if (inet_pton(AF_INET, bcast_arg, (void *)&bcast_addr) <= 0) {
- 			fprintf(stderr, "Invalid broadcast address [%s].", bcast_arg);
- 			usage(OCF_ERR_CONFIGURED);
-			/* not reached */
- 		}
-
-		best_netmask = htonl(best_netmask);
-		if (!OutputInCIDR) {
-			printf("%s\tnetmask %d.%d.%d.%d\tbroadcast %s\n"
-			,	best_if
-                	,       (int)((best_netmask>>24) & 0xff)
-                	,       (int)((best_netmask>>16) & 0xff)
-                	,       (int)((best_netmask>>8) & 0xff)
-                	,       (int)(best_netmask & 0xff)
-			,	bcast_arg);
-		}else{
-			printf("%s\tnetmask %d\tbroadcast %s\n"
-			,	best_if
-			,	netmask_bits(best_netmask)
-			,	bcast_arg);
-		}
-	}else{
-		/* No, we use a common broadcast address convention */
-		unsigned long	def_bcast;
-
-			/* Common broadcast address */
-		def_bcast = (in.s_addr | (~best_netmask));
-#if DEBUG
-		fprintf(stderr, "best_netmask = %08lx, def_bcast = %08lx\n"
-		,	best_netmask,  def_bcast);
 #endif
-
-		/* Make things a bit more machine-independent */
-		best_netmask = htonl(best_netmask);
-		def_bcast = htonl(def_bcast);
-		if (!OutputInCIDR) {
-			printf("%s\tnetmask %d.%d.%d.%d\tbroadcast %d.%d.%d.%d\n"
-			,       best_if
-			,       (int)((best_netmask>>24) & 0xff)
-			,       (int)((best_netmask>>16) & 0xff)
-			,       (int)((best_netmask>>8) & 0xff)
-			,       (int)(best_netmask & 0xff)
-			,       (int)((def_bcast>>24) & 0xff)
-			,       (int)((def_bcast>>16) & 0xff)
-			,       (int)((def_bcast>>8) & 0xff)
-			,       (int)(def_bcast & 0xff));
-		}else{
-			printf("%s\tnetmask %d\tbroadcast %d.%d.%d.%d\n"
-			,       best_if
-			,	netmask_bits(best_netmask)
-			,       (int)((def_bcast>>24) & 0xff)
-			,       (int)((def_bcast>>16) & 0xff)
-			,       (int)((def_bcast>>8) & 0xff)
-			,       (int)(def_bcast & 0xff));
+	/* No daemon (to ask): find out ourselves */
+	rc = ResolveRequest(&req, search_mechs, search_mechs6
+	,	result, sizeof(result), errmsg, sizeof(errmsg));
+	if (rc != OCF_SUCCESS) {
+		if (*errmsg) {
+			fprintf(stderr, "%s", errmsg);
 		}
+		return(rc);
 	}
+	fputs(result, stdout);
 	return(0);
 }
 
@@ -761,10 +2585,20 @@ usage(int ec)
 	fprintf(stderr, "\n"
 		"%s version 2.99.1 Copyright Alan Robertson\n"
 		"\n"
-		"Usage: %s [-C]\n"
+		"Usage: %s [-C] [-b | -K count | -d socket | -c socket]\n"
 		"Options:\n"
 		"    -C: Output netmask as the number of bits rather "
 			"than as 4 octets.\n"
+		"    -b: Batch mode: read ip[/cidr_netmask[/nic[/broadcast]]]\n"
+		"        lines from stdin, print one result line for each.\n"
+		"    -K: Compare route lookups for count random addresses\n"
+		"        against the kernel's, and time both.\n"
+		"    -d: Run as resolver daemon, answering on the Unix socket.\n"
+		"    -c: Ask the resolver daemon on the socket, if there is one.\n"
+		"Batch mode and the resolver daemon look addresses up in the\n"
+		"main routing table only, as /proc/net/route shows it.  Single\n"
+		"lookups ask the kernel, which also applies policy routing\n"
+		"rules; -K reports the addresses where the two disagree.\n"
 		"Environment variables:\n"
 		"OCF_RESKEY_ip		 ip address (mandatory!)\n"
 		"OCF_RESKEY_cidr_netmask netmask of interface\n"
@@ -47,6 +47,8 @@
 #include <clplumbing/cl_signal.h>
 #include <clplumbing/cl_log.h>
 
+#include "send_arp_sched.h"
+
 #ifdef HAVE_LIBNET_1_0_API
 #	define	LTYPE	struct libnet_link_int
 #endif
@@ -57,12 +59,34 @@
 #define PIDDIR       HA_VARRUNDIR "/" PACKAGE
 #define PIDFILE_BASE PIDDIR "/send_arp-"
 
-static int send_arp(LTYPE* l, u_int32_t ip, u_char *device, u_char mac[6]
-,	u_char *broadcast, u_char *netmask, u_short arptype);
+/*
+ * The request and reply packets are built once, before the first one
+ * is sent.  With libnet 1.0 both live in their own buffer; a libnet 1.1
+ * context holds one packet, so switching between request and reply
+ * only patches the ARP header in place.
+ */
+#ifdef HAVE_LIBNET_1_0_API
+struct arp_frames {
+	u_char	*buf[2];	/* request, reply */
+};
+#endif
+#ifdef HAVE_LIBNET_1_1_API
+struct arp_frames {
+	libnet_ptag_t	arp;
+	int		reply;
+	u_int32_t	ip;
+	u_char		mac[6];
+};
+#endif
+
+static int prepare_arp(LTYPE* l, u_int32_t ip, u_char *device, u_char mac[6]
+,	struct arp_frames *f);
+static int send_arp(LTYPE* l, u_char *device, struct arp_frames *f, int reply);
 
 static char print_usage[]={
 "send_arp: sends out custom ARP packet.\n"
-"  usage: send_arp [-i repeatinterval-ms] [-r repeatcount] [-p pidfile] \\\n"
+"  usage: send_arp [-i repeatinterval-ms] [-r repeatcount] [-B burst[,ms]] \\\n"
+"              [-p pidfile] \\\n"
 "              device src_ip_addr src_hw_addr broadcast_ip_addr netmask\n"
 "\n"
 "  where:\n"
@@ -78,6 +102,9 @@ static char print_usage[]={
 "    repeatcount: how many pairs of ARP packets to send.\n"
 "                 See above for why pairs are sent\n"
 "\n"
+"    burst: send the first burst pairs within ms milliseconds (50),\n"
+"           then double the interval per pair up to repeatinterval-ms\n"
+"\n"
 "    pidfile: pid file to use\n"
 "\n"
 "    device: netowrk interace to use\n"
@@ -131,14 +158,14 @@ main(int argc, char *argv[])
 	char*	device;
 	char*	ipaddr;
 	char*	macaddr;
-	char*	broadcast;
-	char*	netmask;
 	u_int32_t	ip;
 	u_char  src_mac[6];
 	LTYPE*	l;
 	int	repeatcount = 1;
 	int	j;
-	long	msinterval = 1000;
+	int	reply;
+	struct arp_frames frames;
+	struct arp_sched sched = ARP_SCHED_INIT;
 	int	flag;
 	char    pidfilenamebuf[64];
 	char    *pidfilename = NULL;
@@ -151,10 +178,16 @@ main(int argc, char *argv[])
         cl_log_set_facility(LOG_USER);
 	cl_inherit_logging_environment(0);
 
-	while ((flag = getopt(argc, argv, "i:r:p:")) != EOF) {
+	while ((flag = getopt(argc, argv, "i:r:p:B:")) != EOF) {
 		switch(flag) {
 
-		case 'i':	msinterval= atol(optarg);
+		case 'i':	sched.interval= atol(optarg);
+				break;
+
+		case 'B':	if (arp_sched_parse_burst(&sched, optarg) < 0) {
+					fprintf(stderr, "%s\n\n", print_usage);
+					return 1;
+				}
 				break;
 
 		case 'r':	repeatcount= atoi(optarg);
@@ -184,8 +217,7 @@ main(int argc, char *argv[])
 	device    = argv[optind];
 	ipaddr    = argv[optind+1];
 	macaddr   = argv[optind+2];
-	broadcast = argv[optind+3];
-	netmask   = argv[optind+4];
+	/* broadcast and netmask are ignored */
 
 	if (!pidfilename) {
 		if (snprintf(pidfilenamebuf, sizeof(pidfilenamebuf), "%s%s", 
@@ -246,27 +278,30 @@ main(int argc, char *argv[])
 		convert_macaddr((unsigned char *)macaddr, src_mac);
 	}
 
+	if (prepare_arp(l, ip, (unsigned char*)device, src_mac, &frames) < 0) {
+		unlink(pidfilename);
+		return EXIT_FAILURE;
+	}
+
 /*
  * We need to send both a broadcast ARP request as well as the ARP response we
  * were already sending.  All the interesting research work for this fix was
  * done by Masaki Hasegawa <masaki-h@pp.iij4u.or.jp> and his colleagues.
  */
-	for (j=0; j < repeatcount; ++j) {
-		c = send_arp(l, ip, (unsigned char*)device, src_mac
-			, (unsigned char*)broadcast, (unsigned char*)netmask
-			, ARPOP_REQUEST);
+	sched.pairs = 1;
+	arp_sched_start(&sched);
+	for (j=0; j < repeatcount; ) {
+		reply = sched.reply_due;
+		c = send_arp(l, (unsigned char*)device, &frames, reply);
 		if (c < 0) {
 			break;
 		}
-		mssleep(msinterval / 2);
-		c = send_arp(l, ip, (unsigned char*)device, src_mac
-			, (unsigned char *)broadcast
-			, (unsigned char *)netmask, ARPOP_REPLY);
-		if (c < 0) {
-			break;
+		if (reply) {
+			++j;
 		}
-		if (j != repeatcount-1) {
-			mssleep(msinterval / 2);
+		if (j < repeatcount) {
+			arp_sched_advance(&sched);
+			arp_sched_sleep(&sched);
 		}
 	}
 
@@ -388,22 +423,14 @@ get_hw_addr(char *device, u_char mac[6])
 
 #ifdef HAVE_LIBNET_1_0_API
 int
-send_arp(struct libnet_link_int *l, u_int32_t ip, u_char *device, u_char *macaddr, u_char *broadcast, u_char *netmask, u_short arptype)
+prepare_arp(struct libnet_link_int *l, u_int32_t ip, u_char *device, u_char macaddr[6], struct arp_frames *f)
 {
-	int n;
-	u_char *buf;
-	u_char *target_mac;
+	int i;
 	u_char device_mac[6];
 	u_char bcast_mac[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 	u_char zero_mac[6] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 
-
-	if (libnet_init_packet(LIBNET_ARP_H + LIBNET_ETH_H, &buf) == -1) {
-	cl_log(LOG_ERR, "libnet_init_packet memory:");
-		return -1;
-	}
-
-	/* Convert ASCII Mac Address to 6 Hex Digits. */
+	(void)l;
 
 	/* Ethernet header */
 	if (get_hw_addr((char*)device, device_mac) < 0) {
@@ -412,50 +439,55 @@ send_arp(struct libnet_link_int *l, u_int32_t ip, u_char *device, u_char *macadd
 		return -1;
 	}
 
-	if (libnet_build_ethernet(bcast_mac, device_mac, ETHERTYPE_ARP, NULL, 0
-	,	buf) == -1) {
-		cl_log(LOG_ERR, "libnet_build_ethernet failed:");
-		libnet_destroy_packet(&buf);
-		return -1;
-	}
+	for (i = 0; i < 2; i++) {
+		u_short arptype = i ? ARPOP_REPLY : ARPOP_REQUEST;
+		u_char *buf;
 
-	if (arptype == ARPOP_REQUEST) {
-		target_mac = zero_mac;
-	}
-	else if (arptype == ARPOP_REPLY) {
-		target_mac = macaddr;
-	}
-	else {
-		cl_log(LOG_ERR, "unkonwn arptype:");
-		return -1;
-	}
+		if (libnet_init_packet(LIBNET_ARP_H + LIBNET_ETH_H, &buf) == -1) {
+			cl_log(LOG_ERR, "libnet_init_packet memory:");
+			return -1;
+		}
+		f->buf[i] = buf;
 
-	/*
-	 *  ARP header
-	 */
-	if (libnet_build_arp(ARPHRD_ETHER,	/* Hardware address type */
-		ETHERTYPE_IP,			/* Protocol address type */
-		6,				/* Hardware address length */
-		4,				/* Protocol address length */
-		arptype,			/* ARP operation */
-		macaddr,			/* Source hardware addr */
-		(u_char *)&ip,			/* Target hardware addr */
-		target_mac,			/* Destination hw addr */
-		(u_char *)&ip,			/* Target protocol address */
-		NULL,				/* Payload */
-		0,				/* Payload length */
-		buf + LIBNET_ETH_H) == -1) {
-	        cl_log(LOG_ERR, "libnet_build_arp failed:");
-		libnet_destroy_packet(&buf);
-		return -1;
+		if (libnet_build_ethernet(bcast_mac, device_mac, ETHERTYPE_ARP, NULL, 0
+		,	buf) == -1) {
+			cl_log(LOG_ERR, "libnet_build_ethernet failed:");
+			return -1;
+		}
+
+		/*
+		 *  ARP header
+		 */
+		if (libnet_build_arp(ARPHRD_ETHER,	/* Hardware address type */
+			ETHERTYPE_IP,			/* Protocol address type */
+			6,				/* Hardware address length */
+			4,				/* Protocol address length */
+			arptype,			/* ARP operation */
+			macaddr,			/* Source hardware addr */
+			(u_char *)&ip,			/* Target hardware addr */
+			arptype == ARPOP_REPLY ? macaddr : zero_mac,
+							/* Destination hw addr */
+			(u_char *)&ip,			/* Target protocol address */
+			NULL,				/* Payload */
+			0,				/* Payload length */
+			buf + LIBNET_ETH_H) == -1) {
+			cl_log(LOG_ERR, "libnet_build_arp failed:");
+			return -1;
+		}
 	}
+	return 0;
+}
 
-	n = libnet_write_link_layer(l, (char*)device, buf, LIBNET_ARP_H + LIBNET_ETH_H);
+int
+send_arp(struct libnet_link_int *l, u_char *device, struct arp_frames *f, int reply)
+{
+	int n;
+
+	n = libnet_write_link_layer(l, (char*)device, f->buf[reply]
+	,	LIBNET_ARP_H + LIBNET_ETH_H);
 	if (n == -1) {
-		cl_log(LOG_ERR, "libnet_build_ethernet failed:");
+		cl_log(LOG_ERR, "libnet_write_link_layer failed:");
 	}
-
-	libnet_destroy_packet(&buf);
 	return (n);
 }
 #endif /* HAVE_LIBNET_1_0_API */
@@ -464,46 +496,53 @@ send_arp(struct libnet_link_int *l, u_int32_t ip, u_char *device, u_char *macadd
 
 
 #ifdef HAVE_LIBNET_1_1_API
-int
-send_arp(libnet_t* lntag, u_int32_t ip, u_char *device, u_char macaddr[6], u_char *broadcast, u_char *netmask, u_short arptype)
+/* (Re)build the ARP header; with f->arp set, libnet updates it in place */
+static int
+build_arp_header(libnet_t* lntag, struct arp_frames *f, int reply)
 {
-	int n;
-	u_char *target_mac;
-	u_char device_mac[6];
-	u_char bcast_mac[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 	u_char zero_mac[6] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-
-	if (arptype == ARPOP_REQUEST) {
-		target_mac = zero_mac;
-	}
-	else if (arptype == ARPOP_REPLY) {
-		target_mac = macaddr;
-	}
-	else {
-		cl_log(LOG_ERR, "unkonwn arptype:");
-		return -1;
-	}
+	libnet_ptag_t tag;
 
 	/*
 	 *  ARP header
 	 */
-	if (libnet_build_arp(ARPHRD_ETHER,	/* hardware address type */
+	tag = libnet_build_arp(ARPHRD_ETHER,	/* hardware address type */
 		ETHERTYPE_IP,	/* protocol address type */
 		6,		/* Hardware address length */
 		4,		/* protocol address length */
-		arptype,	/* ARP operation type */
-		macaddr,	/* sender Hardware address */
-		(u_int8_t *)&ip,	/* sender protocol address */
-		target_mac,	/* target hardware address */
-		(u_int8_t *)&ip,	/* target protocol address */
+		reply ? ARPOP_REPLY : ARPOP_REQUEST,
+				/* ARP operation type */
+		f->mac,		/* sender Hardware address */
+		(u_int8_t *)&f->ip,	/* sender protocol address */
+		reply ? f->mac : zero_mac,
+				/* target hardware address */
+		(u_int8_t *)&f->ip,	/* target protocol address */
 		NULL,		/* Payload */
 		0,		/* Length of payload */
 		lntag,		/* libnet context pointer */
-		0		/* packet id */
-	) == -1 ) {
+		f->arp		/* packet id */
+	);
+	if (tag == -1) {
 		cl_log(LOG_ERR, "libnet_build_arp failed:");
 		return -1;
 	}
+	f->arp = tag;
+	f->reply = reply;
+	return 0;
+}
+
+int
+prepare_arp(libnet_t* lntag, u_int32_t ip, u_char *device, u_char macaddr[6], struct arp_frames *f)
+{
+	u_char device_mac[6];
+	u_char bcast_mac[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+	f->arp = 0;
+	f->ip = ip;
+	memcpy(f->mac, macaddr, 6);
+	if (build_arp_header(lntag, f, 0) < 0) {
+		return -1;
+	}
 
 	/* Ethernet header */
 	if (get_hw_addr((char *)device, device_mac) < 0) {
@@ -517,13 +556,24 @@ send_arp(libnet_t* lntag, u_int32_t ip, u_char *device, u_char macaddr[6], u_cha
 		cl_log(LOG_ERR, "libnet_build_ethernet failed:");
 		return -1;
 	}
+	return 0;
+}
+
+int
+send_arp(libnet_t* lntag, u_char *device, struct arp_frames *f, int reply)
+{
+	int n;
+
+	(void)device;
+
+	if (f->reply != reply && build_arp_header(lntag, f, reply) < 0) {
+		return -1;
+	}
 
 	n = libnet_write(lntag);
 	if (n == -1) {
-		cl_log(LOG_ERR, "libnet_build_ethernet failed:");
+		cl_log(LOG_ERR, "libnet_write failed:");
 	}
-	libnet_clear_packet(lntag);
-
 	return (n);
 }
 #endif /* HAVE_LIBNET_1_1_API */
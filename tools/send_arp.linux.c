@@ -9,6 +9,10 @@
  * Authors:	Alexey Kuznetsov, <kuznet@ms2.inr.ac.ru>
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <sys/param.h>
 #include <sys/socket.h>
@@ -17,6 +21,11 @@
 #include <sys/time.h>
 #include <sys/signal.h>
 #include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <time.h>
+#include <stdint.h>
 #include <linux/if.h>
 #include <linux/if_packet.h>
 #include <linux/if_ether.h>
@@ -32,6 +41,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "send_arp_sched.h"
+
 static void usage(void) __attribute__((noreturn));
 
 static int quit_on_reply;
@@ -48,9 +59,69 @@ static int unicasting = 0;
 static int s = 0;
 static int broadcast_only = 0;
 
+/* Probe timing, see send_arp_sched.h; the timerfd fires at sched.next */
+static struct arp_sched sched = ARP_SCHED_INIT;
+static int timer_fd = -1;
+
+/* The arping probe, built once; only the target hw address is patched
+ * when we switch to unicast */
+static unsigned char probe[64];
+static int probe_len;
+
 static struct sockaddr_ll me;
 static struct sockaddr_ll he;
 
+/*
+ * Multi-target mode (-F, and the send_arp.libnet compatible mode as a
+ * list of one): announce many addresses from one process.  Like the
+ * libnet variant, every repetition is an ARP request followed half an
+ * interval later by an ARP reply.  Both frames are built once per
+ * target, targets are grouped by interface and every interface has a
+ * single socket; each round goes out as interleaved sendmmsg() batches.
+ */
+#define SEND_BATCH	64
+
+/*
+ * With -T each interface transmits from a PACKET_TX_RING instead.
+ * The ring holds lcm(2 * ntargets, RING_FPB) slots, filled once at
+ * setup with all request frames followed by all reply frames, over and
+ * over.  Rounds alternate request/reply, so each round's ntargets
+ * consecutive slots from the kernel's ring head carry exactly the
+ * frames it needs, and a round is just re-flagging them plus one
+ * send() to kick it: no copies, one syscall per link.
+ */
+#define RING_FRAME	128
+#define RING_BLOCK	4096
+#define RING_FPB	(RING_BLOCK / RING_FRAME)
+
+struct arp_iface {
+	char name[IFNAMSIZ];
+	int fd;
+	struct sockaddr_ll me, he;
+	int first, ntargets, pos;
+	unsigned char *ring;
+	size_t ring_len;
+	unsigned int ring_frames, ring_head;
+};
+
+struct arp_target {
+	struct in_addr ip;
+	int iface;
+	int len;
+	int has_mac;
+	unsigned char mac[8];
+	unsigned char frame[2][64];	/* request, reply */
+};
+
+static char *list_file;
+static struct arp_iface *ifaces;
+static int nifaces;
+static struct arp_target *targets;
+static int ntargets;
+static int use_ring;
+static int rounds;
+static long long tx_usec;
+
 static struct timeval start, last;
 
 static int sent, brd_sent;
@@ -62,15 +133,25 @@ static int received, brd_recv, req_recv;
 static void print_hex(unsigned char *p, int len);
 static int recv_pack(unsigned char *buf, int len, struct sockaddr_ll *FROM);
 static void set_signal(int signo, void (*handler)(void));
-static int send_pack(int s, struct in_addr src, struct in_addr dst,
-	      struct sockaddr_ll *ME, struct sockaddr_ll *HE);
+static int build_pack(unsigned char *buf, int op, struct in_addr src,
+	      struct in_addr dst, unsigned char *sha, unsigned char *tha,
+	      struct sockaddr_ll *ME);
+static int send_pack(int s, struct sockaddr_ll *HE);
+static int add_target(const char *dev, const char *addr, const char *mac);
+static int load_targets(const char *path);
+static void prepare_targets(void);
+static void run_targets(void) __attribute__((noreturn));
+static void send_targets(int reply);
+static int setup_ring(struct arp_iface *ifc);
 static void finish(void);
 static void catcher(void);
+static void schedule_next(void);
 
 void usage(void)
 {
 	fprintf(stderr,
-		"Usage: arping [-fqbDUAV] [-c count] [-w timeout] [-I device] [-s source] destination\n"
+		"Usage: arping [-fqbDUAV] [-c count] [-w timeout] [-B burst[,msec]] [-I device] [-s source] destination\n"
+		"       arping [-qTV] [-c count] [-w timeout] [-B burst[,msec]] -F file\n"
 		"  -f : quit on first reply\n"
 		"  -q : be quiet\n"
 		"  -b : keep broadcasting, don't go unicast\n"
@@ -80,8 +161,14 @@ void usage(void)
 		"  -V : print version and exit\n"
 		"  -c count : how many packets to send\n"
 		"  -w timeout : how long to wait for a reply\n"
+		"  -B burst[,msec] : send the first burst packets within msec (50),\n"
+		"               then back off exponentially to the interval\n"
+		"  -i interval : msec between packets (send_arp.libnet mode)\n"
 		"  -I device : which ethernet device to use (eth0)\n"
 		"  -s source : source ip address\n"
+		"  -F file : announce every \"device address\" pair listed in file\n"
+		"            (- for stdin)\n"
+		"  -T : with -F, transmit from a PACKET_TX_RING\n"
 		"  destination : ask for what ip address\n"
 		);
 	exit(2);
@@ -97,12 +184,10 @@ void set_signal(int signo, void (*handler)(void))
 	sigaction(signo, &sa, NULL);
 }
 
-int send_pack(int s, struct in_addr src, struct in_addr dst,
-	      struct sockaddr_ll *ME, struct sockaddr_ll *HE)
+int build_pack(unsigned char *buf, int op, struct in_addr src,
+	      struct in_addr dst, unsigned char *sha, unsigned char *tha,
+	      struct sockaddr_ll *ME)
 {
-	int err;
-	struct timeval now;
-	unsigned char buf[256];
 	struct arphdr *ah = (struct arphdr*)buf;
 	unsigned char *p = (unsigned char *)(ah+1);
 
@@ -112,26 +197,31 @@ int send_pack(int s, struct in_addr src, struct in_addr dst,
 	ah->ar_pro = htons(ETH_P_IP);
 	ah->ar_hln = ME->sll_halen;
 	ah->ar_pln = 4;
-	ah->ar_op  = advert ? htons(ARPOP_REPLY) : htons(ARPOP_REQUEST);
+	ah->ar_op  = htons(op);
 
-	memcpy(p, &ME->sll_addr, ah->ar_hln);
+	memcpy(p, sha, ah->ar_hln);
 	p+=ME->sll_halen;
 
 	memcpy(p, &src, 4);
 	p+=4;
 
-	if (advert)
-		memcpy(p, &ME->sll_addr, ah->ar_hln);
-	else
-		memcpy(p, &HE->sll_addr, ah->ar_hln);
+	memcpy(p, tha, ah->ar_hln);
 	p+=ah->ar_hln;
 
 	memcpy(p, &dst, 4);
 	p+=4;
 
+	return p-buf;
+}
+
+int send_pack(int s, struct sockaddr_ll *HE)
+{
+	int err;
+	struct timeval now;
+
 	gettimeofday(&now, NULL);
-	err = sendto(s, buf, p-buf, 0, (struct sockaddr*)HE, sizeof(*HE));
-	if (err == p-buf) {
+	err = sendto(s, probe, probe_len, 0, (struct sockaddr*)HE, sizeof(*HE));
+	if (err == probe_len) {
 		last = now;
 		sent++;
 		if (!unicasting)
@@ -156,6 +246,14 @@ void finish(void)
 			printf(")");
 		}
 		printf("\n");
+		if (rounds) {
+			printf("%d round(s) of %d frame(s), %.3f ms/round"
+			,	rounds, ntargets, tx_usec / 1000.0 / rounds);
+			if (tx_usec)
+				printf(", %.0f frames/s"
+				,	(double)sent * 1000000 / tx_usec);
+			printf("\n");
+		}
 		fflush(stdout);
 	}
 
@@ -171,24 +269,443 @@ void finish(void)
 	exit(!received);
 }
 
+/*
+ * Arm the timer for the next event.  If we fell behind, the absolute
+ * deadline is already past and the timer fires at once.
+ */
+void schedule_next(void)
+{
+	struct itimerspec its;
+
+	arp_sched_advance(&sched);
+
+	memset(&its, 0, sizeof(its));
+	its.it_value = sched.next;
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		perror("arping: timerfd_settime");
+		exit(2);
+	}
+}
+
 void catcher(void)
 {
 	struct timeval tv;
+	int reply = sched.reply_due;
 
 	gettimeofday(&tv, NULL);
 
 	if (start.tv_sec==0)
 		start = tv;
 
-	if (count-- == 0 || (timeout && MS_TDIFF(tv,start) > timeout*1000 + 500))
+	/* count and timeout apply per repetition, not per half of a pair */
+	if (!reply &&
+	    (count-- == 0 || (timeout && MS_TDIFF(tv,start) > timeout*1000 + 500)))
+		finish();
+
+	if (ntargets)
+		send_targets(reply);
+	else
+		send_pack(s, &he);
+	if (count == 0 && unsolicited && (reply || !sched.pairs))
 		finish();
 
-	if (last.tv_sec==0 || MS_TDIFF(tv,last) > 500) {
-		send_pack(s, src, dst, &me, &he);
-		if (count == 0 && unsolicited)
-			finish();
+	schedule_next();
+}
+
+static int open_iface(const char *name)
+{
+	struct arp_iface *ifc;
+	struct ifreq ifr;
+	socklen_t alen;
+	int i;
+
+	for (i = 0; i < nifaces; i++)
+		if (strcmp(ifaces[i].name, name) == 0)
+			return ifaces[i].fd >= 0 ? i : -1;
+
+	ifc = realloc(ifaces, (nifaces + 1) * sizeof(*ifaces));
+	if (ifc == NULL) {
+		perror("arping: realloc");
+		exit(2);
+	}
+	ifaces = ifc;
+	ifc = &ifaces[nifaces];
+	memset(ifc, 0, sizeof(*ifc));
+	strncpy(ifc->name, name, IFNAMSIZ-1);
+
+	/* the socket opened at startup serves the first interface */
+	ifc->fd = nifaces ? socket(PF_PACKET, SOCK_DGRAM, 0) : s;
+	if (ifc->fd < 0) {
+		perror("arping: socket");
+		exit(2);
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, name, IFNAMSIZ-1);
+	if (ioctl(ifc->fd, SIOCGIFINDEX, &ifr) < 0) {
+		fprintf(stderr, "arping: unknown iface %s\n", name);
+		goto bad;
+	}
+	ifc->me.sll_ifindex = ifr.ifr_ifindex;
+	if (ioctl(ifc->fd, SIOCGIFFLAGS, (char*)&ifr)) {
+		perror("ioctl(SIOCGIFFLAGS)");
+		goto bad;
+	}
+	if (!(ifr.ifr_flags&IFF_UP)) {
+		fprintf(stderr, "arping: interface \"%s\" is down\n", name);
+		goto bad;
+	}
+	if (ifr.ifr_flags&(IFF_NOARP|IFF_LOOPBACK)) {
+		fprintf(stderr, "arping: interface \"%s\" is not ARPable\n", name);
+		goto bad;
+	}
+
+	/* Protocol 0: we only transmit, don't queue incoming ARP */
+	ifc->me.sll_family = AF_PACKET;
+	if (bind(ifc->fd, (struct sockaddr*)&ifc->me, sizeof(ifc->me)) == -1) {
+		perror("bind");
+		goto bad;
+	}
+	alen = sizeof(ifc->me);
+	if (getsockname(ifc->fd, (struct sockaddr*)&ifc->me, &alen) == -1) {
+		perror("getsockname");
+		goto bad;
+	}
+	if (ifc->me.sll_halen == 0) {
+		fprintf(stderr, "arping: interface \"%s\" has no ll address\n", name);
+		goto bad;
+	}
+	ifc->me.sll_protocol = htons(ETH_P_ARP);
+	ifc->he = ifc->me;
+	memset(ifc->he.sll_addr, -1, ifc->he.sll_halen);
+
+	return nifaces++;
+bad:
+	/* keep the slot so the name is not retried, but mark it unusable */
+	if (nifaces)
+		close(ifc->fd);
+	ifc->fd = -1;
+	nifaces++;
+	return -1;
+}
+
+static int cmp_target(const void *a, const void *b)
+{
+	return ((const struct arp_target *)a)->iface -
+		((const struct arp_target *)b)->iface;
+}
+
+/*
+ * Hardware address as given to send_arp.libnet: hex digit pairs,
+ * optionally separated by colons.
+ */
+static int parse_mac(const char *str, unsigned char *mac, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		unsigned int byte;
+
+		if (*str == ':')
+			str++;
+		if (!isxdigit((unsigned char)str[0]) || !isxdigit((unsigned char)str[1]))
+			return -1;
+		sscanf(str, "%2x", &byte);
+		mac[i] = byte;
+		str += 2;
+	}
+	return *str == '\0' ? 0 : -1;
+}
+
+/*
+ * Queue dev/addr for announcement.  mac, if not NULL, is the hardware
+ * address to announce instead of the interface's own.
+ */
+int add_target(const char *dev, const char *addr, const char *mac)
+{
+	struct arp_target *t;
+	int idx;
+
+	if ((idx = open_iface(dev)) < 0)
+		return -1;
+	t = realloc(targets, (ntargets + 1) * sizeof(*targets));
+	if (t == NULL) {
+		perror("arping: realloc");
+		exit(2);
+	}
+	targets = t;
+	t = &targets[ntargets];
+	memset(t, 0, sizeof(*t));
+	if (inet_aton(addr, &t->ip) != 1) {
+		fprintf(stderr, "arping: invalid address %s\n", addr);
+		return -1;
+	}
+	if (mac && parse_mac(mac, t->mac, ifaces[idx].me.sll_halen) == 0)
+		t->has_mac = 1;
+	else if (mac)
+		fprintf(stderr, "arping: invalid hw address %s, using %s's\n"
+		,	mac, dev);
+	t->iface = idx;
+	ntargets++;
+	return 0;
+}
+
+/*
+ * Read "device address" lines; blank lines and lines starting with '#'
+ * are skipped.  Targets on unusable interfaces are dropped with a
+ * warning so one bad entry does not hold up the others.
+ */
+int load_targets(const char *path)
+{
+	FILE *fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	char line[256], dev[IFNAMSIZ], addr[64];
+	int lineno = 0;
+
+	if (fp == NULL) {
+		perror(path);
+		exit(2);
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if (sscanf(line, "%15s %63s", dev, addr) != 2) {
+			if (sscanf(line, " %1s", dev) == 1 && dev[0] != '#')
+				fprintf(stderr, "arping: %s:%d: malformed line\n"
+				,	path, lineno);
+			continue;
+		}
+		if (dev[0] == '#')
+			continue;
+		if (add_target(dev, addr, NULL) < 0)
+			fprintf(stderr, "arping: %s:%d: skipped\n", path, lineno);
+	}
+	if (fp != stdin)
+		fclose(fp);
+	return ntargets;
+}
+
+/*
+ * Group the targets by interface and build both frames of each once.
+ * As in send_arp.libnet, the request has a zero target hw address and
+ * the reply carries the announced one in both hw fields.
+ */
+void prepare_targets(void)
+{
+	static unsigned char zero_ha[8];
+	int i;
+
+	qsort(targets, ntargets, sizeof(*targets), cmp_target);
+	for (i = 0; i < ntargets; i++) {
+		struct arp_target *t = &targets[i];
+		struct arp_iface *ifc = &ifaces[t->iface];
+		unsigned char *sha = t->has_mac ? t->mac : ifc->me.sll_addr;
+
+		if (ifc->ntargets++ == 0)
+			ifc->first = i;
+		t->len = build_pack(t->frame[0], ARPOP_REQUEST, t->ip, t->ip
+		,	sha, zero_ha, &ifc->me);
+		build_pack(t->frame[1], ARPOP_REPLY, t->ip, t->ip
+		,	sha, sha, &ifc->me);
+	}
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	while (b) {
+		unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static struct tpacket2_hdr *ring_slot(struct arp_iface *ifc, unsigned int i)
+{
+	return (struct tpacket2_hdr *)(ifc->ring + (size_t)i * RING_FRAME);
+}
+
+/* Returns -1 if the ring can not be set up; the caller keeps sendmmsg */
+int setup_ring(struct arp_iface *ifc)
+{
+	struct tpacket_req req;
+	int ver = TPACKET_V2, on = 1;
+	unsigned int i, n, data_off = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+
+	if (ifc->ntargets == 0)
+		return 0;
+	if (data_off + sizeof(targets[0].frame[0]) > RING_FRAME)
+		return -1;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = RING_BLOCK;
+	req.tp_frame_size = RING_FRAME;
+	n = 2 * ifc->ntargets;
+	req.tp_frame_nr = n / gcd(n, RING_FPB) * RING_FPB;
+	req.tp_block_nr = req.tp_frame_nr / RING_FPB;
+
+	if (setsockopt(ifc->fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) < 0
+	||  setsockopt(ifc->fd, SOL_PACKET, PACKET_LOSS, &on, sizeof(on)) < 0
+	||  setsockopt(ifc->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+		perror("arping: PACKET_TX_RING");
+		return -1;
+	}
+	ifc->ring_len = (size_t)req.tp_block_nr * req.tp_block_size;
+	ifc->ring = mmap(NULL, ifc->ring_len, PROT_READ|PROT_WRITE, MAP_SHARED
+	,	ifc->fd, 0);
+	if (ifc->ring == MAP_FAILED) {
+		perror("arping: mmap");
+		ifc->ring = NULL;
+		return -1;
+	}
+	ifc->ring_frames = req.tp_frame_nr;
+
+	for (i = 0; i < ifc->ring_frames; i++) {
+		unsigned int j = i % n;
+		struct arp_target *t = &targets[ifc->first + j % ifc->ntargets];
+		struct tpacket2_hdr *hdr = ring_slot(ifc, i);
+
+		memcpy((unsigned char *)hdr + data_off
+		,	t->frame[j >= (unsigned int)ifc->ntargets], t->len);
+		hdr->tp_len = t->len;
+		hdr->tp_status = TP_STATUS_AVAILABLE;
+	}
+	return 0;
+}
+
+static void send_ring(struct arp_iface *ifc)
+{
+	unsigned int i, slot = ifc->ring_head;
+	int len;
+
+	for (i = 0; i < (unsigned int)ifc->ntargets; i++) {
+		ring_slot(ifc, slot)->tp_status = TP_STATUS_SEND_REQUEST;
+		slot = (slot + 1) % ifc->ring_frames;
+	}
+	ifc->ring_head = slot;
+
+	/* Blocking kick: returns once every flagged frame has been handed
+	 * to the device and its slot is free again */
+	len = sendto(ifc->fd, NULL, 0, 0
+	,	(struct sockaddr*)&ifc->he, sizeof(ifc->he));
+	if (len < 0) {
+		if (errno != EINTR)
+			perror("arping: send (tx ring)");
+		return;
+	}
+	len /= targets[ifc->first].len;
+	sent += len;
+	brd_sent += len;
+}
+
+/*
+ * One probe round: the request (or reply) frame of every target once.
+ * Interfaces take turns sending a batch each, so a long list on one
+ * link does not delay the rest.
+ */
+void send_targets(int reply)
+{
+	struct mmsghdr msgs[SEND_BATCH];
+	struct iovec iov[SEND_BATCH];
+	struct timespec t0, t1;
+	int i, j, n, busy;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	gettimeofday(&last, NULL);
+	for (i = 0; i < nifaces; i++) {
+		ifaces[i].pos = 0;
+		if (ifaces[i].ring != NULL) {
+			send_ring(&ifaces[i]);
+			ifaces[i].pos = ifaces[i].ntargets;
+		}
+	}
+
+	do {
+		busy = 0;
+		for (i = 0; i < nifaces; i++) {
+			struct arp_iface *ifc = &ifaces[i];
+
+			n = ifc->ntargets - ifc->pos;
+			if (ifc->fd < 0 || n <= 0)
+				continue;
+			if (n > SEND_BATCH)
+				n = SEND_BATCH;
+			busy = 1;
+
+			memset(msgs, 0, n * sizeof(*msgs));
+			for (j = 0; j < n; j++) {
+				struct arp_target *t = &targets[ifc->first + ifc->pos + j];
+
+				iov[j].iov_base = t->frame[reply];
+				iov[j].iov_len = t->len;
+				msgs[j].msg_hdr.msg_name = &ifc->he;
+				msgs[j].msg_hdr.msg_namelen = sizeof(ifc->he);
+				msgs[j].msg_hdr.msg_iov = &iov[j];
+				msgs[j].msg_hdr.msg_iovlen = 1;
+			}
+			j = sendmmsg(ifc->fd, msgs, n, 0);
+			if (j <= 0) {
+				if (j < 0 && errno != EINTR)
+					perror("arping: sendmmsg");
+				/* skip this batch rather than spin on it */
+				j = n;
+			} else {
+				sent += j;
+				brd_sent += j;
+			}
+			ifc->pos += j;
+		}
+	} while (busy);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	tx_usec += (t1.tv_sec - t0.tv_sec) * 1000000LL
+		+ (t1.tv_nsec - t0.tv_nsec) / 1000;
+	rounds++;
+}
+
+/*
+ * Announce the queued targets: transmit only, finish() exits once the
+ * last reply of count repetitions is out.
+ */
+void run_targets(void)
+{
+	int i, up = 0;
+
+	unsolicited = 1;
+	sched.pairs = 1;
+	prepare_targets();
+
+	if (use_ring) {
+		for (i = 0; i < nifaces; i++)
+			if (ifaces[i].fd >= 0 && setup_ring(&ifaces[i]) < 0)
+				fprintf(stderr, "arping: %s: no tx ring, using sendmmsg\n"
+				,	ifaces[i].name);
+	}
+	if (!quiet) {
+		for (i = 0; i < nifaces; i++)
+			up += ifaces[i].ntargets > 0;
+		printf("ARPING %d address(es) on %d interface(s)\n"
+		,	ntargets, up);
+		fflush(stdout);
+	}
+
+	set_signal(SIGINT, finish);
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (timer_fd < 0) {
+		perror("arping: timerfd_create");
+		exit(2);
+	}
+	arp_sched_start(&sched);
+
+	catcher();
+	while (1) {
+		uint64_t expirations;
+
+		if (read(timer_fd, &expirations, sizeof(expirations)) > 0)
+			catcher();
+		else if (errno != EINTR) {
+			perror("arping: read timerfd");
+			exit(2);
+		}
 	}
-	alarm(1);
 }
 
 void print_hex(unsigned char *p, int len)
@@ -304,6 +821,10 @@ int recv_pack(unsigned char *buf, int len, struct sockaddr_ll *FROM)
 	if(!broadcast_only) {
 		memcpy(he.sll_addr, p, me.sll_halen);
 		unicasting=1;
+		if (!advert) {
+			/* target hw address of the probe */
+			memcpy(probe + sizeof(*ah) + me.sll_halen + 4, p, me.sll_halen);
+		}
 	}
 	return 1;
 }
@@ -338,7 +859,7 @@ main(int argc, char **argv)
 		exit(-1);
 	}
 
-	while ((ch = getopt(argc, argv, "h?bfDUAqc:w:s:I:Vr:i:p:")) != EOF) {
+	while ((ch = getopt(argc, argv, "h?bfDUAqc:w:s:I:Vr:i:p:B:F:T")) != EOF) {
 		switch(ch) {
 		case 'b':
 			broadcast_only=1;
@@ -378,11 +899,31 @@ main(int argc, char **argv)
 		case 'V':
 			printf("send_arp utility\n");
 			exit(0);
-		case 'p':
 		case 'i':
 		    hb_mode = 1;
-		    /* send_arp.libnet compatibility options, ignore */
+		    /* send_arp.libnet compatibility option */
+		    sched.interval = atol(optarg);
+		    if (sched.interval <= 0) {
+			fprintf(stderr, "arping: invalid interval %s\n", optarg);
+			exit(2);
+		    }
 		    break;
+		case 'B':
+		    if (arp_sched_parse_burst(&sched, optarg) < 0) {
+			fprintf(stderr, "arping: invalid burst %s\n", optarg);
+			exit(2);
+		    }
+		    break;
+		case 'p':
+		    hb_mode = 1;
+		    /* send_arp.libnet compatibility option, ignore */
+		    break;
+		case 'F':
+			list_file = optarg;
+			break;
+		case 'T':
+			use_ring = 1;
+			break;
 		case 'h':
 		case '?':
 		default:
@@ -390,6 +931,24 @@ main(int argc, char **argv)
 		}
 	}
 
+	if (list_file || hb_mode) {
+	    if (s < 0) {
+		errno = socket_errno;
+		perror("arping: socket");
+		exit(2);
+	    }
+	}
+
+	if (list_file) {
+	    if (argc != optind || dad)
+		usage();
+	    if (load_targets(list_file) == 0) {
+		fprintf(stderr, "arping: no usable targets in %s\n", list_file);
+		exit(2);
+	    }
+	    run_targets();
+	}
+
 	if(hb_mode) {
 	    /* send_arp.libnet compatibility mode */
 	    if (argc - optind != 5) {
@@ -404,18 +963,17 @@ main(int argc, char **argv)
 	     *	argv[optind+5] NETMASK		ffffffffffff
 	     */
 
-	    unsolicited = 1;
-	    device = argv[optind];
-	    target = argv[optind+1];
+	    if (add_target(argv[optind], argv[optind+1]
+	    ,	strcasecmp(argv[optind+2], "auto") ? argv[optind+2] : NULL) < 0)
+		exit(2);
+	    run_targets();
+	}
 
-	} else {
-	    argc -= optind;
-	    argv += optind;
-	    if (argc != 1)
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
 		usage();
-
-	    target = *argv;
-	}
+	target = *argv;
 	
 	if (device == NULL) {
 		fprintf(stderr, "arping: device (option -I) is required\n");
@@ -538,6 +1096,9 @@ main(int argc, char **argv)
 	he = me;
 	memset(he.sll_addr, -1, he.sll_halen);
 
+	probe_len = build_pack(probe, advert ? ARPOP_REPLY : ARPOP_REQUEST
+	,	src, dst, me.sll_addr, advert ? me.sll_addr : he.sll_addr, &me);
+
 	if (!quiet) {
 		printf("ARPING %s ", inet_ntoa(dst));
 		printf("from %s %s\n",  inet_ntoa(src), device ? : "");
@@ -549,7 +1110,13 @@ main(int argc, char **argv)
 	}
 
 	set_signal(SIGINT, finish);
-	set_signal(SIGALRM, catcher);
+
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (timer_fd < 0) {
+		perror("arping: timerfd_create");
+		exit(2);
+	}
+	arp_sched_start(&sched);
 
 	catcher();
 
@@ -558,15 +1125,35 @@ main(int argc, char **argv)
 		unsigned char packet[4096];
 		struct sockaddr_ll from;
 		socklen_t alen = sizeof(from);
+		struct pollfd pfd[2];
 		int cc;
 
-		if ((cc = recvfrom(s, packet, sizeof(packet), 0,
+		pfd[0].fd = s;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = timer_fd;
+		pfd[1].events = POLLIN;
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno != EINTR)
+				perror("arping: poll");
+			continue;
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			uint64_t expirations;
+
+			if (read(timer_fd, &expirations, sizeof(expirations)) > 0)
+				catcher();
+		}
+
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+		if ((cc = recvfrom(s, packet, sizeof(packet), MSG_DONTWAIT,
 				   (struct sockaddr *)&from, &alen)) < 0) {
-			perror("arping: recvfrom");
+			if (errno != EAGAIN && errno != EINTR)
+				perror("arping: recvfrom");
 			continue;
 		}
 		sigemptyset(&sset);
-		sigaddset(&sset, SIGALRM);
 		sigaddset(&sset, SIGINT);
 		sigprocmask(SIG_BLOCK, &sset, &osset);
 		recv_pack(packet, cc, &from);
@@ -0,0 +1,127 @@
+/*
+ * send_arp_sched.c --- Probe timing shared by both send_arp variants.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include "send_arp_sched.h"
+
+int
+arp_sched_parse_burst(struct arp_sched *as, const char *arg)
+{
+	char *end;
+	long count, window = as->burst_window;
+
+	count = strtol(arg, &end, 10);
+	if (*end == ',') {
+		window = strtol(end + 1, &end, 10);
+	}
+	if (*end != '\0' || count <= 0 || window < 0) {
+		return -1;
+	}
+	as->burst_count = count;
+	as->burst_window = window;
+	return 0;
+}
+
+long
+arp_sched_gap(const struct arp_sched *as, int k)
+{
+	long gap, limit = as->interval * 1000;
+
+	if (as->burst_count <= 0) {
+		return limit;
+	}
+
+	gap = as->burst_count > 1
+	?	as->burst_window * 1000 / (as->burst_count - 1)
+	:	as->burst_window * 1000;
+	if (gap < 1000) {
+		gap = 1000;
+	}
+	for (k -= as->burst_count - 2; k > 0 && gap < limit; k--) {
+		gap *= 2;
+	}
+	return gap < limit ? gap : limit;
+}
+
+void
+arp_sched_start(struct arp_sched *as)
+{
+	as->rep = 0;
+	as->reply_due = 0;
+	clock_gettime(CLOCK_MONOTONIC, &as->next);
+}
+
+static void
+ts_add_usec(struct timespec *ts, long usec)
+{
+	ts->tv_sec += usec / 1000000;
+	ts->tv_nsec += (usec % 1000000) * 1000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+void
+arp_sched_advance(struct arp_sched *as)
+{
+	long gap = arp_sched_gap(as, as->rep);
+
+	if (!as->pairs) {
+		ts_add_usec(&as->next, gap);
+		as->rep++;
+	} else if (!as->reply_due) {
+		ts_add_usec(&as->next, gap / 2);
+		as->reply_due = 1;
+	} else {
+		ts_add_usec(&as->next, gap - gap / 2);
+		as->reply_due = 0;
+		as->rep++;
+	}
+}
+
+void
+arp_sched_sleep(const struct arp_sched *as)
+{
+	struct timespec now, left;
+
+	/* nanosleep() rather than clock_nanosleep() for the BSDs/Solaris
+	 * that the libnet build still serves */
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left.tv_sec = as->next.tv_sec - now.tv_sec;
+		left.tv_nsec = as->next.tv_nsec - now.tv_nsec;
+		if (left.tv_nsec < 0) {
+			left.tv_sec--;
+			left.tv_nsec += 1000000000;
+		}
+		if (left.tv_sec < 0) {
+			return;
+		}
+		if (nanosleep(&left, NULL) == 0) {
+			return;
+		}
+		if (errno != EINTR) {
+			return;
+		}
+	}
+}
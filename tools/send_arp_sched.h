@@ -0,0 +1,63 @@
+/*
+ * send_arp_sched.h --- Probe timing shared by both send_arp variants.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef SEND_ARP_SCHED_H
+#define SEND_ARP_SCHED_H
+
+#include <time.h>
+
+/*
+ * arp_sched --- when to send the next announcement
+ *
+ * Repetitions are interval msec apart.  With a burst, the first
+ * burst_count repetitions are spread evenly over burst_window msec and
+ * the gap then doubles per repetition until it reaches the interval.
+ * In pair mode every repetition is an ARP request followed, half a gap
+ * later, by an ARP reply.  Deadlines are absolute CLOCK_MONOTONIC
+ * times, so time spent sending does not push the schedule back.
+ */
+struct arp_sched {
+	long interval;		/* msec */
+	int burst_count;
+	long burst_window;	/* msec */
+	int pairs;
+
+	int rep;		/* repetitions started so far */
+	int reply_due;		/* next event is the reply half of a pair */
+	struct timespec next;
+};
+
+#define ARP_SCHED_INIT	{ 1000, 0, 50, 0, 0, 0, { 0, 0 } }
+
+/* Parse a "-B count[,msec]" argument; 0 if ok, -1 if malformed */
+int arp_sched_parse_burst(struct arp_sched *as, const char *arg);
+
+/* Gap in usec between repetition k and k+1 */
+long arp_sched_gap(const struct arp_sched *as, int k);
+
+/* The first event is due now */
+void arp_sched_start(struct arp_sched *as);
+
+/* Move the deadline to the event after the one just sent */
+void arp_sched_advance(struct arp_sched *as);
+
+/* Sleep until the current deadline */
+void arp_sched_sleep(const struct arp_sched *as);
+
+#endif /* SEND_ARP_SCHED_H */
@@ -42,6 +42,9 @@
 #define SFEX_VERSION 1
 #define SFEX_REVISION 3
 
+/* version number of the binary meta-data format. See sfex_lockdata_v2. */
+#define SFEX_VERSION2 2
+
 #if 0
 #ifndef TRUE
 #  define TRUE 1
@@ -101,6 +104,7 @@ typedef struct sfex_controldata {
   int version;			/*  version number */
   int revision;			/*  revision number */
   size_t blocksize;		/*  block size */
+  size_t recordsize;		/*  size of one lock data, version 2 only */
   int numlocks;			/*  number of locks */
 } sfex_controldata;
 
@@ -143,7 +147,9 @@ typedef struct sfex_controldata_ondisk {
  */
 typedef struct sfex_lockdata {
   char status;				/* status of lock */
-  int count;				/* increment counter */
+  uint64_t count;			/* increment counter */
+  uint64_t timestamp;		/* writer's monotonic clock(msec), version 2 only */
+  uint32_t interval;		/* writer's refresh interval(msec), version 2 only */
   char nodename[256];		/* node name */
 } sfex_lockdata;
 
@@ -153,6 +159,57 @@ typedef struct sfex_lockdata_ondisk {
 	uint8_t nodename[256];
 } sfex_lockdata_ondisk;
 
+/*
+ * sfex_controldata_ondisk_v2, sfex_lockdata_ondisk_v2 --- binary format
+ *
+ * When the version field of the control data is not a printable number
+ * but the little-endian binary value SFEX_VERSION2, the meta-data is 
+ * stored in the following binary format. All integers are little-endian.
+ * Version 1 programs refuse this format with a version mismatch.
+ *
+ * control data --- magic number (same as version 1), version, revision, 
+ * blocksize, number of locks and record size as 32bit integers, 4 reserved
+ * bytes and a CRC32C of these 32 bytes computed with the crc field zeroed.
+ *
+ * record size --- the size of one lock data. 0 means blocksize, i.e. one
+ * lock data per block as in version 1. With a smaller record size, 
+ * blocksize / recordsize lock data are packed into one block (compact 
+ * layout); lock data #n is then stored in block 1 + (n - 1) / that number.
+ * A node updates its own records by reading the block, replacing them and
+ * writing the block back. Two nodes doing that at the same moment would
+ * undo each other's update, so a block must only ever be written by one
+ * holder: sfex_daemon refuses an index set which covers only a part of
+ * the lock data of a block, and holds all of them or none.
+ *
+ * lock data --- status (same characters as version 1), length of the node
+ * name, the refresh interval of the holder in units of 10 milliseconds 
+ * (0 if unknown, 65535 if longer), a CRC32C, a 64bit generation counter which never wraps in 
+ * practice, the writer's CLOCK_MONOTONIC time in milliseconds at the time
+ * of the write, and the node name without terminator. The CRC32C covers 
+ * the whole block with the crc field zeroed, so a torn or stale block is 
+ * detected.
+ */
+typedef struct sfex_controldata_ondisk_v2 {
+	uint8_t magic[4];
+	uint8_t version[4];
+	uint8_t revision[4];
+	uint8_t blocksize[4];
+	uint8_t numlocks[4];
+	uint8_t recordsize[4];
+	uint8_t reserved[4];
+	uint8_t crc[4];
+} sfex_controldata_ondisk_v2;
+
+typedef struct sfex_lockdata_ondisk_v2 {
+	uint8_t status;
+	uint8_t namelen;
+	uint8_t interval[2];
+	uint8_t crc[4];
+	uint8_t generation[8];
+	uint8_t timestamp[8];
+	uint8_t nodename[];
+} sfex_lockdata_ondisk_v2;
+
 /* character for lock status. This is used in sfex_lockdata.status */
 #define SFEX_STATUS_UNLOCK 'u' /* unlock */
 #define SFEX_STATUS_LOCK 'l'	/* lock */
@@ -161,16 +218,21 @@ typedef struct sfex_lockdata_ondisk {
 #define SFEX_MAGIC "SFEX"
 #define SFEX_MIN_NUMLOCKS 1
 #define SFEX_MAX_NUMLOCKS 999
+#define SFEX_MAX_NUMLOCKS2 65535	/* version 2 */
+#define SFEX_MIN_RECORDSIZE 32	/* version 2, node names up to 8 bytes */
 #define SFEX_MIN_COUNT 0
 #define SFEX_MAX_COUNT 999
 #define SFEX_MAX_NODENAME (sizeof(((sfex_lockdata *)0)->nodename) - 1)
 
 /* update macro for increment counter */
-#define SFEX_NEXT_COUNT(c) (c >= SFEX_MAX_COUNT ? c - SFEX_MAX_COUNT : c + 1)
+/* Version 1 stores the counter modulo SFEX_MAX_COUNT + 1, so it still 
+   wraps from 999 to 0 there. Version 2 stores all 64 bits. */
+#define SFEX_NEXT_COUNT(c) ((c) + 1)
 
 /* extern variables */
 extern const char *progname;
 extern char *nodename;
 extern unsigned long sector_size;
+extern unsigned long io_retries;
 
 #endif /* SFEX_H */
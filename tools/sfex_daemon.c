@@ -12,56 +12,391 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <syslog.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
 #include "sfex.h"
 #include "sfex_lib.h"
+#include "sfex_stats.h"
 
 #if HAVE_GLUE_CONFIG_H
 #include <glue_config.h> /* for HA_LOG_FACILITY */
 #endif
 
 static int sysrq_fd;
-static int lock_index = 1;        /* default 1st lock */
-static time_t collision_timeout = 1; /* default 1 sec */
-static time_t lock_timeout = 60; /* default 60 sec */
+static int *lock_index;        /* held indexes, ascending */
+static int num_locks = 0;
+/* timeouts and interval are kept in milliseconds */
+static long long collision_timeout = 1000; /* default 1 sec */
+static long long lock_timeout = 60000; /* default 60 sec */
 time_t unlock_timeout = 60;
-static time_t monitor_interval = 10;
+static long long monitor_interval = 10000;
+static int fast_acquire = 0;      /* missed intervals before take over, 0 = off */
+#define FAST_ACQUIRE_MIN 2        /* fewest missed intervals accepted by -a */
+#define FAST_ACQUIRE_FLOOR_DIV 2  /* never take over before lock_timeout / 2 */
 
 static sfex_controldata cdata;
-static sfex_lockdata ldata;
-static sfex_lockdata ldata_new;
+static sfex_lockdata *ldata;
+static sfex_lockdata *ldata_new;
 
 static const char *device;
 const char *progname;
 char *nodename;
 static const char *rsc_id = "sfex";
 
+/* refresh statistics, published when -S <file> is given */
+static sfex_stats local_stats;
+static sfex_stats *stats = &local_stats;
+static struct timespec last_refresh;	/* end of the last lock write */
+
 static void usage(FILE *dist) {
-	  fprintf(dist, "usage: %s [-i <index>] [-c <collision_timeout>] [-t <lock_timeout>] <device>\n", progname);
+	  fprintf(dist, "usage: %s [-i <index>[,<index>|-<index>...]] [-c <collision_timeout>] [-t <lock_timeout>] [-m <monitor_interval>] [-e sync|uring] [-S <statsfile>] [-a <missed_intervals>] <device>\n", progname);
+	  fprintf(dist, "  times are seconds, or milliseconds with an \"ms\" suffix (e.g. 250ms)\n");
+	  fprintf(dist, "  -a takes a foreign lock over after at least %d missed intervals plus the\n"
+		  "  I/O latency, and never before lock_timeout / %d\n",
+		  FAST_ACQUIRE_MIN, FAST_ACQUIRE_FLOOR_DIV);
+}
+
+/*
+ * parse_msec --- parse a time value of the command line into milliseconds
+ *
+ * A plain number is seconds as before. A "s" or "ms" suffix may be given.
+ * The value must be between 1ms and INT_MAX seconds, otherwise -1 is 
+ * returned.
+ */
+static long long parse_msec(const char *arg)
+{
+	char *end;
+	unsigned long l;
+	long long msec;
+
+	errno = 0;
+	l = strtoul(arg, &end, 10);
+	if (end == arg || errno != 0 || l > INT_MAX)
+		return -1;
+	if (*end == '\0' || strcmp(end, "s") == 0)
+		msec = (long long)l * 1000;
+	else if (strcmp(end, "ms") == 0)
+		msec = l;
+	else
+		return -1;
+	if (msec < 1 || msec > (long long)INT_MAX * 1000)
+		return -1;
+	return msec;
+}
+
+static void timespec_add_msec(struct timespec *ts, long long msec)
+{
+	ts->tv_sec += msec / 1000;
+	ts->tv_nsec += (msec % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static long long timespec_diff_msec(const struct timespec *a, const struct timespec *b)
+{
+	return (long long)(a->tv_sec - b->tv_sec) * 1000
+		+ (a->tv_nsec - b->tv_nsec) / 1000000;
+}
+
+static long long timespec_diff_usec(const struct timespec *a, const struct timespec *b)
+{
+	return (long long)(a->tv_sec - b->tv_sec) * 1000000
+		+ (a->tv_nsec - b->tv_nsec) / 1000;
+}
+
+/*
+ * sleep_msec --- sleep msec milliseconds on the monotonic clock
+ *
+ * The deadline is absolute, so an interrupted sleep is resumed without
+ * drifting, and wall clock adjustments have no effect.
+ */
+static void sleep_msec(long long msec)
+{
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	timespec_add_msec(&deadline, msec);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+		;
+}
+
+/*
+ * parse_index_list --- parse the argument of -i
+ *
+ * The argument is a comma separated list of indexes or ranges of indexes,
+ * e.g. "1,3,5-8". All of them are held and refreshed by this process.
+ */
+static void parse_index_list(const char *arg)
+{
+	static char wanted[SFEX_MAX_NUMLOCKS2 + 1];
+	const char *p = arg;
+	int i;
+
+	while (*p) {
+		char *end;
+		unsigned long first, last;
+
+		first = last = strtoul(p, &end, 10);
+		if (end != p && *end == '-') {
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+		}
+		if (end == p || (*end && *end != ',')
+			|| first < SFEX_MIN_NUMLOCKS || last > SFEX_MAX_NUMLOCKS2
+			|| first > last) {
+			cl_log(LOG_ERR, 
+					"index %s is out of range or invalid. it must be integer value between %lu and %lu.\n",
+					arg,
+					(unsigned long)SFEX_MIN_NUMLOCKS,
+					(unsigned long)SFEX_MAX_NUMLOCKS2);
+			exit(4);
+		}
+		for (; first <= last; first++)
+			wanted[first] = 1;
+		p = *end ? end + 1 : end;
+	}
+
+	num_locks = 0;
+	for (i = SFEX_MIN_NUMLOCKS; i <= SFEX_MAX_NUMLOCKS2; i++)
+		if (wanted[i])
+			num_locks++;
+	free(lock_index);
+	lock_index = malloc(num_locks * sizeof(*lock_index));
+	if (lock_index == NULL) {
+		cl_log(LOG_ERR, "%s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	num_locks = 0;
+	for (i = SFEX_MIN_NUMLOCKS; i <= SFEX_MAX_NUMLOCKS2; i++)
+		if (wanted[i])
+			lock_index[num_locks++] = i;
+}
+
+/*
+ * run_length --- number of adjacent indexes starting at lock_index[i]
+ *
+ * Adjacent lock data are stored in adjacent blocks, so they are
+ * transferred with a single I/O.
+ */
+static int run_length(int i)
+{
+	int n = 1;
+
+	while (i + n < num_locks && lock_index[i + n] == lock_index[i] + n)
+		n++;
+	return n;
+}
+
+static int read_locks(sfex_lockdata *l)
+{
+	int i, n;
+
+	for (i = 0; i < num_locks; i += n) {
+		n = run_length(i);
+		if (read_lockdata_run(&cdata, &l[i], lock_index[i], n) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static int write_locks(const sfex_lockdata *l)
+{
+	int i, n;
+
+	for (i = 0; i < num_locks; i += n) {
+		n = run_length(i);
+		if (write_lockdata_run(&cdata, &l[i], lock_index[i], n) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static int is_own_lock(const sfex_lockdata *l)
+{
+	return l->status == SFEX_STATUS_LOCK
+		&& !strncmp((const char*)(l->nodename), nodename, sizeof(l->nodename));
+}
+
+/*
+ * give_back_locks --- unlock every lock which is still held by own node
+ *
+ * This is used when the acquisition of a part of the locks failed, so
+ * that the others do not stay locked without being refreshed.
+ */
+static void give_back_locks(sfex_lockdata *l)
+{
+	int i;
+
+	for (i = 0; i < num_locks; i++) {
+		if (!is_own_lock(&l[i]))
+			continue;
+		l[i].status = SFEX_STATUS_UNLOCK;
+		if (write_lockdata(&cdata, &l[i], lock_index[i]) == -1)
+			cl_log(LOG_ERR, "write_lockdata failed in give_back_locks (index=%d)\n", lock_index[i]);
+	}
+}
+
+/*
+ * check_collision --- give up when another node overwrote a lock
+ *
+ * ldata holds what was written, ldata_new what was read back.
+ */
+static void check_collision(void)
+{
+	int i;
+
+	for (i = 0; i < num_locks; i++) {
+		if (strncmp((char*)(ldata[i].nodename), (const char*)(ldata_new[i].nodename), sizeof(ldata[i].nodename))) {
+			cl_log(LOG_ERR, "can\'t acquire lock (index=%d): collision detected in the air.\n", lock_index[i]);
+			give_back_locks(ldata_new);
+			exit(2);
+		}
+	}
+}
+
+/*
+ * wait_foreign_locks_fast --- wait for the locks of other nodes to expire
+ *
+ * Instead of one lock_timeout, the counters of the foreign locks are 
+ * sampled at the refresh interval their holders advertise (format 2). 
+ * When a counter advances, the holder is alive and we give up at once. 
+ * A lock is taken over when it is released, or when its counter did not 
+ * advance for fast_acquire of the holder's intervals plus the I/O margin.
+ * The margin is twice the slowest read seen while waiting, which covers 
+ * the holder's write that may still be in flight as well as our read. 
+ * The wait is bounded by lock_timeout / FAST_ACQUIRE_FLOOR_DIV below and 
+ * by lock_timeout above, so a short advertised interval can not make us 
+ * steal a lock much earlier than its holder expects to keep it.
+ *
+ * Returns 0 if some holder does not advertise its interval; the caller 
+ * then waits the full lock_timeout. Returns 1 when every lock may be 
+ * taken; ldata then holds the latest lock data.
+ */
+static int wait_foreign_locks_fast(void)
+{
+	struct timespec start, before, now;
+	long long period = 0, io_max = 0, io, waited, expire;
+	int i, pending;
+
+	for (i = 0; i < num_locks; i++) {
+		if (ldata[i].status != SFEX_STATUS_LOCK || is_own_lock(&ldata[i]))
+			continue;
+		if (ldata[i].interval == 0)
+			return 0;
+		if (period == 0 || ldata[i].interval < period)
+			period = ldata[i].interval;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		sleep_msec(period);
+		clock_gettime(CLOCK_MONOTONIC, &before);
+		if (read_locks(ldata_new) == -1) {
+			cl_log(LOG_ERR, "read_lockdata failed in acquire_lock\n");
+			exit(EXIT_FAILURE);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		io = timespec_diff_msec(&now, &before);
+		if (io > io_max)
+			io_max = io;
+		waited = timespec_diff_msec(&now, &start);
+
+		pending = 0;
+		for (i = 0; i < num_locks; i++) {
+			if (ldata[i].status != SFEX_STATUS_LOCK || is_own_lock(&ldata[i]))
+				continue;
+			if (ldata_new[i].status == SFEX_STATUS_UNLOCK) {
+				ldata[i] = ldata_new[i];	/* released meanwhile */
+				continue;
+			}
+			if (ldata[i].count != ldata_new[i].count
+				|| strncmp(ldata[i].nodename, ldata_new[i].nodename, sizeof(ldata[i].nodename))) {
+				cl_log(LOG_ERR, "can\'t acquire lock (index=%d): the lock's already hold by some other node.\n", lock_index[i]);
+				exit(2);
+			}
+			expire = (long long)fast_acquire * ldata[i].interval + 2 * io_max;
+			if (expire < lock_timeout / FAST_ACQUIRE_FLOOR_DIV)
+				expire = lock_timeout / FAST_ACQUIRE_FLOOR_DIV;
+			if (waited < expire)
+				pending = 1;
+		}
+	} while (pending && waited < lock_timeout);
+
+	return 1;
+}
+
+/*
+ * detect_collision_fast --- collision detection with randomized re-reads
+ *
+ * The written lock data are read back several times at random points 
+ * within a random fraction (1/2 to 1) of collision_timeout. A collision
+ * is detected as soon as it shows up, and two nodes which started at the
+ * same moment do not re-read in lockstep.
+ */
+#define COLLISION_ROUNDS 3
+static void detect_collision_fast(void)
+{
+	long long remaining;
+	int round;
+
+	srandom(getpid() ^ time(NULL));
+	remaining = collision_timeout / 2 + random() % (collision_timeout / 2 + 1);
+	for (round = 0; round < COLLISION_ROUNDS; round++) {
+		long long slice = remaining / (COLLISION_ROUNDS - round);
+		long long wait = slice / 2 + random() % (slice / 2 + 1);
+
+		if (round == COLLISION_ROUNDS - 1)
+			wait = remaining;
+		sleep_msec(wait);
+		remaining -= wait;
+		if (read_locks(ldata_new) == -1) {
+			cl_log(LOG_ERR, "read_lockdata failed in collision detection\n");
+			continue;
+		}
+		check_collision();
+	}
 }
 
 static void acquire_lock(void)
 {
-	if (read_lockdata(&cdata, &ldata, lock_index) == -1) {
+	int i;
+	int foreign = 0;
+
+	if (read_locks(ldata) == -1) {
 		cl_log(LOG_ERR, "read_lockdata failed in acquire_lock\n");
 		exit(EXIT_FAILURE);
 	}
 
-	if ((ldata.status == SFEX_STATUS_LOCK) && (strncmp(nodename, (const char*)(ldata.nodename), sizeof(ldata.nodename)))) {
-		unsigned int t = lock_timeout;
-		while (t > 0)
-			t = sleep(t);
-		read_lockdata(&cdata, &ldata_new, lock_index);
-		if (ldata.count != ldata_new.count) {
-			cl_log(LOG_ERR, "can\'t acquire lock: the lock's already hold by some other node.\n");
-			exit(2);
+	for (i = 0; i < num_locks; i++)
+		if ((ldata[i].status == SFEX_STATUS_LOCK) && (strncmp(nodename, (const char*)(ldata[i].nodename), sizeof(ldata[i].nodename))))
+			foreign = 1;
+
+	/* One lock_timeout covers every lock held by other nodes. */
+	if (foreign && !(fast_acquire && wait_foreign_locks_fast())) {
+		sleep_msec(lock_timeout);
+		if (read_locks(ldata_new) == -1) {
+			cl_log(LOG_ERR, "read_lockdata failed in acquire_lock\n");
+			exit(EXIT_FAILURE);
+		}
+		for (i = 0; i < num_locks; i++) {
+			if (ldata[i].count != ldata_new[i].count) {
+				cl_log(LOG_ERR, "can\'t acquire lock (index=%d): the lock's already hold by some other node.\n", lock_index[i]);
+				exit(2);
+			}
 		}
 	}
 
 	/* The lock acquisition is possible because it was not updated. */
-	ldata.status = SFEX_STATUS_LOCK;
-	ldata.count = SFEX_NEXT_COUNT(ldata.count);
-	strncpy((char*)(ldata.nodename), nodename, sizeof(ldata.nodename));
-	if (write_lockdata(&cdata, &ldata, lock_index) == -1) {
+	for (i = 0; i < num_locks; i++) {
+		ldata[i].status = SFEX_STATUS_LOCK;
+		ldata[i].count = SFEX_NEXT_COUNT(ldata[i].count);
+		ldata[i].interval = monitor_interval;
+		strncpy((char*)(ldata[i].nodename), nodename, sizeof(ldata[i].nodename));
+	}
+	if (write_locks(ldata) == -1) {
 		cl_log(LOG_ERR, "write_lockdata failed\n");
 		exit(EXIT_FAILURE);
 	}
@@ -73,27 +408,26 @@ static void acquire_lock(void)
 	   another node is done is checked. If the superscription was done by 
 	   another node, the lock acquisition with the own node is given up.  
 	 */
-	{
-		unsigned int t = collision_timeout;
-		while (t > 0)
-			t = sleep(t);
-		if (read_lockdata(&cdata, &ldata_new, lock_index) == -1) {
+	if (fast_acquire)
+		detect_collision_fast();
+	else {
+		sleep_msec(collision_timeout);
+		if (read_locks(ldata_new) == -1) {
 			cl_log(LOG_ERR, "read_lockdata failed in collision detection\n");
 		}
-		if (strncmp((char*)(ldata.nodename), (const char*)(ldata_new.nodename), sizeof(ldata.nodename))) {
-			cl_log(LOG_ERR, "can\'t acquire lock: collision detected in the air.\n");
-			exit(2);
-		}
+		check_collision();
 	}
 
 	/* extension of lock */
 	/* Validly time of the lock is extended. It is because of spending at 
 	   the collision_timeout seconds to detect the collision. */
-	ldata.count = SFEX_NEXT_COUNT(ldata.count);
-	if (write_lockdata(&cdata, &ldata, lock_index) == -1) {
+	for (i = 0; i < num_locks; i++)
+		ldata[i].count = SFEX_NEXT_COUNT(ldata[i].count);
+	if (write_locks(ldata) == -1) {
 		cl_log(LOG_ERR, "write_lockdata failed in extension of lock\n");
 		exit(EXIT_FAILURE);
 	}
+	clock_gettime(CLOCK_MONOTONIC, &last_refresh);
 	cl_log(LOG_INFO, "lock acquired\n");
 }
 
@@ -125,10 +459,24 @@ static void failure_todo(void)
 #endif
 }
 
+/*
+ * update_lock --- refresh every held lock
+ *
+ * The read and the write half are timed into the histograms of stats. The
+ * margin is what is left of lock_timeout between the end of the previous 
+ * write and the end of this one; other nodes take the lock over when it 
+ * reaches zero.
+ */
 static void update_lock(void)
 {
+	struct timespec t0, t1, t2;
+	long long margin;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
 	/* read lock data */
-	if (read_lockdata(&cdata, &ldata, lock_index) == -1) {
+	if (read_locks(ldata) == -1) {
 		cl_log(LOG_ERR, "read_lockdata failed in update_lock\n");
 		error_todo();
 		exit(EXIT_FAILURE);
@@ -136,41 +484,140 @@ static void update_lock(void)
 
 	/* check current lock status */
 	/* if own node is not locking, lock update is failed */
-	if (ldata.status != SFEX_STATUS_LOCK || strncmp((const char*)(ldata.nodename), nodename, sizeof(ldata.nodename))) {
-		cl_log(LOG_ERR, "can't update lock.\n");
-		failure_todo();
-		exit(EXIT_FAILURE); 
+	for (i = 0; i < num_locks; i++) {
+		if (!is_own_lock(&ldata[i])) {
+			cl_log(LOG_ERR, "can't update lock (index=%d).\n", lock_index[i]);
+			failure_todo();
+			exit(EXIT_FAILURE); 
+		}
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
 	/* lock update */
-	ldata.count = SFEX_NEXT_COUNT(ldata.count);
-	if (write_lockdata(&cdata, &ldata, lock_index) == -1) {
+	for (i = 0; i < num_locks; i++)
+		ldata[i].count = SFEX_NEXT_COUNT(ldata[i].count);
+	if (write_locks(ldata) == -1) {
 		cl_log(LOG_ERR, "write_lockdata failed in update_lock\n");
 		error_todo();
 		exit(EXIT_FAILURE);
 	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	margin = lock_timeout - timespec_diff_msec(&t2, &last_refresh);
+	last_refresh = t2;
+
+	sfex_stats_begin(stats);
+	sfex_hist_record(&stats->read, timespec_diff_usec(&t1, &t0));
+	sfex_hist_record(&stats->write, timespec_diff_usec(&t2, &t1));
+	stats->refreshes++;
+	stats->io_retries = io_retries;
+	stats->last_margin = margin;
+	if (stats->refreshes == 1 || margin < stats->min_margin)
+		stats->min_margin = margin;
+	sfex_stats_end(stats);
+}
+
+/*
+ * refresh_loop --- call update_lock() every monitor_interval
+ *
+ * The refreshes are driven by a CLOCK_MONOTONIC timerfd with absolute 
+ * deadlines, so the time spent in update_lock() does not add up to a 
+ * drift. When a refresh does not finish within its slot, or slots are 
+ * missed entirely, it is logged, because that time is lost from the 
+ * lock_timeout safety margin.
+ */
+static void refresh_loop(void)
+{
+	struct itimerspec its;
+	struct timespec slot, now;
+	int tfd;
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (tfd == -1) {
+		cl_log(LOG_ERR, "timerfd_create failed: %s\n", strerror(errno));
+		error_todo();
+		exit(EXIT_FAILURE);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &slot);
+	timespec_add_msec(&slot, monitor_interval);
+	memset(&its, 0, sizeof(its));
+	its.it_value = slot;
+	timespec_add_msec(&its.it_interval, monitor_interval);
+	if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+		cl_log(LOG_ERR, "timerfd_settime failed: %s\n", strerror(errno));
+		error_todo();
+		exit(EXIT_FAILURE);
+	}
+
+	while (1) {
+		uint64_t expirations;
+		ssize_t s;
+		long long elapsed;
+
+		s = read(tfd, &expirations, sizeof(expirations));
+		if (s == -1 && errno == EINTR)
+			continue;
+		if (s != sizeof(expirations)) {
+			cl_log(LOG_ERR, "can't read timerfd: %s\n", strerror(errno));
+			error_todo();
+			exit(EXIT_FAILURE);
+		}
+		if (expirations > 1) {
+			cl_log(LOG_WARNING, "%llu refresh slot(s) missed.\n",
+					(unsigned long long)(expirations - 1));
+			sfex_stats_begin(stats);
+			stats->missed_slots += expirations - 1;
+			sfex_stats_end(stats);
+			timespec_add_msec(&slot, monitor_interval * (long long)(expirations - 1));
+		}
+
+		update_lock();
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = timespec_diff_msec(&now, &slot);
+		if (elapsed > monitor_interval) {
+			cl_log(LOG_WARNING, "lock refresh overran its slot by %lld ms.\n",
+					elapsed - monitor_interval);
+			sfex_stats_begin(stats);
+			stats->slow_refreshes++;
+			sfex_stats_end(stats);
+		}
+		timespec_add_msec(&slot, monitor_interval);
+	}
 }
 
 static void release_lock(void)
 {
 	/* The only thing I care about in release_lock(), is to terminate the process */
+	int i;
+	int released = 0;
 	   
 	/* read lock data */
-	if (read_lockdata(&cdata, &ldata, lock_index) == -1) {
+	if (read_locks(ldata) == -1) {
 		cl_log(LOG_ERR, "read_lockdata failed in release_lock\n");
 		exit(EXIT_FAILURE);
 	}
 
 	/* check current lock status */
 	/* if own node is not locking, we judge that lock has been released already */
-	if (ldata.status != SFEX_STATUS_LOCK || strncmp((const char*)(ldata.nodename), nodename, sizeof(ldata.nodename))) {
-		cl_log(LOG_ERR, "lock was already released.\n");
-		exit(EXIT_FAILURE);
+	for (i = 0; i < num_locks; i++) {
+		if (!is_own_lock(&ldata[i])) {
+			cl_log(LOG_ERR, "lock (index=%d) was already released.\n", lock_index[i]);
+			released = 1;
+		}
 	}
 
 	/* lock release */
-	ldata.status = SFEX_STATUS_UNLOCK;
-	if (write_lockdata(&cdata, &ldata, lock_index) == -1) {
+	/* Only the locks which are still ours may be written back. */
+	if (released) {
+		give_back_locks(ldata);
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < num_locks; i++)
+		ldata[i].status = SFEX_STATUS_UNLOCK;
+	if (write_locks(ldata) == -1) {
 	    /*FIXME: We are going to self-stop */
 		cl_log(LOG_ERR, "write_lockdata failed in release_lock\n");
 		exit(EXIT_FAILURE);
@@ -190,6 +637,7 @@ int main(int argc, char *argv[])
 {	
 
 	int ret;
+	int i, n;
 
 	progname = get_progname(argv[0]);
 	nodename = get_nodename();
@@ -201,35 +649,23 @@ int main(int argc, char *argv[])
 	/* read command line option */
 	opterr = 0;
 	while (1) {
-		int c = getopt(argc, argv, "hi:c:t:m:n:r:");
+		int c = getopt(argc, argv, "hi:c:t:m:n:r:e:S:a:");
 		if (c == -1)
 			break;
 		switch (c) {
 			case 'h':           /* help*/
 				usage(stdout);
 				exit(EXIT_SUCCESS);
-			case 'i':           /* -i <index> */
-				{
-					unsigned long l = strtoul(optarg, NULL, 10);
-					if (l < SFEX_MIN_NUMLOCKS || l > SFEX_MAX_NUMLOCKS) {
-						cl_log(LOG_ERR, 
-								"index %s is out of range or invalid. it must be integer value between %lu and %lu.\n",
-								optarg,
-								(unsigned long)SFEX_MIN_NUMLOCKS,
-								(unsigned long)SFEX_MAX_NUMLOCKS);
-						exit(4);
-					}
-					lock_index = l;
-				}
+			case 'i':           /* -i <index>[,<index>...] */
+				parse_index_list(optarg);
 				break;
 			case 'c':           /* -c <collision_timeout> */
 				{
-					unsigned long l = strtoul(optarg, NULL, 10);
-					if (l < 1 || l > INT_MAX) {
+					long long l = parse_msec(optarg);
+					if (l == -1) {
 						cl_log(LOG_ERR, 
-								"collision_timeout %s is out of range or invalid. it must be integer value between %lu and %lu.\n",
+								"collision_timeout %s is out of range or invalid. it must be between 1ms and %lu seconds.\n",
 								optarg,
-								(unsigned long)1,
 								(unsigned long)INT_MAX);
 						exit(4);
 					}
@@ -238,12 +674,11 @@ int main(int argc, char *argv[])
 				break;
 			case 'm':  			/* -m <monitor_interval> */
 				{
-					unsigned long l = strtoul(optarg, NULL, 10);
-					if (l < 1 || l > INT_MAX) {
+					long long l = parse_msec(optarg);
+					if (l == -1) {
 						cl_log(LOG_ERR, 
-								"monitor_interval %s is out of range or invalid. it must be integer value between %lu and %lu.\n",
+								"monitor_interval %s is out of range or invalid. it must be between 1ms and %lu seconds.\n",
 								optarg,
-								(unsigned long)1,
 								(unsigned long)INT_MAX);
 						exit(4);
 					}
@@ -252,12 +687,11 @@ int main(int argc, char *argv[])
 				break;	
 			case 't':           /* -t <lock_timeout> */
 				{
-					unsigned long l = strtoul(optarg, NULL, 10);
-					if (l < 1 || l > INT_MAX) {
+					long long l = parse_msec(optarg);
+					if (l == -1) {
 						cl_log(LOG_ERR, 
-								"lock_timeout %s is out of range or invalid. it must be integer value between %lu and %lu.\n",
+								"lock_timeout %s is out of range or invalid. it must be between 1ms and %lu seconds.\n",
 								optarg,
-								(unsigned long)1,
 								(unsigned long)INT_MAX);
 						exit(4);
 					}
@@ -281,6 +715,31 @@ int main(int argc, char *argv[])
 					rsc_id = strdup(optarg);
 				}
 				break;
+			case 'e':           /* -e <io_engine> */
+				if (set_io_engine(optarg) == -1) {
+					cl_log(LOG_ERR, "io engine %s is invalid. it must be sync or uring.\n", optarg);
+					exit(4);
+				}
+				break;
+			case 'a':           /* -a <missed_intervals> */
+				{
+					unsigned long l = strtoul(optarg, NULL, 10);
+					if (l < FAST_ACQUIRE_MIN || l > 1000) {
+						cl_log(LOG_ERR, 
+								"missed_intervals %s is out of range or invalid. it must be integer value between %lu and %lu.\n",
+								optarg,
+								(unsigned long)FAST_ACQUIRE_MIN,
+								(unsigned long)1000);
+						exit(4);
+					}
+					fast_acquire = l;
+				}
+				break;
+			case 'S':           /* -S <statsfile> */
+				stats = sfex_stats_create(optarg);
+				if (stats == NULL)
+					exit(EXIT_FAILURE);
+				break;
 			case '?':           /* error */
 				usage(stderr);
 				exit(4);
@@ -297,6 +756,16 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 	device = argv[optind];
+	stats->lock_timeout = lock_timeout;
+	stats->monitor_interval = monitor_interval;
+	if (num_locks == 0)
+		parse_index_list("1");	/* default 1st lock */
+	ldata = calloc(num_locks, sizeof(*ldata));
+	ldata_new = calloc(num_locks, sizeof(*ldata_new));
+	if (ldata == NULL || ldata_new == NULL) {
+		cl_log(LOG_ERR, "%s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
 
 	prepare_lock(device);
 #if !SFEX_TESTING
@@ -307,9 +776,29 @@ int main(int argc, char *argv[])
 	}
 #endif
 
-	ret = lock_index_check(&cdata, lock_index);
+	/* the indexes are sorted, so checking the last one is enough */
+	ret = lock_index_check(&cdata, lock_index[num_locks - 1]);
 	if (ret == -1)
 		exit(EXIT_FAILURE);
+	/* A block of the compact layout is written by its reader, so only
+	   one holder may have lock data in it (see sfex.h). */
+	for (i = 0; i < num_locks; i += n) {
+		int first, last;
+
+		lock_block_range(&cdata, lock_index[i], &first, &last);
+		n = last - first + 1;
+		if (lock_index[i] != first || i + n > num_locks
+			|| lock_index[i + n - 1] != last) {
+			cl_log(LOG_ERR, "index %d shares a block with indexes %d-%d. all of them must be held by one process.\n",
+					lock_index[i], first, last);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (strlen(nodename) > max_nodename(&cdata)) {
+		cl_log(LOG_ERR, "nodename %s is too long for the lock data. must be less than %d byte.\n",
+				nodename, (int)max_nodename(&cdata) + 1);
+		exit(EXIT_FAILURE);
+	}
 
 	{
 		struct sigaction sig_act;
@@ -334,12 +823,11 @@ int main(int argc, char *argv[])
 		release_lock();
 		exit(EXIT_FAILURE);
 	}
+	io_engine_after_fork();
 
 	cl_make_realtime(-1, -1, 128, 128);
 	
 	cl_log(LOG_INFO, "SFeX Daemon started.\n");
-	while (1) {
-		sleep (monitor_interval);
-		update_lock();
-	}
+	refresh_loop();
+	return 0;
 }
@@ -25,7 +25,7 @@
  *
  *-------------------------------------------------------------------------
  *
- * sfex_init [-b <blocksize>] [-n <numlocks>] <device>
+ * sfex_init [-b <blocksize>] [-n <numlocks>] [-f <format>] [-r <recordsize>] [-v] <device>
  *
  * -b <blocksize> --- The size of the block is specified by the number of 
  * bytes. In general, to prevent a partial writing to the disk, the size 
@@ -41,6 +41,21 @@
  * meta-data, you set the value of two or more to numlocks. A necessary disk 
  * area for meta data are (blocksize*(1+numlocks))bytes. Default is 1.
  *
+ * -f <format> --- The version of the meta-data format. 1 is the printable 
+ * format which every SF-EX program can read. 2 is the binary format with 
+ * checksums and a 64bit counter; see sfex.h. Default is 1.
+ *
+ * -r <recordsize> --- The size of one lock data in bytes, format 2 only. 
+ * When it is smaller than the block size, several lock data are packed 
+ * into one block (compact layout), and up to 65535 locks can be stored. 
+ * It must divide the block size. The node name must fit into 
+ * recordsize - 24 bytes. The lock data of one block can only be held 
+ * together, by one sfex_daemon given all of their indexes. Default is 
+ * the block size.
+ *
+ * -v --- After the meta-data is written, read it back and check the 
+ * control data and every lock data.
+ *
  * <device> --- This is file path which stored meta-data. It is usually 
  * expressed in "/dev/...", because it is partition on the shared disk.
  *
@@ -75,7 +90,7 @@ char *nodename;
  * return value --- void
  */
 static void usage(FILE *dist) {
-  fprintf(dist, "usage: %s [-n <numlocks>] <device>\n", progname);
+  fprintf(dist, "usage: %s [-n <numlocks>] [-f <format>] [-r <recordsize>] [-v] <device>\n", progname);
 }
 
 /*
@@ -94,6 +109,9 @@ main(int argc, char *argv[]) {
 
   /* command line parameter */
   int numlocks = 1;		/* default 1 locks  */
+  int version = SFEX_VERSION;	/* default printable format */
+  unsigned long recordsize = 0;	/* default blocksize */
+  int verify = 0;
   const char *device;
 
   /*
@@ -111,7 +129,7 @@ main(int argc, char *argv[]) {
   /* read command line option */
   opterr = 0;
   while (1) {
-    int c = getopt(argc, argv, "hn:");
+    int c = getopt(argc, argv, "hn:f:r:v");
     if (c == -1)
       break;
     switch (c) {
@@ -121,17 +139,41 @@ main(int argc, char *argv[]) {
     case 'n':			/* -n <numlocks> */
       {
 	unsigned long l = strtoul(optarg, NULL, 10);
-	if (l < SFEX_MIN_NUMLOCKS || l > SFEX_MAX_NUMLOCKS) {
+	if (l < SFEX_MIN_NUMLOCKS || l > SFEX_MAX_NUMLOCKS2) {
 	  fprintf(stderr,
 		  "%s: ERROR: numlocks %s is out of range or invalid. it must be integer value between %lu and %lu.\n",
 		  progname, optarg,
 		  (unsigned long)SFEX_MIN_NUMLOCKS,
-		  (unsigned long)SFEX_MAX_NUMLOCKS);
+		  (unsigned long)SFEX_MAX_NUMLOCKS2);
 	  exit(4);
 	}
 	numlocks = l;
       }
       break;
+    case 'f':			/* -f <format> */
+      {
+	unsigned long l = strtoul(optarg, NULL, 10);
+	if (l != SFEX_VERSION && l != SFEX_VERSION2) {
+	  fprintf(stderr,
+		  "%s: ERROR: format %s is invalid. it must be %d or %d.\n",
+		  progname, optarg, SFEX_VERSION, SFEX_VERSION2);
+	  exit(4);
+	}
+	version = l;
+      }
+      break;
+    case 'r':			/* -r <recordsize> */
+      recordsize = strtoul(optarg, NULL, 10);
+      if (recordsize < SFEX_MIN_RECORDSIZE) {
+	fprintf(stderr,
+		"%s: ERROR: recordsize %s is out of range or invalid. it must be %d or more.\n",
+		progname, optarg, SFEX_MIN_RECORDSIZE);
+	exit(4);
+      }
+      break;
+    case 'v':			/* -v */
+      verify = 1;
+      break;
     case '?':			/* error */
       usage(stderr);
       exit(4);
@@ -150,6 +192,18 @@ main(int argc, char *argv[]) {
   }
   device = argv[optind];
 
+  /* version 1 keeps its own limits */
+  if (version == SFEX_VERSION && numlocks > SFEX_MAX_NUMLOCKS) {
+    fprintf(stderr, "%s: ERROR: format %d stores at most %d locks.\n",
+	    progname, version, SFEX_MAX_NUMLOCKS);
+    exit(4);
+  }
+  if (version == SFEX_VERSION && recordsize) {
+    fprintf(stderr, "%s: ERROR: recordsize requires format %d.\n",
+	    progname, SFEX_VERSION2);
+    exit(4);
+  }
+
   prepare_lock(device);
 
   /* main processes start */
@@ -158,19 +212,32 @@ main(int argc, char *argv[]) {
   nodename = get_nodename();
 
   /* create and control data and lock data */
-  init_controldata(&cdata, sector_size, numlocks);
+  init_controldata(&cdata, version, sector_size, numlocks);
+  if (recordsize) {
+    if (recordsize > sector_size || sector_size % recordsize) {
+      fprintf(stderr, "%s: ERROR: recordsize %lu must divide the sector size %lu.\n",
+	      progname, recordsize, sector_size);
+      exit(4);
+    }
+    cdata.recordsize = recordsize;
+  }
   init_lockdata(&ldata);
 
-  /* write out control data and lock data */
-  write_controldata(&cdata);
-  {
-    int index;
-    for (index = 1; index <= numlocks; index++)
-      if (write_lockdata(&cdata, &ldata, index) == -1) {
-        fprintf(stderr, "%s: ERROR: cannot write lock data (index=%d).\n",
-                progname, index);
-        exit(3);
-      }
+  /* write out lock data and control data */
+  if (write_metadata(&cdata, &ldata) == -1) {
+    fprintf(stderr, "%s: ERROR: cannot write lock data.\n", progname);
+    exit(3);
+  }
+  if (verify && verify_metadata(&cdata, &ldata) == -1) {
+    fprintf(stderr, "%s: ERROR: verification of the meta-data failed.\n", progname);
+    exit(3);
+  }
+  if (cdata.recordsize != cdata.blocksize && numlocks > 1) {
+    unsigned long per_block = cdata.blocksize / cdata.recordsize;
+
+    printf("%lu lock data share each block; sfex_daemon must be given all "
+	   "indexes of a block (-i 1-%lu, ...).\n", per_block,
+	   per_block < (unsigned long) numlocks ? per_block : (unsigned long) numlocks);
   }
 
   exit(0);
@@ -25,12 +25,15 @@
  *
  *-------------------------------------------------------------------------*/
 
+#include <config.h>
+
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -41,13 +44,169 @@
 #include <sys/ioctl.h>
 #include <syslog.h>
 #include <linux/fs.h>
+#include <ctype.h>
+#include <time.h>
 
 #include "sfex.h"
 #include "sfex_lib.h"
+#include "sfex_uring.h"
 
 static void *locked_mem;
+static size_t locked_mem_size;
 static int dev_fd;
 unsigned long sector_size = 0;
+unsigned long io_retries = 0;	/* I/O retried on EINTR/EAGAIN */
+
+/* I/O engine used for the meta-data */
+#define SFEX_IO_SYNC 0		/* lseek(2) and read(2)/write(2) */
+#define SFEX_IO_URING 1		/* io_uring with registered fd and buffer */
+static int io_engine = SFEX_IO_SYNC;
+
+/*
+ * set_io_engine --- select the I/O engine by name
+ *
+ * This must be called before prepare_lock(). "sync" is the default.
+ * If "uring" is selected but io_uring is unavailable, prepare_lock()
+ * falls back to "sync".
+ */
+int
+set_io_engine (const char *name)
+{
+  if (strcmp (name, "sync") == 0)
+    io_engine = SFEX_IO_SYNC;
+  else if (strcmp (name, "uring") == 0)
+    io_engine = SFEX_IO_URING;
+  else
+    return -1;
+  return 0;
+}
+
+/*
+ * io_engine_after_fork --- re-register the I/O buffer in a forked child
+ *
+ * The registered buffer pins the pages of the process which registered 
+ * it. After fork(2) the child writes into its own copy of locked_mem, so 
+ * the buffer must be registered again or the parent's stale pages would 
+ * be written to the disk.
+ */
+void
+io_engine_after_fork (void)
+{
+  if (io_engine == SFEX_IO_URING
+      && sfex_uring_register_buffer (locked_mem, locked_mem_size) == -1) {
+    cl_log(LOG_INFO, "falling back to the sync I/O engine\n");
+    io_engine = SFEX_IO_SYNC;
+  }
+}
+
+/*
+ * dev_read, dev_write --- transfer size bytes at offset of the device
+ *
+ * The return value is the number of transferred bytes, or -1 with errno 
+ * set. EINTR and EAGAIN are retried here.
+ */
+static ssize_t
+dev_read (void *buf, size_t size, off_t offset)
+{
+  ssize_t s;
+
+  if (io_engine == SFEX_IO_URING)
+    return sfex_uring_rw (0, buf, size, offset);
+
+  if (lseek (dev_fd, offset, SEEK_SET) == -1)
+    return -1;
+  while ((s = read (dev_fd, buf, size)) == -1
+	 && (errno == EINTR || errno == EAGAIN))
+    io_retries++;
+  return s;
+}
+
+static ssize_t
+dev_write (const void *buf, size_t size, off_t offset)
+{
+  ssize_t s;
+
+  if (io_engine == SFEX_IO_URING)
+    return sfex_uring_rw (1, buf, size, offset);
+
+  if (lseek (dev_fd, offset, SEEK_SET) == -1)
+    return -1;
+  while ((s = write (dev_fd, buf, size)) == -1
+	 && (errno == EINTR || errno == EAGAIN))
+    io_retries++;
+  return s;
+}
+
+/*
+ * sfex_crc32c --- CRC32C (Castagnoli) used by the version 2 format
+ *
+ * crc is 0 for a new checksum, or the result of the previous call to 
+ * continue it.
+ */
+uint32_t
+sfex_crc32c (uint32_t crc, const void *buf, size_t len)
+{
+  static uint32_t table[256];
+  const uint8_t *p = buf;
+
+  if (table[1] == 0) {
+    uint32_t i, j, c;
+    for (i = 0; i < 256; i++) {
+      c = i;
+      for (j = 0; j < 8; j++)
+	c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+      table[i] = c;
+    }
+  }
+
+  crc = ~crc;
+  while (len--)
+    crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static void
+put_le32 (uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void
+put_le64 (uint8_t *p, uint64_t v)
+{
+  put_le32 (p, (uint32_t) v);
+  put_le32 (p + 4, (uint32_t) (v >> 32));
+}
+
+static uint16_t
+get_le16 (const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t
+get_le32 (const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t
+get_le64 (const uint8_t *p)
+{
+  return get_le32 (p) | ((uint64_t) get_le32 (p + 4) << 32);
+}
+
+static uint64_t
+monotonic_msec (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
 int
 prepare_lock (const char *device)
@@ -81,6 +240,13 @@ prepare_lock (const char *device)
     exit (3);
   }
   memset (locked_mem, 0, sector_size);
+  locked_mem_size = sector_size;
+
+  if (io_engine == SFEX_IO_URING
+      && sfex_uring_init (dev_fd, locked_mem, locked_mem_size) == -1) {
+    cl_log(LOG_INFO, "falling back to the sync I/O engine\n");
+    io_engine = SFEX_IO_SYNC;
+  }
 
   return 0;
 }
@@ -138,15 +304,18 @@ get_nodename (void)
 /*
  * init_controldata --- initialize control data
  *
- * We initialize each member of sfex_controldata structure.
+ * We initialize each member of sfex_controldata structure. version is 
+ * SFEX_VERSION or SFEX_VERSION2 and selects the on-disk format.
  */
 void
-init_controldata (sfex_controldata * cdata, size_t blocksize, int numlocks)
+init_controldata (sfex_controldata * cdata, int version, size_t blocksize,
+		  int numlocks)
 {
   memcpy (cdata->magic, SFEX_MAGIC, sizeof (cdata->magic));
-  cdata->version = SFEX_VERSION;
+  cdata->version = version;
   cdata->revision = SFEX_REVISION;
   cdata->blocksize = blocksize;
+  cdata->recordsize = blocksize;
   cdata->numlocks = numlocks;
 }
 
@@ -163,6 +332,62 @@ init_lockdata (sfex_lockdata * ldata)
   ldata->nodename[0] = 0;
 }
 
+/*
+ * pack_controldata_v2, unpack_controldata_v2 --- binary control data
+ *
+ * See sfex_controldata_ondisk_v2 in sfex.h.
+ */
+static void
+pack_controldata_v2 (const sfex_controldata * cdata, void *buf)
+{
+  sfex_controldata_ondisk_v2 *block = (sfex_controldata_ondisk_v2 *) buf;
+
+  memset (block, 0, cdata->blocksize);
+  memcpy (block->magic, cdata->magic, sizeof (block->magic));
+  put_le32 (block->version, cdata->version);
+  put_le32 (block->revision, cdata->revision);
+  put_le32 (block->blocksize, cdata->blocksize);
+  put_le32 (block->numlocks, cdata->numlocks);
+  if (cdata->recordsize != cdata->blocksize)
+    put_le32 (block->recordsize, cdata->recordsize);
+  put_le32 (block->crc, sfex_crc32c (0, block, sizeof (*block)));
+}
+
+static int
+unpack_controldata_v2 (const void *buf, sfex_controldata * cdata)
+{
+  sfex_controldata_ondisk_v2 block;
+
+  memcpy (&block, buf, sizeof (block));
+  memset (block.crc, 0, sizeof (block.crc));
+  if (sfex_crc32c (0, &block, sizeof (block))
+      != get_le32 (((const sfex_controldata_ondisk_v2 *) buf)->crc)) {
+    cl_log(LOG_ERR, "control data checksum error.\n");
+    return -1;
+  }
+  cdata->version = get_le32 (block.version);
+  if (cdata->version != SFEX_VERSION2) {
+    cl_log(LOG_ERR,
+	   "version number mismatched. program is %d or %d, data is %d.\n",
+	   SFEX_VERSION, SFEX_VERSION2, cdata->version);
+    return -1;
+  }
+  cdata->revision = get_le32 (block.revision);
+  cdata->blocksize = get_le32 (block.blocksize);
+  cdata->numlocks = get_le32 (block.numlocks);
+  cdata->recordsize = get_le32 (block.recordsize);
+  if (cdata->recordsize == 0)
+    cdata->recordsize = cdata->blocksize;
+  if (cdata->numlocks < SFEX_MIN_NUMLOCKS || cdata->numlocks > SFEX_MAX_NUMLOCKS2
+      || cdata->recordsize < SFEX_MIN_RECORDSIZE
+      || cdata->recordsize > cdata->blocksize
+      || cdata->blocksize % cdata->recordsize) {
+    cl_log(LOG_ERR, "control data format error.\n");
+    return -1;
+  }
+  return 0;
+}
+
 /*
  * write_controldata --- write control data into file
  *
@@ -177,48 +402,273 @@ void
 write_controldata (const sfex_controldata * cdata)
 {
   sfex_controldata_ondisk *block;
-  int fd;
 
   block = (sfex_controldata_ondisk *) (locked_mem);
 
-  /* We write control data into the buffer with given format. */
-  /* We write the offset value of each field of the control data directly.
-   * Because a point using this value is limited to two places, we do not 
-   * use macro. If you change the following offset values, you must change 
-   * values in the read_controldata() function.
-   */
-  memset (block, 0, cdata->blocksize);
-  memcpy (block->magic, cdata->magic, sizeof (block->magic));
-  snprintf ((char *) (block->version), sizeof (block->version), "%d",
-	    cdata->version);
-  snprintf ((char *) (block->revision), sizeof (block->revision), "%d",
-	    cdata->revision);
-  snprintf ((char *) (block->blocksize), sizeof (block->blocksize), "%u",
-	    (unsigned)cdata->blocksize);
-  snprintf ((char *) (block->numlocks), sizeof (block->numlocks), "%d",
-	    cdata->numlocks);
-
-  fd = dev_fd;
-  if (lseek (fd, 0, SEEK_SET) == -1) {
-    cl_log(LOG_ERR, "can't seek file pointer: %s\n",
+  if (cdata->version == SFEX_VERSION2)
+    pack_controldata_v2 (cdata, locked_mem);
+  else {
+    /* We write control data into the buffer with given format. */
+    /* We write the offset value of each field of the control data directly.
+     * Because a point using this value is limited to two places, we do not 
+     * use macro. If you change the following offset values, you must change 
+     * values in the read_controldata() function.
+     */
+    memset (block, 0, cdata->blocksize);
+    memcpy (block->magic, cdata->magic, sizeof (block->magic));
+    snprintf ((char *) (block->version), sizeof (block->version), "%d",
+	      cdata->version);
+    snprintf ((char *) (block->revision), sizeof (block->revision), "%d",
+	      cdata->revision);
+    snprintf ((char *) (block->blocksize), sizeof (block->blocksize), "%u",
+	      (unsigned)cdata->blocksize);
+    snprintf ((char *) (block->numlocks), sizeof (block->numlocks), "%d",
+	      cdata->numlocks);
+  }
+
+  /* write buffer into a file  */
+  if (dev_write (block, cdata->blocksize, 0) == -1) {
+    cl_log(LOG_ERR, "can't write meta-data: %s\n",
 		  strerror (errno));
     exit (3);
   }
+}
 
-  /* write buffer into a file  */
-  do {
-	  ssize_t s = write (fd, block, cdata->blocksize);
-	  if (s == -1) {
-		  if (errno == EINTR || errno == EAGAIN)
-			  continue;
-		  cl_log(LOG_ERR, "can't write meta-data: %s\n",
-				strerror (errno));
-		  exit (3);
-	  }
-	  else
-		  break;
+/*
+ * get_locked_mem --- get an aligned I/O buffer of at least size bytes
+ *
+ * The buffer allocated by prepare_lock() holds one sector. When several
+ * adjacent lock data are transferred at once, it is grown here. The
+ * previous contents are not preserved.
+ */
+static void *
+get_locked_mem (size_t size)
+{
+  void *p;
+
+  if (size <= locked_mem_size)
+    return locked_mem;
+
+  if (posix_memalign (&p, SFEX_ODIRECT_ALIGNMENT, size) != 0) {
+    cl_log(LOG_ERR, "Failed to allocate aligned memory\n");
+    return NULL;
   }
-  while (1);
+  free (locked_mem);
+  locked_mem = p;
+  locked_mem_size = size;
+  memset (locked_mem, 0, size);
+  if (io_engine == SFEX_IO_URING
+      && sfex_uring_register_buffer (locked_mem, locked_mem_size) == -1) {
+    cl_log(LOG_INFO, "falling back to the sync I/O engine\n");
+    io_engine = SFEX_IO_SYNC;
+  }
+  return locked_mem;
+}
+
+/*
+ * max_nodename --- the longest node name which fits into one lock data
+ */
+size_t
+max_nodename (const sfex_controldata * cdata)
+{
+  size_t room;
+
+  if (cdata->version != SFEX_VERSION2)
+    return SFEX_MAX_NODENAME;
+  room = cdata->recordsize - sizeof (sfex_lockdata_ondisk_v2);
+  return room < SFEX_MAX_NODENAME ? room : SFEX_MAX_NODENAME;
+}
+
+/*
+ * pack_lockdata_v2, unpack_lockdata_v2 --- binary lock data
+ *
+ * See sfex_lockdata_ondisk_v2 in sfex.h.
+ */
+static void
+pack_lockdata_v2 (const sfex_controldata * cdata,
+		  const sfex_lockdata * ldata, void *buf)
+{
+  sfex_lockdata_ondisk_v2 *block = (sfex_lockdata_ondisk_v2 *) buf;
+  size_t namelen = strnlen (ldata->nodename, max_nodename (cdata));
+
+  memset (block, 0, cdata->recordsize);
+  block->status = ldata->status;
+  block->namelen = namelen;
+  {
+    uint32_t ticks = (ldata->interval + 9) / 10;
+    if (ticks > 0xffff)
+      ticks = 0xffff;
+    block->interval[0] = ticks;
+    block->interval[1] = ticks >> 8;
+  }
+  put_le64 (block->generation, ldata->count);
+  put_le64 (block->timestamp, monotonic_msec ());
+  memcpy (block->nodename, ldata->nodename, namelen);
+  put_le32 (block->crc, sfex_crc32c (0, block, cdata->recordsize));
+}
+
+static int
+unpack_lockdata_v2 (const sfex_controldata * cdata, const void *buf,
+		    sfex_lockdata * ldata)
+{
+  const sfex_lockdata_ondisk_v2 *block = (const sfex_lockdata_ondisk_v2 *) buf;
+  static const uint8_t zero[4];
+  uint32_t crc;
+
+  crc = sfex_crc32c (0, block, offsetof (sfex_lockdata_ondisk_v2, crc));
+  crc = sfex_crc32c (crc, zero, sizeof (zero));
+  crc = sfex_crc32c (crc, block->generation,
+		     cdata->recordsize - offsetof (sfex_lockdata_ondisk_v2, generation));
+  if (crc != get_le32 (block->crc)) {
+    cl_log(LOG_ERR, "lock data checksum error.\n");
+    return -1;
+  }
+  ldata->status = block->status;
+  if ((ldata->status != SFEX_STATUS_UNLOCK
+       && ldata->status != SFEX_STATUS_LOCK)
+      || block->namelen > max_nodename (cdata)) {
+    cl_log(LOG_ERR, "lock data format error.\n");
+    return -1;
+  }
+  ldata->count = get_le64 (block->generation);
+  ldata->timestamp = get_le64 (block->timestamp);
+  ldata->interval = get_le16 (block->interval) * 10;
+  memcpy (ldata->nodename, block->nodename, block->namelen);
+  ldata->nodename[block->namelen] = 0;
+  return 0;
+}
+
+/*
+ * pack_lockdata --- format one lock data into an on-disk block
+ *
+ * We write the offset value of each field of the control data directly.
+ * Because a point using this value is limited to two places, we do not 
+ * use macro. If you chage the following offset values, you must change 
+ * values in the unpack_lockdata() function.
+ */
+static void
+pack_lockdata (const sfex_controldata * cdata, const sfex_lockdata * ldata,
+	       void *buf)
+{
+  sfex_lockdata_ondisk *block = (sfex_lockdata_ondisk *) buf;
+
+  if (cdata->version == SFEX_VERSION2) {
+    pack_lockdata_v2 (cdata, ldata, buf);
+    return;
+  }
+
+  memset (block, 0, cdata->blocksize);
+  block->status = ldata->status;
+  snprintf ((char *) (block->count), sizeof (block->count), "%d",
+	    (int) (ldata->count % (SFEX_MAX_COUNT + 1)));
+  snprintf ((char *) (block->nodename), sizeof (block->nodename), "%s",
+	    ldata->nodename);
+}
+
+/*
+ * unpack_lockdata --- parse one on-disk block into lock data
+ *
+ * 1. check null terminator of each field 2. check the status
+ */
+static int
+unpack_lockdata (const sfex_controldata * cdata, const void *buf,
+		 sfex_lockdata * ldata)
+{
+  const sfex_lockdata_ondisk *block = (const sfex_lockdata_ondisk *) buf;
+
+  if (cdata->version == SFEX_VERSION2)
+    return unpack_lockdata_v2 (cdata, buf, ldata);
+
+  if (block->count[sizeof(block->count)-1] || block->nodename[sizeof(block->nodename)-1]) {
+    cl_log(LOG_ERR, "lock data format error.\n");
+    return -1;
+  }
+  ldata->status = block->status;
+  if (ldata->status != SFEX_STATUS_UNLOCK
+      && ldata->status != SFEX_STATUS_LOCK) {
+    cl_log(LOG_ERR, "lock data format error.\n");
+    return -1;
+  }
+  ldata->count = atoi ((const char *) (block->count));
+  ldata->timestamp = 0;
+  ldata->interval = 0;
+  strncpy ((char *) (ldata->nodename), (const char *) (block->nodename), sizeof(block->nodename));
+
+#ifdef SFEX_DEBUG
+  cl_log(LOG_INFO, "status: %c\n", ldata->status);
+  cl_log(LOG_INFO, "count: %llu\n", (unsigned long long)ldata->count);
+  cl_log(LOG_INFO, "nodename: %s\n", ldata->nodename);
+#endif
+  return 0;
+}
+
+/*
+ * record_block --- number of the block which stores the lock data of index
+ *
+ * The control data is block 0. With the compact layout of version 2 
+ * (recordsize < blocksize), blocksize / recordsize lock data share one 
+ * block; otherwise lock data #n is stored in block n.
+ */
+static int
+record_block (const sfex_controldata * cdata, int index)
+{
+  return 1 + (index - 1) / (cdata->blocksize / cdata->recordsize);
+}
+
+/*
+ * lock_block_range --- the indexes whose lock data share a block with index
+ *
+ * first and last are set to the lowest and the highest of them; both are
+ * index itself unless the compact layout is used.
+ */
+void
+lock_block_range (const sfex_controldata * cdata, int index,
+		  int *first, int *last)
+{
+  int per_block = cdata->blocksize / cdata->recordsize;
+
+  *first = (record_block (cdata, index) - 1) * per_block + 1;
+  *last = *first + per_block - 1;
+  if (*last > cdata->numlocks)
+    *last = cdata->numlocks;
+}
+
+/*
+ * record_offset --- offset of the lock data of index in a buffer which 
+ * holds the blocks starting at block first
+ */
+static size_t
+record_offset (const sfex_controldata * cdata, int first, int index)
+{
+  int per_block = cdata->blocksize / cdata->recordsize;
+
+  return (size_t) ((index - 1) - (first - 1) * per_block) * cdata->recordsize;
+}
+
+/*
+ * transfer_blocks --- read or write size bytes of whole blocks from block 
+ * first
+ */
+static int
+transfer_blocks (const sfex_controldata * cdata, int write, void *buf,
+		 int first, size_t size)
+{
+  off_t offset = (off_t) cdata->blocksize * first;
+  ssize_t s;
+
+  s = write ? dev_write (buf, size, offset) : dev_read (buf, size, offset);
+  if (s == -1) {
+    cl_log(LOG_ERR, write ? "can't write meta-data: %s\n"
+	   : "can't read lockdata meta-data: %s\n", strerror (errno));
+    return -1;
+  }
+  else if (s != size) {
+    /* if writing atomically failed, this process is error */
+    cl_log(LOG_ERR, write ? "can't write meta-data atomically.\n"
+	   : "can't read meta-data atomically.\n");
+    return -1;
+  }
+  return 0;
 }
 
 /*
@@ -239,51 +689,47 @@ int
 write_lockdata (const sfex_controldata * cdata, const sfex_lockdata * ldata,
 		int index)
 {
-  sfex_lockdata_ondisk *block;
-  int fd;
+  return write_lockdata_run (cdata, ldata, index, 1);
+}
 
-  block = (sfex_lockdata_ondisk *) locked_mem;
-  /* We write lock data into buffer with given format */
-  /* We write the offset value of each field of the control data directly.
-   * Because a point using this value is limited to two places, we do not 
-   * use macro. If you chage the following offset values, you must change 
-   * values in the read_lockdata() function.
-   */
-  memset (block, 0, cdata->blocksize);
-  block->status = ldata->status;
-  snprintf ((char *) (block->count), sizeof (block->count), "%d",
-	    ldata->count);
-  snprintf ((char *) (block->nodename), sizeof (block->nodename), "%s",
-	    ldata->nodename);
+/*
+ * write_lockdata_run --- write adjacent lock data into file at once
+ *
+ * We format count lock data into one buffer and write them out with a 
+ * single write(2). Each lock data still occupies its own block, so the 
+ * atomicity of one block is kept.
+ *
+ * cdata --- pointer for control data
+ *
+ * ldata --- array of count lock data
+ *
+ * index --- index number of the first lock data. 1 origin.
+ *
+ * count --- number of lock data
+ */
+int
+write_lockdata_run (const sfex_controldata * cdata,
+		    const sfex_lockdata * ldata, int index, int count)
+{
+  int first = record_block (cdata, index);
+  size_t size = cdata->blocksize * (record_block (cdata, index + count - 1) - first + 1);
+  char *buf;
+  int i;
 
-  fd = dev_fd;
+  buf = get_locked_mem (size);
+  if (buf == NULL)
+    return -1;
 
-  /* seek a file pointer to given position */
-  if (lseek (fd, cdata->blocksize * index, SEEK_SET) == -1) {
-    cl_log(LOG_ERR, "can't seek file pointer: %s\n",
-		  strerror (errno));
+  /* When several lock data share a block, the records of the other 
+     indexes are read first and written back unchanged. */
+  if (cdata->recordsize != cdata->blocksize
+      && transfer_blocks (cdata, 0, buf, first, size) == -1)
     return -1;
-  }
 
-  /* write buffer into file */
-  do {
-    ssize_t s = write (fd, block, cdata->blocksize);
-    if (s == -1) {
-      if (errno == EINTR || errno == EAGAIN)
-	continue;
-      cl_log(LOG_ERR, "can't write meta-data: %s\n",
-		    strerror (errno));
-      return -1;
-    }
-    else if (s != cdata->blocksize) {
-      /* if writing atomically failed, this process is error */
-      cl_log(LOG_ERR, "can't write meta-data atomically.\n");
-      return -1;
-    }
-    break;
-  }
-  while (1);
-  return 0;
+  for (i = 0; i < count; i++)
+    pack_lockdata (cdata, &ldata[i], buf + record_offset (cdata, first, index + i));
+
+  return transfer_blocks (cdata, 1, buf, first, size);
 }
 
 /*
@@ -302,27 +748,14 @@ read_controldata (sfex_controldata * cdata)
 
   block = (sfex_controldata_ondisk *) (locked_mem);
 
-  if (lseek (dev_fd, 0, SEEK_SET) == -1) {
-    cl_log(LOG_ERR, "can't seek file pointer: %s\n",
-		  strerror (errno));
+  /* read data from file */
+  if (dev_read (block, sector_size, 0) == -1) {
+    cl_log(LOG_ERR,
+	   "can't read controldata meta-data: %s\n",
+	   strerror (errno));
     return -1;
   }
 
-  /* read data from file */
-  do {
-	  ssize_t s = read (dev_fd, block, sector_size);
-	  if (s == -1) {
-		  if (errno == EINTR || errno == EAGAIN)
-			  continue;
-		  cl_log(LOG_ERR,
-			  "can't read controldata meta-data: %s\n",
-			   strerror (errno));
-		  return -1;
-	  }
-	  else
-		  break;
-  } while (1);
-
   /* read control data from buffer */
   /* 1. check the magic number.  2. check null terminator of each field 
      3. check the version number.  4. Unmuch of revision number is allowed  */
@@ -336,6 +769,9 @@ read_controldata (sfex_controldata * cdata)
     cl_log(LOG_ERR, "magic number mismatched. %c%c%c%c <-> %s\n", block->magic[0], block->magic[1], block->magic[2], block->magic[3], SFEX_MAGIC);
     return -1;
   }
+  /* version 1 stores a printable number, version 2 a binary one */
+  if (!isdigit (block->version[0]))
+    return unpack_controldata_v2 (block, cdata);
   if (block->version[sizeof (block->version)-1]
       || block->revision[sizeof (block->revision)-1]
       || block->blocksize[sizeof (block->blocksize)-1]
@@ -352,6 +788,7 @@ read_controldata (sfex_controldata * cdata)
   }
   cdata->revision = atoi ((char *) (block->revision));
   cdata->blocksize = atoi ((char *) (block->blocksize));
+  cdata->recordsize = cdata->blocksize;
   cdata->numlocks = atoi ((char *) (block->numlocks));
 
   return 0;
@@ -376,64 +813,156 @@ int
 read_lockdata (const sfex_controldata * cdata, sfex_lockdata * ldata,
 	       int index)
 {
-  sfex_lockdata_ondisk *block;
-  int fd;
+  return read_lockdata_run (cdata, ldata, index, 1);
+}
 
-  block = (sfex_lockdata_ondisk *) (locked_mem);
+/*
+ * read_lockdata_run --- read adjacent lock data from file at once
+ *
+ * read count sfex_lockdata starting at index with a single read(2).
+ *
+ * cdata --- pointer for control data
+ *
+ * ldata --- array of count lock data. Read lock data are stored here.
+ *
+ * index --- index number of the first lock data. 1 origin.
+ *
+ * count --- number of lock data
+ */
+int
+read_lockdata_run (const sfex_controldata * cdata, sfex_lockdata * ldata,
+		   int index, int count)
+{
+  return read_lockdata_each (cdata, ldata, NULL, index, count);
+}
 
-  fd = dev_fd;
+/*
+ * read_lockdata_each --- read adjacent lock data, decoding each one alone
+ *
+ * Like read_lockdata_run, but when bad is not NULL a lock data which 
+ * can't be decoded only sets its bad[] entry and the others are still 
+ * returned. Returns -1 if the read fails (or, without bad, if any lock 
+ * data is broken), otherwise the number of broken lock data.
+ */
+int
+read_lockdata_each (const sfex_controldata * cdata, sfex_lockdata * ldata,
+		    int *bad, int index, int count)
+{
+  int first = record_block (cdata, index);
+  size_t size = cdata->blocksize * (record_block (cdata, index + count - 1) - first + 1);
+  char *buf;
+  int i, nbad = 0;
 
-  /* seek a file pointer to given position */
-  if (lseek (fd, cdata->blocksize * index, SEEK_SET) == -1) {
-    cl_log(LOG_ERR, "can't seek file pointer: %s\n",
-		  strerror (errno));
+  buf = get_locked_mem (size);
+  if (buf == NULL)
     return -1;
-  }
 
-  /* read from file */
-  do {
-    ssize_t s = read (fd, block, cdata->blocksize);
-    if (s == -1) {
-      if (errno == EINTR || errno == EAGAIN)
-	continue;
-      cl_log(LOG_ERR, "can't read lockdata meta-data: %s\n",
-		    strerror (errno));
-      return -1;
-    }
-    else if (s != cdata->blocksize) {
-      cl_log(LOG_ERR, "can't read meta-data atomically.\n");
-      return -1;
+  if (transfer_blocks (cdata, 0, buf, first, size) == -1)
+    return -1;
+
+  for (i = 0; i < count; i++) {
+    int ret = unpack_lockdata (cdata, buf + record_offset (cdata, first, index + i), &ldata[i]);
+
+    if (bad == NULL) {
+      if (ret == -1)
+	return -1;
+      continue;
     }
-    break;
+    bad[i] = ret == -1;
+    nbad += bad[i];
   }
-  while (1);
+  return nbad;
+}
 
-  /* read control data form buffer */
-  /* 1. check null terminator of each field 2. check the status */
-  /* We write the offset value of each field of the control data directly.
-   * Because a point using this value is limited to two places, we do not 
-   * use macro. If you chage the following offset values, you must change 
-   * values in the write_lockdata() function.
-   */
-  if (block->count[sizeof(block->count)-1] || block->nodename[sizeof(block->nodename)-1]) {
-    cl_log(LOG_ERR, "lock data format error.\n");
+/*
+ * write_metadata --- format the whole meta-data area
+ *
+ * Every lock data is set to ldata. The lock data area is built in one 
+ * aligned buffer and written with writes of up to SFEX_FORMAT_CHUNK bytes
+ * instead of one synchronous write per lock. The control data is written
+ * last, so an interrupted format does not leave valid looking meta-data.
+ */
+#define SFEX_FORMAT_CHUNK (1024 * 1024)
+
+int
+write_metadata (const sfex_controldata * cdata, const sfex_lockdata * ldata)
+{
+  int last = record_block (cdata, cdata->numlocks);
+  int per_chunk = SFEX_FORMAT_CHUNK / cdata->blocksize;
+  int block, n;
+  int index = 1;
+  char *buf;
+
+  if (per_chunk < 1)
+    per_chunk = 1;
+  if (per_chunk > last)
+    per_chunk = last;
+  buf = get_locked_mem (cdata->blocksize * per_chunk);
+  if (buf == NULL)
     return -1;
+
+  for (block = 1; block <= last; block += n) {
+    n = last - block + 1 < per_chunk ? last - block + 1 : per_chunk;
+    memset (buf, 0, cdata->blocksize * n);
+    for (; index <= cdata->numlocks && record_block (cdata, index) < block + n; index++)
+      pack_lockdata (cdata, ldata, buf + record_offset (cdata, block, index));
+    if (transfer_blocks (cdata, 1, buf, block, cdata->blocksize * n) == -1)
+      return -1;
   }
-  ldata->status = block->status;
-  if (ldata->status != SFEX_STATUS_UNLOCK
-      && ldata->status != SFEX_STATUS_LOCK) {
-    cl_log(LOG_ERR, "lock data format error.\n");
+
+  write_controldata (cdata);
+  return 0;
+}
+
+/*
+ * verify_metadata --- check a meta-data area written by write_metadata()
+ *
+ * The control data and every lock data are read back, in chunks of 
+ * SFEX_FORMAT_CHUNK bytes, and compared with cdata and ldata. Each 
+ * mismatch is logged. Returns -1 if there was any.
+ */
+int
+verify_metadata (const sfex_controldata * cdata, const sfex_lockdata * ldata)
+{
+  sfex_controldata c;
+  sfex_lockdata l;
+  int last = record_block (cdata, cdata->numlocks);
+  int per_chunk = SFEX_FORMAT_CHUNK / cdata->blocksize;
+  int block, n;
+  int index = 1;
+  int errors = 0;
+  char *buf;
+
+  if (read_controldata (&c) == -1)
+    return -1;
+  if (c.version != cdata->version || c.blocksize != cdata->blocksize
+      || c.recordsize != cdata->recordsize || c.numlocks != cdata->numlocks) {
+    cl_log(LOG_ERR, "control data mismatch.\n");
     return -1;
   }
-  ldata->count = atoi ((char *) (block->count));
-  strncpy ((char *) (ldata->nodename), (const char *) (block->nodename), sizeof(block->nodename));
 
-#ifdef SFEX_DEBUG
-  cl_log(LOG_INFO, "status: %c\n", ldata->status);
-  cl_log(LOG_INFO, "count: %d\n", ldata->count);
-  cl_log(LOG_INFO, "nodename: %s\n", ldata->nodename);
-#endif
-  return 0;
+  if (per_chunk < 1)
+    per_chunk = 1;
+  if (per_chunk > last)
+    per_chunk = last;
+  buf = get_locked_mem (cdata->blocksize * per_chunk);
+  if (buf == NULL)
+    return -1;
+
+  for (block = 1; block <= last; block += n) {
+    n = last - block + 1 < per_chunk ? last - block + 1 : per_chunk;
+    if (transfer_blocks (cdata, 0, buf, block, cdata->blocksize * n) == -1)
+      return -1;
+    for (; index <= cdata->numlocks && record_block (cdata, index) < block + n; index++) {
+      if (unpack_lockdata (cdata, buf + record_offset (cdata, block, index), &l) == -1
+	  || l.status != ldata->status || l.count != ldata->count
+	  || strcmp (l.nodename, ldata->nodename)) {
+	cl_log(LOG_ERR, "lock data mismatch (index=%d).\n", index);
+	errors++;
+      }
+    }
+  }
+  return errors ? -1 : 0;
 }
 
 /*
@@ -28,15 +28,25 @@
 #ifndef LIB_H
 #define LIB_H
 
+uint32_t sfex_crc32c(uint32_t crc, const void *buf, size_t len);
 const char *get_progname(const char *argv0);
 char *get_nodename(void);
-void init_controldata(sfex_controldata *cdata, size_t blocksize, int numlocks);
+void init_controldata(sfex_controldata *cdata, int version, size_t blocksize, int numlocks);
 void init_lockdata(sfex_lockdata *ldata);
 void write_controldata(const sfex_controldata *cdata);
 int write_lockdata(const sfex_controldata *cdata, const sfex_lockdata *ldata, int index);
 int read_controldata(sfex_controldata *cdata);
 int read_lockdata(const sfex_controldata *cdata, sfex_lockdata *ldata, int index);
+int write_lockdata_run(const sfex_controldata *cdata, const sfex_lockdata *ldata, int index, int count);
+int read_lockdata_run(const sfex_controldata *cdata, sfex_lockdata *ldata, int index, int count);
+int read_lockdata_each(const sfex_controldata *cdata, sfex_lockdata *ldata, int *bad, int index, int count);
+int set_io_engine(const char *name);
+void io_engine_after_fork(void);
 int prepare_lock(const char *device);
+int write_metadata(const sfex_controldata *cdata, const sfex_lockdata *ldata);
+int verify_metadata(const sfex_controldata *cdata, const sfex_lockdata *ldata);
 int lock_index_check(sfex_controldata * cdata, int index);
+void lock_block_range(const sfex_controldata *cdata, int index, int *first, int *last);
+size_t max_nodename(const sfex_controldata *cdata);
 
 #endif /* LIB_H */
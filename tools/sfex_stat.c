@@ -26,17 +26,36 @@
  *-------------------------------------------------------------------------
  *
  * sfex_stat [-i <index>] <device>
+ * sfex_stat -a [-F text|tsv|json] [-w <msec>] <device>
+ * sfex_stat -s <statsfile> [-F text|tsv|json]
  *
  * -i <index> --- The index is number of the resource that display the lock.
  * This number is specified by the integer of one or more. When two or more 
  * resources are exclusively controlled by one meta-data, this option is used. 
  * Default is 1.
  *
+ * -a, --all --- Read the whole meta-data area with one read and display 
+ * every lock data.
+ *
+ * -F, --format <format> --- Output format of --all. "text" is the format of
+ * a single lock data. "tsv" prints one line per lock with the fields index,
+ * status, count, nodename and timestamp separated by tabs. "json" prints 
+ * one JSON object per line with the same fields. Default is text.
+ *
+ * -w, --watch <msec> --- With --all, re-read the meta-data every msec 
+ * milliseconds and print only the lock data which changed. This does not 
+ * return.
+ *
+ * -s, --stats <statsfile> --- Display the lock refresh statistics which 
+ * sfex_daemon publishes with its -S option: counters, the remaining 
+ * lock_timeout margin and percentiles of the read and write latency. 
+ * No device is needed.
+ *
  * <device> --- This is file path which stored meta-data. It is usually 
  * expressed in "/dev/...", because it is partition on the shared disk.
  *
- * exit code --- 0 - Normal end. Own node is holding lock. 2 - Normal 
- * end. Own node does not hold a lock. 3 - Error occurs while processing 
+ * exit code --- 0 - Normal end. Own node is holding lock (always with 
+ * --all). 2 - Normal end. Own node does not hold a lock. 3 - Error occurs while processing 
  * it. The content of the error is displayed into stderr. 4 - The mistake 
  * is found in the command line parameter.
  *
@@ -49,12 +68,15 @@
 #include <errno.h>
 #include <string.h>
 #include <limits.h>
+#include <time.h>
+#include <getopt.h>
 #if HAVE_UNISTD_H
 #  include <unistd.h>
 #endif
 
 #include "sfex.h"
 #include "sfex_lib.h"
+#include "sfex_stats.h"
 
 const char *progname;
 char *nodename;
@@ -62,6 +84,11 @@ char *nodename;
 void print_controldata(const sfex_controldata *cdata);
 void print_lockdata(const sfex_lockdata *ldata, int index);
 
+/* output formats of --all */
+#define FORMAT_TEXT 0
+#define FORMAT_TSV 1
+#define FORMAT_JSON 2
+
 /*
  * print_controldata --- print sfex control data to the display
  *
@@ -78,6 +105,8 @@ print_controldata(const sfex_controldata *cdata)
   printf("  version: %d\n", cdata->version);
   printf("  revision: %d\n", cdata->revision);
   printf("  blocksize: %d\n", (int)cdata->blocksize);
+  if (cdata->recordsize != cdata->blocksize)
+    printf("  recordsize: %d\n", (int)cdata->recordsize);
   printf("  numlocks: %d\n", cdata->numlocks);
 }
 
@@ -95,10 +124,225 @@ print_lockdata(const sfex_lockdata *ldata, int index)
 {
   printf("lock data #%d:\n", index);
   printf("  status: %s\n", ldata->status == SFEX_STATUS_UNLOCK ? "unlock" : "lock");
-  printf("  count: %d\n", ldata->count);
+  printf("  count: %llu\n", (unsigned long long)ldata->count);
+  if (ldata->timestamp)
+    printf("  timestamp: %llu\n", (unsigned long long)ldata->timestamp);
   printf("  nodename: %s\n",ldata->nodename);
 }
 
+/*
+ * print_json_string --- print a string as a JSON string literal
+ */
+static void
+print_json_string(const char *str)
+{
+  putchar('"');
+  for (; *str; str++) {
+    unsigned char c = *str;
+    if (c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if (c < 0x20)
+      printf("\\u%04x", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
+
+/*
+ * print_record --- print one lock data in the format of --all
+ */
+static void
+print_record(const sfex_lockdata *ldata, int index, int format)
+{
+  const char *status = ldata->status == SFEX_STATUS_UNLOCK ? "unlock" : "lock";
+
+  switch (format) {
+  case FORMAT_TSV:
+    printf("%d\t%s\t%llu\t%s\t%llu\n", index, status,
+	   (unsigned long long)ldata->count, ldata->nodename,
+	   (unsigned long long)ldata->timestamp);
+    break;
+  case FORMAT_JSON:
+    printf("{\"index\":%d,\"status\":\"%s\",\"count\":%llu,\"nodename\":",
+	   index, status, (unsigned long long)ldata->count);
+    print_json_string(ldata->nodename);
+    printf(",\"timestamp\":%llu}\n", (unsigned long long)ldata->timestamp);
+    break;
+  default:
+    print_lockdata(ldata, index);
+  }
+}
+
+/*
+ * print_bad_record --- print a lock data which can't be decoded
+ */
+static void
+print_bad_record(int index, int format)
+{
+  switch (format) {
+  case FORMAT_TSV:
+    printf("%d\terror\t\t\t\n", index);
+    break;
+  case FORMAT_JSON:
+    printf("{\"index\":%d,\"status\":\"error\"}\n", index);
+    break;
+  default:
+    printf("lock data #%d:\n", index);
+    printf("  status: error (lock data format error)\n");
+  }
+}
+
+/*
+ * stat_all --- display every lock data
+ *
+ * All lock data are read with one read of the whole meta-data area. A 
+ * lock data which can't be decoded is shown as an error record, and the
+ * others are still shown. With watch_msec, this is repeated every 
+ * watch_msec milliseconds and only the lock data whose status, count or 
+ * node name changed are printed. Returns the number of broken lock data 
+ * of the last read, or -1 if it failed.
+ */
+static int
+stat_all(sfex_controldata *cdata, int format, long watch_msec)
+{
+  sfex_lockdata *cur, *prev;
+  int *bad, *prev_bad;
+  struct timespec deadline;
+  int first = 1;
+  int i, nbad = 0;
+
+  cur = calloc(cdata->numlocks, sizeof(*cur));
+  prev = calloc(cdata->numlocks, sizeof(*prev));
+  bad = calloc(cdata->numlocks, sizeof(*bad));
+  prev_bad = calloc(cdata->numlocks, sizeof(*prev_bad));
+  if (cur == NULL || prev == NULL || bad == NULL || prev_bad == NULL) {
+    fprintf(stderr, "%s: ERROR: %s\n", progname, strerror(errno));
+    exit(3);
+  }
+
+  if (format == FORMAT_TEXT)
+    print_controldata(cdata);
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  while (1) {
+    nbad = read_lockdata_each(cdata, cur, bad, 1, cdata->numlocks);
+    if (nbad == -1) {
+      if (!watch_msec)
+	exit(3);
+    } else {
+      for (i = 0; i < cdata->numlocks; i++) {
+	if (bad[i]) {
+	  if (first || !prev_bad[i])
+	    print_bad_record(i + 1, format);
+	} else if (first || prev_bad[i] || cur[i].status != prev[i].status
+		   || cur[i].count != prev[i].count
+		   || strcmp(cur[i].nodename, prev[i].nodename))
+	  print_record(&cur[i], i + 1, format);
+      }
+      fflush(stdout);
+      memcpy(prev, cur, cdata->numlocks * sizeof(*cur));
+      memcpy(prev_bad, bad, cdata->numlocks * sizeof(*bad));
+      first = 0;
+    }
+    if (!watch_msec)
+      break;
+
+    deadline.tv_sec += watch_msec / 1000;
+    deadline.tv_nsec += (watch_msec % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+      ;
+  }
+  free(cur);
+  free(prev);
+  free(bad);
+  free(prev_bad);
+  return nbad;
+}
+
+/*
+ * print_stat_num --- display one unsigned statistics item
+ */
+static void
+print_stat_num(const char *name, unsigned long long value, int format)
+{
+  switch (format) {
+  case FORMAT_TSV:
+    printf("%s\t%llu\n", name, value);
+    break;
+  case FORMAT_JSON:
+    printf("\"%s\":%llu,", name, value);
+    break;
+  default:
+    printf("  %s: %llu\n", name, value);
+  }
+}
+
+/*
+ * print_stat_int --- display one signed statistics item
+ */
+static void
+print_stat_int(const char *name, long long value, int format)
+{
+  switch (format) {
+  case FORMAT_TSV:
+    printf("%s\t%lld\n", name, value);
+    break;
+  case FORMAT_JSON:
+    printf("\"%s\":%lld,", name, value);
+    break;
+  default:
+    printf("  %s: %lld\n", name, value);
+  }
+}
+
+/*
+ * print_stats --- display the statistics of a sfex_daemon
+ */
+static void
+print_stats(const sfex_stats *st, int format)
+{
+  static const double pct[] = { 0.5, 0.9, 0.99, 0.999 };
+  static const char *pct_name[] = { "p50", "p90", "p99", "p999" };
+  const sfex_histogram *hist[] = { &st->read, &st->write };
+  const char *hist_name[] = { "read", "write" };
+  int h, i;
+
+  if (format == FORMAT_JSON)
+    putchar('{');
+  else if (format != FORMAT_TSV)
+    printf("refresh statistics:\n");
+
+  print_stat_int("lock_timeout_ms", (long long)st->lock_timeout, format);
+  print_stat_int("monitor_interval_ms", (long long)st->monitor_interval,
+		 format);
+  print_stat_num("refreshes", (unsigned long long)st->refreshes, format);
+  print_stat_num("slow_refreshes", (unsigned long long)st->slow_refreshes,
+		 format);
+  print_stat_num("missed_slots", (unsigned long long)st->missed_slots, format);
+  print_stat_num("io_retries", (unsigned long long)st->io_retries, format);
+  print_stat_int("last_margin_ms", (long long)st->last_margin, format);
+  print_stat_int("min_margin_ms", (long long)st->min_margin, format);
+  for (h = 0; h < 2; h++) {
+    char name[32];
+    for (i = 0; i < 4; i++) {
+      snprintf(name, sizeof(name), "%s_%s_us", hist_name[h], pct_name[i]);
+      print_stat_num(name,
+		     (unsigned long long)sfex_hist_percentile(hist[h], pct[i]),
+		     format);
+    }
+    snprintf(name, sizeof(name), "%s_max_us", hist_name[h]);
+    if (format == FORMAT_JSON && h == 1)
+      printf("\"%s\":%llu}\n", name, (unsigned long long)hist[h]->max);
+    else
+      print_stat_num(name, (unsigned long long)hist[h]->max, format);
+  }
+}
+
 /*
  * usage --- display command line syntax
  *
@@ -111,6 +355,8 @@ print_lockdata(const sfex_lockdata *ldata, int index)
  */
 static void usage(FILE *dist) {
   fprintf(dist, "usage: %s [-i <index>] <device>\n", progname);
+  fprintf(dist, "       %s -a [-F text|tsv|json] [-w <msec>] <device>\n", progname);
+  fprintf(dist, "       %s -s <statsfile> [-F text|tsv|json]\n", progname);
 }
 
 /*
@@ -131,7 +377,20 @@ main(int argc, char *argv[]) {
 
   /* command line parameter */
   int index = 1;		/* default 1st lock */
+  int all = 0;
+  int format = FORMAT_TEXT;
+  long watch_msec = 0;
+  const char *stats_path = NULL;
   const char *device;
+  static const struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"index", required_argument, NULL, 'i'},
+    {"all", no_argument, NULL, 'a'},
+    {"format", required_argument, NULL, 'F'},
+    {"watch", required_argument, NULL, 'w'},
+    {"stats", required_argument, NULL, 's'},
+    {NULL, 0, NULL, 0}
+  };
 
   /*
    * startup process
@@ -148,7 +407,7 @@ main(int argc, char *argv[]) {
   /* read command line option */
   opterr = 0;
   while (1) {
-    int c = getopt(argc, argv, "hi:");
+    int c = getopt_long(argc, argv, "hi:aF:w:s:", long_options, NULL);
     if (c == -1)
       break;
     switch (c) {
@@ -158,23 +417,62 @@ main(int argc, char *argv[]) {
     case 'i':			/* -i <index> */
       {
 	unsigned long l = strtoul(optarg, NULL, 10);
-	if (l < SFEX_MIN_NUMLOCKS || l > SFEX_MAX_NUMLOCKS) {
+	if (l < SFEX_MIN_NUMLOCKS || l > SFEX_MAX_NUMLOCKS2) {
 	  fprintf(stderr,
 		  "%s: ERROR: index %s is out of range or invalid. it must be integer value between %lu and %lu.\n",
 		  progname, optarg,
 		  (unsigned long)SFEX_MIN_NUMLOCKS,
-		  (unsigned long)SFEX_MAX_NUMLOCKS);
+		  (unsigned long)SFEX_MAX_NUMLOCKS2);
 	  exit(4);
 	}
 	index = l;
       }
       break;
+    case 'a':			/* -a, --all */
+      all = 1;
+      break;
+    case 'F':			/* -F, --format <format> */
+      if (strcmp(optarg, "text") == 0)
+	format = FORMAT_TEXT;
+      else if (strcmp(optarg, "tsv") == 0)
+	format = FORMAT_TSV;
+      else if (strcmp(optarg, "json") == 0)
+	format = FORMAT_JSON;
+      else {
+	fprintf(stderr, "%s: ERROR: format %s is invalid. it must be text, tsv or json.\n",
+		progname, optarg);
+	exit(4);
+      }
+      break;
+    case 's':			/* -s, --stats <statsfile> */
+      stats_path = optarg;
+      break;
+    case 'w':			/* -w, --watch <msec> */
+      {
+	unsigned long l = strtoul(optarg, NULL, 10);
+	if (l < 1 || l > INT_MAX) {
+	  fprintf(stderr,
+		  "%s: ERROR: watch interval %s is out of range or invalid. it must be integer value between %lu and %lu.\n",
+		  progname, optarg, (unsigned long)1, (unsigned long)INT_MAX);
+	  exit(4);
+	}
+	watch_msec = l;
+      }
+      break;
     case '?':			/* error */
       usage(stderr);
       exit(4);
     }
   }
 
+  if (stats_path) {
+    sfex_stats st;
+    if (sfex_stats_read(stats_path, &st) == -1)
+      exit(3);
+    print_stats(&st, format);
+    exit(0);
+  }
+
   /* check parameter except the option */
   if (optind >= argc) {
     fprintf(stderr, "%s: ERROR: no device specified.\n", progname);
@@ -186,6 +484,11 @@ main(int argc, char *argv[]) {
     exit(4);
   }
   device = argv[optind];
+  if (watch_msec && !all) {
+    fprintf(stderr, "%s: ERROR: --watch requires --all.\n", progname);
+    usage(stderr);
+    exit(4);
+  }
 
   /*
    * main processes start 
@@ -196,12 +499,19 @@ main(int argc, char *argv[]) {
 
   prepare_lock(device);
 
+  if (all) {
+    if (read_controldata(&cdata) == -1)
+      exit(3);
+    exit(stat_all(&cdata, format, watch_msec) ? 3 : 0);
+  }
+
   ret = lock_index_check(&cdata, index);
   if (ret == -1)
     exit(EXIT_FAILURE);
 
   /* read lock data */
-  read_lockdata(&cdata, &ldata, index);
+  if (read_lockdata(&cdata, &ldata, index) == -1)
+    exit(3);
 
   /* display status */
   print_controldata(&cdata);
@@ -0,0 +1,224 @@
+/*-------------------------------------------------------------------------
+ * 
+ * Shared Disk File EXclusiveness Control Program(SF-EX)
+ *
+ * sfex_stats.c --- Lock refresh statistics of sfex_daemon.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ *
+ *-------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "sfex.h"
+#include "sfex_stats.h"
+
+/* a torn copy is retried every millisecond for at most this many times */
+#define READ_RETRIES 100
+
+#define SUB_BUCKETS (1 << SFEX_HIST_SUB_BITS)
+#define LINEAR_LIMIT (2 * SUB_BUCKETS)
+
+/*
+ * bucket_of --- the histogram bucket of a value
+ */
+static int
+bucket_of (uint64_t v)
+{
+  int e, i;
+
+  if (v < LINEAR_LIMIT)
+    return v;
+  e = 63 - __builtin_clzll (v);
+  i = LINEAR_LIMIT + (e - SFEX_HIST_SUB_BITS - 1) * SUB_BUCKETS
+    + ((v >> (e - SFEX_HIST_SUB_BITS)) & (SUB_BUCKETS - 1));
+  return i < SFEX_HIST_BUCKETS ? i : SFEX_HIST_BUCKETS - 1;
+}
+
+/*
+ * bucket_high --- the largest value which falls into bucket i
+ */
+static uint64_t
+bucket_high (int i)
+{
+  int e, sub;
+
+  if (i < LINEAR_LIMIT)
+    return i;
+  e = (i - LINEAR_LIMIT) / SUB_BUCKETS + SFEX_HIST_SUB_BITS + 1;
+  sub = (i - LINEAR_LIMIT) % SUB_BUCKETS;
+  return ((uint64_t) (SUB_BUCKETS + sub + 1) << (e - SFEX_HIST_SUB_BITS)) - 1;
+}
+
+void
+sfex_hist_record (sfex_histogram *h, uint64_t usec)
+{
+  h->bucket[bucket_of (usec)]++;
+  h->count++;
+  if (usec > h->max)
+    h->max = usec;
+}
+
+/*
+ * sfex_hist_percentile --- value below which p (0.0 - 1.0) of the 
+ * recorded values fall
+ *
+ * The upper bound of the bucket is returned, but never more than the 
+ * largest recorded value.
+ */
+uint64_t
+sfex_hist_percentile (const sfex_histogram *h, double p)
+{
+  uint64_t target, seen = 0;
+  int i;
+
+  if (h->count == 0)
+    return 0;
+  /* rank of the value, rounded up */
+  target = (uint64_t) (p * h->count);
+  if (target < p * h->count || target < 1)
+    target++;
+  for (i = 0; i < SFEX_HIST_BUCKETS; i++) {
+    seen += h->bucket[i];
+    if (seen >= target)
+      return bucket_high (i) < h->max ? bucket_high (i) : h->max;
+  }
+  return h->max;
+}
+
+/*
+ * sfex_stats_create --- create the statistics file and map it
+ *
+ * Returns NULL on failure; the reason is logged.
+ */
+sfex_stats *
+sfex_stats_create (const char *path)
+{
+  sfex_stats *stats;
+  int fd;
+
+  fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    cl_log(LOG_ERR, "can't create %s: %s\n", path, strerror (errno));
+    return NULL;
+  }
+  if (ftruncate (fd, sizeof (*stats)) == -1) {
+    cl_log(LOG_ERR, "can't resize %s: %s\n", path, strerror (errno));
+    close (fd);
+    return NULL;
+  }
+  stats = mmap (NULL, sizeof (*stats), PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+  close (fd);
+  if (stats == MAP_FAILED) {
+    cl_log(LOG_ERR, "can't map %s: %s\n", path, strerror (errno));
+    return NULL;
+  }
+  memcpy (stats->magic, SFEX_STATS_MAGIC, sizeof (stats->magic));
+  stats->version = SFEX_STATS_VERSION;
+  return stats;
+}
+
+/*
+ * sfex_stats_read --- take a consistent copy of a statistics file
+ *
+ * A daemon killed in the middle of an update leaves an odd sequence 
+ * number behind for good, so the copy is retried only READ_RETRIES times.
+ */
+int
+sfex_stats_read (const char *path, sfex_stats *snapshot)
+{
+  static const struct timespec pause = { 0, 1000000 };
+  const sfex_stats *stats;
+  struct stat st;
+  void *map;
+  uint32_t seq;
+  int fd, tries = 0;
+
+  fd = open (path, O_RDONLY);
+  if (fd == -1) {
+    cl_log(LOG_ERR, "can't open %s: %s\n", path, strerror (errno));
+    return -1;
+  }
+  if (fstat (fd, &st) == -1) {
+    cl_log(LOG_ERR, "can't stat %s: %s\n", path, strerror (errno));
+    close (fd);
+    return -1;
+  }
+  /* mapping past the end of the file would raise SIGBUS */
+  if (st.st_size < (off_t) sizeof (*stats)) {
+    cl_log(LOG_ERR, "%s is not a sfex statistics file.\n", path);
+    close (fd);
+    return -1;
+  }
+  map = mmap (NULL, sizeof (*stats), PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED) {
+    cl_log(LOG_ERR, "can't map %s: %s\n", path, strerror (errno));
+    return -1;
+  }
+  stats = map;
+
+  for (;;) {
+    seq = __atomic_load_n (&stats->seq, __ATOMIC_ACQUIRE);
+    memcpy (snapshot, stats, sizeof (*snapshot));
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    if (!(seq & 1) && seq == __atomic_load_n (&stats->seq, __ATOMIC_RELAXED))
+      break;
+    if (++tries == READ_RETRIES) {
+      cl_log(LOG_ERR, "%s is busy or stale: the daemon did not finish an update.\n",
+	     path);
+      munmap (map, sizeof (*stats));
+      return -1;
+    }
+    nanosleep (&pause, NULL);
+  }
+  munmap (map, sizeof (*stats));
+
+  if (memcmp (snapshot->magic, SFEX_STATS_MAGIC, sizeof (snapshot->magic))
+      || snapshot->version != SFEX_STATS_VERSION) {
+    cl_log(LOG_ERR, "%s is not a sfex statistics file.\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+void
+sfex_stats_begin (sfex_stats *stats)
+{
+  __atomic_store_n (&stats->seq, stats->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+}
+
+void
+sfex_stats_end (sfex_stats *stats)
+{
+  __atomic_store_n (&stats->seq, stats->seq + 1, __ATOMIC_RELEASE);
+}
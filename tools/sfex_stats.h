@@ -0,0 +1,79 @@
+/*-------------------------------------------------------------------------
+ *
+ * Shared Disk File EXclusiveness Control Program(SF-EX)
+ *
+ * sfex_stats.h --- Lock refresh statistics of sfex_daemon.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ *
+ *-------------------------------------------------------------------------*/
+
+#ifndef SFEX_STATS_H
+#define SFEX_STATS_H
+
+#include <stdint.h>
+
+/*
+ * sfex_histogram --- latency histogram in microseconds
+ *
+ * Values below 16 have a bucket of their own. Above that, every power of
+ * two is split into 2^SFEX_HIST_SUB_BITS buckets, so the relative error 
+ * of a reported value is at most 12.5%, like a HDR histogram with one 
+ * significant digit.
+ */
+#define SFEX_HIST_SUB_BITS 3
+#define SFEX_HIST_BUCKETS 320
+
+typedef struct sfex_histogram {
+  uint64_t count;
+  uint64_t max;
+  uint64_t bucket[SFEX_HIST_BUCKETS];
+} sfex_histogram;
+
+/*
+ * sfex_stats --- statistics published by sfex_daemon -S <file>
+ *
+ * The file is a mapping of this structure. The daemon makes seq odd while
+ * it updates the contents, so a reader retries when seq is odd or changed
+ * during its copy. Times are milliseconds unless noted.
+ */
+#define SFEX_STATS_MAGIC "SFEXSTAT"
+#define SFEX_STATS_VERSION 1
+
+typedef struct sfex_stats {
+  char magic[8];
+  uint32_t version;
+  uint32_t seq;
+  int64_t lock_timeout;
+  int64_t monitor_interval;
+  uint64_t refreshes;		/* successful update_lock() */
+  uint64_t slow_refreshes;	/* refreshes which overran their slot */
+  uint64_t missed_slots;	/* slots skipped entirely */
+  uint64_t io_retries;		/* I/O retried on EINTR/EAGAIN */
+  int64_t last_margin;		/* lock_timeout - time between refreshes */
+  int64_t min_margin;
+  sfex_histogram read;		/* read half of a refresh, usec */
+  sfex_histogram write;		/* write half of a refresh, usec */
+} sfex_stats;
+
+void sfex_hist_record(sfex_histogram *h, uint64_t usec);
+uint64_t sfex_hist_percentile(const sfex_histogram *h, double p);
+sfex_stats *sfex_stats_create(const char *path);
+int sfex_stats_read(const char *path, sfex_stats *snapshot);
+void sfex_stats_begin(sfex_stats *stats);
+void sfex_stats_end(sfex_stats *stats);
+
+#endif /* SFEX_STATS_H */
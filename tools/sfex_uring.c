@@ -0,0 +1,295 @@
+/*-------------------------------------------------------------------------
+ * 
+ * Shared Disk File EXclusiveness Control Program(SF-EX)
+ *
+ * sfex_uring.c --- io_uring I/O engine for the SF-EX meta-data.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ *
+ *-------------------------------------------------------------------------
+ *
+ * The device fd and the aligned I/O buffer of sfex_lib.c are registered
+ * with the kernel once, and every transfer is a positioned READ_FIXED or
+ * WRITE_FIXED request. This saves the lseek(2) and the per-request page
+ * pinning of read(2)/write(2) on an O_DIRECT descriptor. Only one request
+ * is in flight at a time, so the ring is tiny.
+ *
+ * liburing is not required; the three system calls are used directly.
+ *
+ *-------------------------------------------------------------------------*/
+
+#include <config.h>
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+
+#include "sfex.h"
+#include "sfex_uring.h"
+
+#if HAVE_LINUX_IO_URING_H
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#define SFEX_URING_ENTRIES 4
+
+static int ring_fd = -1;
+
+/* submission queue */
+static unsigned *sq_head;
+static unsigned *sq_tail;
+static unsigned *sq_mask;
+static unsigned *sq_array;
+static struct io_uring_sqe *sqes;
+
+/* completion queue */
+static unsigned *cq_head;
+static unsigned *cq_tail;
+static unsigned *cq_mask;
+static struct io_uring_cqe *cqes;
+
+/* the registered buffer */
+static void *reg_buf;
+static size_t reg_size;
+
+static int
+uring_setup (unsigned entries, struct io_uring_params *p)
+{
+  return syscall (__NR_io_uring_setup, entries, p);
+}
+
+static int
+uring_enter (unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  return syscall (__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+		  flags, NULL, 0);
+}
+
+static int
+uring_register (unsigned opcode, void *arg, unsigned nr_args)
+{
+  return syscall (__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+/*
+ * sfex_uring_init --- set up the ring and register fd and buffer
+ *
+ * Returns 0 on success. On failure -1 is returned and nothing is left
+ * behind, so the caller can keep using read(2)/write(2).
+ */
+int
+sfex_uring_init (int fd, void *buf, size_t size)
+{
+  struct io_uring_params p;
+  size_t sq_size, cq_size, sqes_size;
+  char *sq_ptr = MAP_FAILED, *cq_ptr = MAP_FAILED;
+
+  sqes_size = 0;
+  memset (&p, 0, sizeof (p));
+  ring_fd = uring_setup (SFEX_URING_ENTRIES, &p);
+  if (ring_fd == -1) {
+    cl_log(LOG_INFO, "io_uring is not available: %s\n", strerror (errno));
+    return -1;
+  }
+
+  sq_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+  cq_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cq_size > sq_size)
+      sq_size = cq_size;
+    cq_size = sq_size;
+  }
+
+  sq_ptr = mmap (NULL, sq_size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED)
+    goto fail;
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    cq_ptr = sq_ptr;
+  else {
+    cq_ptr = mmap (NULL, cq_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED)
+      goto fail;
+  }
+  sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+  sqes = mmap (NULL, sqes_size, PROT_READ | PROT_WRITE,
+	       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    goto fail;
+
+  sq_head = (unsigned *) (sq_ptr + p.sq_off.head);
+  sq_tail = (unsigned *) (sq_ptr + p.sq_off.tail);
+  sq_mask = (unsigned *) (sq_ptr + p.sq_off.ring_mask);
+  sq_array = (unsigned *) (sq_ptr + p.sq_off.array);
+  cq_head = (unsigned *) (cq_ptr + p.cq_off.head);
+  cq_tail = (unsigned *) (cq_ptr + p.cq_off.tail);
+  cq_mask = (unsigned *) (cq_ptr + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *) (cq_ptr + p.cq_off.cqes);
+
+  if (uring_register (IORING_REGISTER_FILES, &fd, 1) == -1) {
+    cl_log(LOG_INFO, "io_uring can't register device: %s\n",
+	   strerror (errno));
+    goto fail;
+  }
+  if (sfex_uring_register_buffer (buf, size) == -1)
+    goto fail;
+
+  return 0;
+
+fail:
+  if (sqes != MAP_FAILED && sqes != NULL)
+    munmap (sqes, sqes_size);
+  if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+    munmap (cq_ptr, cq_size);
+  if (sq_ptr != MAP_FAILED)
+    munmap (sq_ptr, sq_size);
+  sqes = NULL;
+  close (ring_fd);
+  ring_fd = -1;
+  return -1;
+}
+
+/*
+ * sfex_uring_register_buffer --- (re)register the aligned I/O buffer
+ *
+ * This must be called whenever the buffer of sfex_lib.c is reallocated.
+ */
+int
+sfex_uring_register_buffer (void *buf, size_t size)
+{
+  struct iovec iov;
+
+  if (ring_fd == -1)
+    return -1;
+  if (reg_buf != NULL)
+    uring_register (IORING_UNREGISTER_BUFFERS, NULL, 0);
+  reg_buf = NULL;
+  reg_size = 0;
+
+  iov.iov_base = buf;
+  iov.iov_len = size;
+  if (uring_register (IORING_REGISTER_BUFFERS, &iov, 1) == -1) {
+    cl_log(LOG_ERR, "io_uring can't register buffer: %s\n",
+	   strerror (errno));
+    return -1;
+  }
+  reg_buf = buf;
+  reg_size = size;
+  return 0;
+}
+
+/*
+ * sfex_uring_rw --- read or write size bytes at offset of the device
+ *
+ * buf must lie inside the registered buffer; it is only read for a
+ * write. Returns the number of bytes transferred, or -1 with errno set.
+ */
+ssize_t
+sfex_uring_rw (int write, const void *buf, size_t size, off_t offset)
+{
+  struct io_uring_sqe *sqe;
+  struct io_uring_cqe *cqe;
+  unsigned tail, head;
+  int res;
+
+  if (ring_fd == -1 || (const char *) buf < (const char *) reg_buf
+      || (const char *) buf + size > (const char *) reg_buf + reg_size) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  do {
+    tail = *sq_tail;
+    sqe = &sqes[tail & *sq_mask];
+    memset (sqe, 0, sizeof (*sqe));
+    sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0;		/* index in the registered files */
+    sqe->addr = (unsigned long) buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->buf_index = 0;
+    sq_array[tail & *sq_mask] = tail & *sq_mask;
+    __atomic_store_n (sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    /* submit and wait. If the wait was interrupted, the request may have
+       been consumed already, so only what is still queued is submitted. */
+    while (1) {
+      unsigned pending = *sq_tail - __atomic_load_n (sq_head, __ATOMIC_ACQUIRE);
+
+      if (uring_enter (pending, 1, IORING_ENTER_GETEVENTS) != -1)
+	break;
+      if (errno != EINTR && errno != EAGAIN)
+	return -1;
+      io_retries++;
+    }
+
+    head = *cq_head;
+    while (head == __atomic_load_n (cq_tail, __ATOMIC_ACQUIRE)) {
+      if (uring_enter (0, 1, IORING_ENTER_GETEVENTS) == -1
+	  && errno != EINTR && errno != EAGAIN)
+	return -1;
+    }
+    cqe = &cqes[head & *cq_mask];
+    res = cqe->res;
+    __atomic_store_n (cq_head, head + 1, __ATOMIC_RELEASE);
+    if (res == -EINTR || res == -EAGAIN)
+      io_retries++;
+  }
+  while (res == -EINTR || res == -EAGAIN);
+
+  if (res < 0) {
+    errno = -res;
+    return -1;
+  }
+  return res;
+}
+
+#else /* !HAVE_LINUX_IO_URING_H */
+
+int
+sfex_uring_init (int fd, void *buf, size_t size)
+{
+  cl_log(LOG_INFO, "io_uring support is not compiled in.\n");
+  return -1;
+}
+
+int
+sfex_uring_register_buffer (void *buf, size_t size)
+{
+  return -1;
+}
+
+ssize_t
+sfex_uring_rw (int write, const void *buf, size_t size, off_t offset)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
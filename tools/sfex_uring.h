@@ -0,0 +1,33 @@
+/*-------------------------------------------------------------------------
+ *
+ * Shared Disk File EXclusiveness Control Program(SF-EX)
+ *
+ * sfex_uring.h --- Prototypes for sfex_uring.c.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ *
+ *-------------------------------------------------------------------------*/
+
+#ifndef SFEX_URING_H
+#define SFEX_URING_H
+
+#include <sys/types.h>
+
+int sfex_uring_init(int fd, void *buf, size_t size);
+int sfex_uring_register_buffer(void *buf, size_t size);
+ssize_t sfex_uring_rw(int write, const void *buf, size_t size, off_t offset);
+
+#endif /* SFEX_URING_H */
@@ -52,6 +52,7 @@ HERE="$(dirname "$0")"
 : ${LO_NM4:=8}
 : ${LO_BC4:=127.255.255.255}
 : ${LO_IP6:=::1}
+: ${LO_NM6:=128}
 
 : ${DUMMY_IF:=dummy0}
 # carefully selected to fit TEST-NET-2
@@ -64,6 +65,11 @@ HERE="$(dirname "$0")"
 : ${DUMMY_NM6:=32}
 : ${DUMMY_BC6:=198.51.100.255}
 
+# randomized routing table for the consistency check (findif -K)
+: ${RANDOM_ROUTES:=2000}
+: ${RANDOM_LOOKUPS:=100000}
+: ${RANDOM_PROTO:=99}
+
 #
 # hard-wired
 #
@@ -128,7 +134,7 @@ TEST_DATA4=\
 TEST_DATA6=\
 "   # valid: A0-A9: loopback, B0-B9: dummy if; invalid cases: C0-C9: ip, D0-D9: netmask bits
     # A0) LO6_IP
-    ${LO_IP6}		, 				, $OCF_SUCCESS		, ${LO_IF}	, ${LO_NM4}	,
+    ${LO_IP6}		, 				, $OCF_SUCCESS		, ${LO_IF}	, ${LO_NM6}	,
     #
     # B0) DUMMY6_IP+1
     ${DUMMY_IP6_INC}	, 				, $OCF_SUCCESS		, ${DUMMY_IF}	, ${DUMMY_NM6}	,
@@ -304,6 +310,41 @@ proceed () {
 	return $err_cnt
 }
 
+consistency () {
+	[ -x "${PRG}" ] || die "Forgot to compile ${PRG} for me to test?"
+
+	# Random prefixes within 10.0.0.0/8, spread over two interfaces,
+	# with colliding prefixes at different metrics and some unreachable
+	# routes; all tagged with a private protocol number to clean up.
+	awk -v n=${RANDOM_ROUTES} -v seed=$$ -v proto=${RANDOM_PROTO} \
+	    -v if1=${DUMMY_IF} -v if2=${LO_IF} '
+	BEGIN {
+		srand(seed)
+		for (i = 0; i < n; i++) {
+			len = 8 + int(rand() * 25)
+			addr = int(rand() * 16777216)
+			addr -= addr % 2 ^ (32 - len)
+			dst = sprintf("10.%d.%d.%d/%d", int(addr / 65536),
+			    int(addr / 256) % 256, addr % 256, len)
+			r = rand()
+			if (r < 0.1)
+				how = "unreachable " dst
+			else if (r < 0.55)
+				how = dst " dev " if1
+			else
+				how = dst " dev " if2
+			printf "route add %s metric %d proto %d\n",
+			    how, int(rand() * 4), proto
+		}
+	}' | ip -force -batch - 2>/dev/null
+
+	${PRG} -K ${RANDOM_LOOKUPS}
+	ret=$?
+	ip route flush proto ${RANDOM_PROTO}
+	[ $ret -eq 0 ] && ok || fail
+	return $ret
+}
+
 if [ $# -ge 1 ]; then
 	while true; do
 		case $1 in
@@ -327,13 +368,13 @@ if [ $# -ge 1 ]; then
 			TESTS="4 6"
 			[ $# -eq 1 ] && break
 			;;
-		setup|proceed|teardown)
+		setup|proceed|teardown|consistency)
 			verbosely $1
 			ret=$?
 			[ $ret -ne 0 ] && exit $ret
 			;;
 		*)
-			echo "usage: ./$0 [-script] [--|-4|-6|-46] (setup,proceed,teardown)"
+			echo "usage: ./$0 [-script] [--|-4|-6|-46] (setup,proceed,teardown,consistency)"
 			echo "additional tests may be piped to standard input, format:"
 			echo "${TEST_FORMAT}" | tr '\t' ' ' | tr -s ' '
 			exit 0
@@ -19,6 +19,10 @@
    along with this program; if not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -29,9 +33,19 @@
 #include <netinet/ip6.h>
 #include <netinet/tcp.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <net/if.h>
+#include <time.h>
+#include <libgen.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define discard_const(ptr) ((void *)((intptr_t)(ptr)))
 
@@ -41,6 +55,67 @@ typedef union {
 	struct sockaddr_in6 ip6;
 } sock_addr;
 
+struct tickle_pkt4 {
+	struct iphdr ip;
+	struct tcphdr tcp;
+};
+
+struct tickle_pkt6 {
+	struct ip6_hdr ip6;
+	struct tcphdr tcp;
+};
+
+union tickle_pkt {
+	struct tickle_pkt4 p4;
+	struct tickle_pkt6 p6;
+};
+
+/*
+ * Packets are built from a template per source address (and RST flag):
+ * everything but the destination address, the ports and seq/ack is
+ * fixed.  Each packet starts as a copy of the previous one from the
+ * same template and, in the default CSUM_INCR mode, its checksum is
+ * updated from the previous one with the RFC 1624 eqn. 3 deltas of the
+ * words that changed.  Connections to one VIP mostly differ in the
+ * client port only, so that is usually a single word.
+ *
+ * CSUM_FULL recomputes every checksum with tcp_checksum(), CSUM_BULK
+ * leaves them for tcp_checksum_bulk() to do a whole batch at once.
+ */
+enum { CSUM_INCR, CSUM_FULL, CSUM_BULK };
+
+struct tickle_template {
+	sock_addr src;
+	int rst;
+	union tickle_pkt last;
+};
+
+static int csum_mode = CSUM_INCR;
+
+/*
+ * One raw socket per address family for the life of the process;
+ * packets are queued and sent TICKLE_BATCH at a time with sendmmsg().
+ */
+#define TICKLE_BATCH 64
+
+struct tickle_queue {
+	int family;
+	int fd;
+	int n;
+	struct mmsghdr msgs[TICKLE_BATCH];
+	struct iovec iov[TICKLE_BATCH];
+	sock_addr dst[TICKLE_BATCH];
+	union tickle_pkt pkt[TICKLE_BATCH];
+};
+
+static struct tickle_queue queue4 = { AF_INET, -1 };
+static struct tickle_queue queue6 = { AF_INET6, -1 };
+static struct tickle_template *templates;
+static int ntemplates;
+
+/* Totals for the replay summary; a failed packet is counted, not fatal */
+static unsigned long tickles_sent, tickle_errors;
+
 uint32_t uint16_checksum(uint16_t *data, size_t n);
 void set_nonblocking(int fd);
 void set_close_on_exec(int fd);
@@ -51,6 +126,10 @@ int parse_ip_port(const char *addr, sock_addr *saddr);
 int send_tickle_ack(const sock_addr *dst, 
 		    const sock_addr *src, 
 		    uint32_t seq, uint32_t ack, int rst);
+int queue_tickle_ack(const sock_addr *dst,
+		     const sock_addr *src,
+		     uint32_t seq, uint32_t ack, int rst);
+int flush_tickle_acks(void);
 static void usage(void);
 
 uint32_t uint16_checksum(uint16_t *data, size_t n)
@@ -88,16 +167,17 @@ static uint16_t tcp_checksum(uint16_t *data, size_t n, struct iphdr *ip)
 
 static uint16_t tcp_checksum6(uint16_t *data, size_t n, struct ip6_hdr *ip6)
 {
-	uint32_t phdr[2];
 	uint32_t sum = 0;
 	uint16_t sum2;
 
 	sum += uint16_checksum((uint16_t *)(void *)&ip6->ip6_src, 16);
 	sum += uint16_checksum((uint16_t *)(void *)&ip6->ip6_dst, 16);
 
-	phdr[0] = htonl(n);
-	phdr[1] = htonl(ip6->ip6_nxt);
-	sum += uint16_checksum((uint16_t *)phdr, 8);
+	/* pseudo-header upper layer length and next header, as 32-bit
+	 * big endian words; summed directly, as reading them back through
+	 * a uint16_t pointer is undefined and gcc -O2 drops the stores */
+	sum += (n >> 16) + (n & 0xFFFF);
+	sum += ip6->ip6_nxt;
 
 	sum += uint16_checksum(data, n);
 
@@ -204,135 +284,1198 @@ int parse_ip_port(const char *addr, sock_addr *saddr)
 	return ret;
 }
 
+static int same_addr(const sock_addr *a, const sock_addr *b)
+{
+	if (a->sa.sa_family != b->sa.sa_family)
+		return 0;
+	if (a->sa.sa_family == AF_INET)
+		return a->ip.sin_addr.s_addr == b->ip.sin_addr.s_addr;
+	return memcmp(&a->ip6.sin6_addr, &b->ip6.sin6_addr,
+		      sizeof(a->ip6.sin6_addr)) == 0;
+}
+
+static struct tickle_template *get_template(const sock_addr *src, int rst)
+{
+	struct tickle_template *t;
+	int i;
+
+	for (i = 0; i < ntemplates; i++) {
+		if (templates[i].rst == !!rst && same_addr(&templates[i].src, src))
+			return &templates[i];
+	}
+
+	t = realloc(templates, (ntemplates + 1) * sizeof(*templates));
+	if (!t) {
+		fprintf(stderr, "Failed realloc()\n");
+		return NULL;
+	}
+	templates = t;
+	t = &templates[ntemplates];
+	memset(t, 0, sizeof(*t));
+	t->src = *src;
+	t->rst = !!rst;
+
+	/* destination, ports, seq and ack stay zero: the checksum then
+	 * covers exactly the fixed part */
+	switch (src->sa.sa_family) {
+	case AF_INET:
+		t->last.p4.ip.version  = 4;
+		t->last.p4.ip.ihl      = sizeof(t->last.p4.ip)/4;
+		t->last.p4.ip.tot_len  = htons(sizeof(t->last.p4));
+		t->last.p4.ip.ttl      = 255;
+		t->last.p4.ip.protocol = IPPROTO_TCP;
+		t->last.p4.ip.saddr    = src->ip.sin_addr.s_addr;
+		t->last.p4.tcp.ack     = 1;
+		t->last.p4.tcp.rst     = t->rst;
+		t->last.p4.tcp.doff    = sizeof(t->last.p4.tcp)/4;
+		t->last.p4.tcp.window  = htons(1234);
+		t->last.p4.tcp.check   = tcp_checksum((uint16_t *)&t->last.p4.tcp,
+						     sizeof(t->last.p4.tcp), &t->last.p4.ip);
+		break;
+	case AF_INET6:
+		t->last.p6.ip6.ip6_vfc  = 0x60;
+		t->last.p6.ip6.ip6_plen = htons(20);
+		t->last.p6.ip6.ip6_nxt  = IPPROTO_TCP;
+		t->last.p6.ip6.ip6_hlim = 64;
+		t->last.p6.ip6.ip6_src  = src->ip6.sin6_addr;
+		t->last.p6.tcp.ack      = 1;
+		t->last.p6.tcp.rst      = t->rst;
+		t->last.p6.tcp.doff     = sizeof(t->last.p6.tcp)/4;
+		t->last.p6.tcp.window   = htons(1234);
+		t->last.p6.tcp.check    = tcp_checksum6((uint16_t *)&t->last.p6.tcp,
+						       sizeof(t->last.p6.tcp), &t->last.p6.ip6);
+		break;
+	default:
+		fprintf(stderr, "Not an ipv4/v6 address\n");
+		return NULL;
+	}
+	ntemplates++;
+	return t;
+}
+
+/*
+ * RFC 1624 eqn. 3, HC' = ~(~HC + ~m + m'): add ~m + m' for every
+ * 16-bit word (as stored) that changed from old to new ...
+ */
+static uint32_t csum_delta(uint32_t sum, const void *old, const void *new, size_t n)
+{
+	const uint16_t *o = old, *m = new;
+
+	for (; n >= 2; n -= 2, o++, m++) {
+		if (*o != *m)
+			sum += (uint16_t)~*o + *m;
+	}
+	return sum;
+}
+
+/* ... and fold the deltas into the old checksum */
+static uint16_t csum_finish(uint16_t check, uint32_t sum)
+{
+	sum += (uint16_t)~check;
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	check = ~sum;
+	return check == 0 ? 0xFFFF : check;
+}
+
+static uint16_t csum_fold(uint32_t sum)
+{
+	uint16_t check;
+
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	check = htons(~sum);
+	return check == 0 ? 0xFFFF : check;
+}
+
+#ifdef __SSE2__
+/* Sum of the 8 host order 16-bit words in v, as 4 partial 32-bit sums */
+static __m128i sum16x8(__m128i acc, __m128i v)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	/* byte swap each word so the sums match uint16_checksum() */
+	v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+	acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+	return _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+}
+
+static uint32_t hsum32x4(__m128i v)
+{
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(v);
+}
+#endif
+
+/*
+ * Checksum n packets of one family in one pass; their check fields must
+ * be zero.  With SSE2 the pseudo-header addresses and the TCP header of
+ * a packet, which are contiguous in it, are summed 16 bytes at a time.
+ */
+static void tcp_checksum_bulk(union tickle_pkt *pkts, int n, int family)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		/* protocol and TCP length */
+		uint32_t sum = IPPROTO_TCP + sizeof(struct tcphdr);
+
+		if (family == AF_INET) {
+			struct tickle_pkt4 *p = &pkts[i].p4;
+#ifdef __SSE2__
+			/* bytes 8..39: ttl, protocol and IP check are masked out */
+			const __m128i mask = _mm_set_epi32(-1, -1, -1, 0);
+			const unsigned char *b = (const unsigned char *)p;
+			__m128i acc = _mm_setzero_si128();
+
+			acc = sum16x8(acc, _mm_and_si128(mask,
+				_mm_loadu_si128((const __m128i *)(b + 8))));
+			acc = sum16x8(acc, _mm_loadu_si128((const __m128i *)(b + 24)));
+			sum += hsum32x4(acc);
+#else
+			sum += uint16_checksum((uint16_t *)(void *)&p->ip.saddr, 8);
+			sum += uint16_checksum((uint16_t *)&p->tcp, sizeof(p->tcp));
+#endif
+			p->tcp.check = csum_fold(sum);
+		} else {
+			struct tickle_pkt6 *p = &pkts[i].p6;
+#ifdef __SSE2__
+			/* bytes 8..55, then the last 4 of the TCP header */
+			const unsigned char *b = (const unsigned char *)p;
+			__m128i acc = _mm_setzero_si128();
+
+			acc = sum16x8(acc, _mm_loadu_si128((const __m128i *)(b + 8)));
+			acc = sum16x8(acc, _mm_loadu_si128((const __m128i *)(b + 24)));
+			acc = sum16x8(acc, _mm_loadu_si128((const __m128i *)(b + 40)));
+			sum += hsum32x4(acc);
+			sum += uint16_checksum((uint16_t *)(void *)((unsigned char *)&p->tcp + 16), 4);
+#else
+			sum += uint16_checksum((uint16_t *)(void *)&p->ip6.ip6_src, 32);
+			sum += uint16_checksum((uint16_t *)&p->tcp, sizeof(p->tcp));
+#endif
+			p->tcp.check = csum_fold(sum);
+		}
+	}
+}
+
+/*
+ * Fill in pkt for one connection from template t, which remembers it
+ * as the base for the next one.
+ */
+static void build_tickle(struct tickle_template *t, union tickle_pkt *pkt,
+			 const sock_addr *dst, const sock_addr *src,
+			 uint32_t seq, uint32_t ack)
+{
+	struct tcphdr *tcp;
+	const struct tcphdr *old;
+	uint32_t sum;
+
+	*pkt = t->last;
+	if (src->sa.sa_family == AF_INET) {
+		pkt->p4.ip.daddr = dst->ip.sin_addr.s_addr;
+		tcp = &pkt->p4.tcp;
+		old = &t->last.p4.tcp;
+		tcp->source = src->ip.sin_port;
+		tcp->dest   = dst->ip.sin_port;
+		sum = csum_delta(0, &t->last.p4.ip.daddr, &pkt->p4.ip.daddr, 4);
+	} else {
+		pkt->p6.ip6.ip6_dst = dst->ip6.sin6_addr;
+		tcp = &pkt->p6.tcp;
+		old = &t->last.p6.tcp;
+		tcp->source = src->ip6.sin6_port;
+		tcp->dest   = dst->ip6.sin6_port;
+		sum = csum_delta(0, &t->last.p6.ip6.ip6_dst, &pkt->p6.ip6.ip6_dst, 16);
+	}
+	tcp->seq     = seq;
+	tcp->ack_seq = ack;
+
+	switch (csum_mode) {
+	case CSUM_INCR:
+		sum = csum_delta(sum, &old->source, &tcp->source, 4);
+		sum = csum_delta(sum, &old->seq, &tcp->seq, 8);
+		tcp->check = csum_finish(tcp->check, sum);
+		break;
+	case CSUM_FULL:
+		tcp->check = 0;
+		if (src->sa.sa_family == AF_INET)
+			tcp->check = tcp_checksum((uint16_t *)tcp, sizeof(*tcp), &pkt->p4.ip);
+		else
+			tcp->check = tcp_checksum6((uint16_t *)tcp, sizeof(*tcp), &pkt->p6.ip6);
+		break;
+	case CSUM_BULK:
+		tcp->check = 0;
+		break;
+	}
+	t->last = *pkt;
+}
+
+static int open_raw_socket(struct tickle_queue *q)
+{
+	uint32_t one = 1;
+
+	if (q->family == AF_INET) {
+		q->fd = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
+		if (q->fd == -1) {
+			fprintf(stderr, "Failed to open raw socket (%s)\n", strerror(errno));
+			return -1;
+		}
+		if (setsockopt(q->fd, SOL_IP, IP_HDRINCL, &one, sizeof(one)) != 0) {
+			fprintf(stderr, "Failed to setup IP headers (%s)\n", strerror(errno));
+			close(q->fd);
+			q->fd = -1;
+			return -1;
+		}
+	} else {
+		q->fd = socket(PF_INET6, SOCK_RAW, IPPROTO_RAW);
+		if (q->fd == -1) {
+			fprintf(stderr, "Failed to open sending socket\n");
+			return -1;
+		}
+	}
+	set_close_on_exec(q->fd);
+	return 0;
+}
+
+static int flush_queue(struct tickle_queue *q)
+{
+	int i, ret, done = 0, failed = 0;
+	char buf[INET6_ADDRSTRLEN];
+
+	if (q->n == 0)
+		return 0;
+	if (q->fd == -1 && open_raw_socket(q) < 0) {
+		tickle_errors += q->n;
+		q->n = 0;
+		return -1;
+	}
+	if (csum_mode == CSUM_BULK)
+		tcp_checksum_bulk(q->pkt, q->n, q->family);
+
+	for (i = 0; i < q->n; i++) {
+		memset(&q->msgs[i], 0, sizeof(q->msgs[i]));
+		q->msgs[i].msg_hdr.msg_name = &q->dst[i];
+		q->msgs[i].msg_hdr.msg_namelen = q->family == AF_INET
+			? sizeof(q->dst[i].ip) : sizeof(q->dst[i].ip6);
+		q->msgs[i].msg_hdr.msg_iov = &q->iov[i];
+		q->msgs[i].msg_hdr.msg_iovlen = 1;
+		q->iov[i].iov_base = &q->pkt[i];
+		q->iov[i].iov_len = q->family == AF_INET
+			? sizeof(q->pkt[i].p4) : sizeof(q->pkt[i].p6);
+	}
+
+	/* skip a packet the kernel refuses and go on with the rest */
+	while (done < q->n) {
+		ret = sendmmsg(q->fd, q->msgs + done, q->n - done, 0);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			inet_ntop(q->family, q->family == AF_INET
+				  ? (void *)&q->dst[done].ip.sin_addr
+				  : (void *)&q->dst[done].ip6.sin6_addr, buf, sizeof(buf));
+			fprintf(stderr, "Failed sendto %s (%s)\n", buf, strerror(errno));
+			tickle_errors++;
+			failed = -1;
+			done++;
+			continue;
+		}
+		tickles_sent += ret;
+		done += ret;
+	}
+	q->n = 0;
+	return failed;
+}
+
+int flush_tickle_acks(void)
+{
+	int ret = 0;
+
+	if (flush_queue(&queue4))
+		ret = -1;
+	if (flush_queue(&queue6))
+		ret = -1;
+	return ret;
+}
+
+/*
+ * Queue one tickle ACK; it goes out with the next full batch or
+ * flush_tickle_acks().  Returns -1 if it could not be queued or an
+ * earlier packet of the batch flushed to make room failed to send.
+ */
+int queue_tickle_ack(const sock_addr *dst,
+		     const sock_addr *src,
+		     uint32_t seq, uint32_t ack, int rst)
+{
+	struct tickle_template *t;
+	struct tickle_queue *q;
+	int i, ret = 0;
+
+	t = get_template(src, rst);
+	if (!t) {
+		tickle_errors++;
+		return -1;
+	}
+	q = src->sa.sa_family == AF_INET ? &queue4 : &queue6;
+	if (q->n == TICKLE_BATCH && flush_queue(q) < 0)
+		ret = -1;
+	i = q->n;
+
+	build_tickle(t, &q->pkt[i], dst, src, seq, ack);
+	q->dst[i] = *dst;
+	/* a raw IPv6 socket wants no port in the address */
+	if (q->family == AF_INET6)
+		q->dst[i].ip6.sin6_port = 0;
+
+	q->n++;
+	return ret;
+}
+
 int send_tickle_ack(const sock_addr *dst, 
 		    const sock_addr *src, 
 		    uint32_t seq, uint32_t ack, int rst)
 {
-	int s;
-	int ret;
-	uint32_t one = 1;
-	uint16_t tmpport;
-	sock_addr *tmpdest;
-	struct {
-		struct iphdr ip;
-		struct tcphdr tcp;
-	} ip4pkt;
-	struct {
-		struct ip6_hdr ip6;
-		struct tcphdr tcp;
-	} ip6pkt;
+	if (queue_tickle_ack(dst, src, seq, ack, rst))
+		return -1;
+	return flush_tickle_acks();
+}
 
-	switch (src->ip.sin_family) {
-	case AF_INET:
-		memset(&ip4pkt, 0, sizeof(ip4pkt));
-		ip4pkt.ip.version  = 4;
-		ip4pkt.ip.ihl      = sizeof(ip4pkt.ip)/4;
-		ip4pkt.ip.tot_len  = htons(sizeof(ip4pkt));
-		ip4pkt.ip.ttl      = 255;
-		ip4pkt.ip.protocol = IPPROTO_TCP;
-		ip4pkt.ip.saddr    = src->ip.sin_addr.s_addr;
-		ip4pkt.ip.daddr    = dst->ip.sin_addr.s_addr;
-		ip4pkt.ip.check    = 0;
-
-		ip4pkt.tcp.source  = src->ip.sin_port;
-		ip4pkt.tcp.dest    = dst->ip.sin_port;
-		ip4pkt.tcp.seq     = seq;
-		ip4pkt.tcp.ack_seq = ack;
-		ip4pkt.tcp.ack     = 1;
-		if (rst)
-			ip4pkt.tcp.rst = 1;
-		ip4pkt.tcp.doff    = sizeof(ip4pkt.tcp)/4;
-		ip4pkt.tcp.window   = htons(1234);
-		ip4pkt.tcp.check    = tcp_checksum((uint16_t *)&ip4pkt.tcp, sizeof(ip4pkt.tcp), &ip4pkt.ip);
-
-		s = socket(AF_INET, SOCK_RAW, htons(IPPROTO_RAW));
-		if (s == -1) {
-			fprintf(stderr, "Failed to open raw socket (%s)\n", strerror(errno));
+/*
+ * Connection snapshot (-s): ask the kernel for the ESTABLISHED TCP
+ * sockets bound to one local address with a NETLINK_SOCK_DIAG dump.
+ * A bytecode filter on the source address runs in the kernel, so the
+ * cost scales with the matching sockets rather than the whole table.
+ *
+ * Snapshots are written as text, "local_ip:port<TAB>remote_ip:port"
+ * per line as read from stdin, or in the binary state format below.
+ */
+
+/*
+ * Binary state file: a header and fixed size records, all multi-byte
+ * fields in network byte order.  The first nbase records are a full
+ * snapshot sorted by tickle_rec_cmp(); ndelta records appended after
+ * them each add or remove one connection.  A delta append writes the
+ * records first and then the header, so a torn append is ignored.
+ * Every write bumps the generation.
+ */
+#define TICKLE_MAGIC	"TICKLEST"
+#define TICKLE_VERSION	1
+
+struct tickle_file_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t generation;
+	uint32_t nbase;
+	uint32_t ndelta;
+};
+
+enum { TICKLE_REC_ADD, TICKLE_REC_DEL };
+
+struct tickle_rec {
+	uint8_t family;		/* 4 or 6 */
+	uint8_t op;		/* TICKLE_REC_ADD/DEL, deltas only */
+	uint16_t pad;
+	uint16_t sport;
+	uint16_t dport;
+	uint8_t src[16];
+	uint8_t dst[16];
+};
+
+struct tickle_recs {
+	struct tickle_rec *rec;
+	size_t n, alloced;
+};
+
+/* Too many deltas make the replay slow; rewrite the file instead */
+#define TICKLE_MAX_DELTA(nbase)	((nbase) / 2 > 1024 ? (nbase) / 2 : 1024)
+
+static int tickle_rec_cmp(const void *a, const void *b)
+{
+	const struct tickle_rec *x = a, *y = b;
+	int d;
+
+	if (x->family != y->family)
+		return x->family - y->family;
+	if ((d = memcmp(x->src, y->src, 16)) != 0)
+		return d;
+	if ((d = memcmp(x->dst, y->dst, 16)) != 0)
+		return d;
+	if (x->sport != y->sport)
+		return ntohs(x->sport) - ntohs(y->sport);
+	return ntohs(x->dport) - ntohs(y->dport);
+}
+
+static int add_rec(struct tickle_recs *r, const struct tickle_rec *rec)
+{
+	if (r->n == r->alloced) {
+		size_t n = r->alloced ? 2 * r->alloced : 1024;
+		struct tickle_rec *p = realloc(r->rec, n * sizeof(*p));
+
+		if (!p) {
+			fprintf(stderr, "Failed realloc()\n");
 			return -1;
 		}
+		r->rec = p;
+		r->alloced = n;
+	}
+	r->rec[r->n++] = *rec;
+	return 0;
+}
 
-		ret = setsockopt(s, SOL_IP, IP_HDRINCL, &one, sizeof(one));
-		if (ret != 0) {
-			fprintf(stderr, "Failed to setup IP headers (%s)\n", strerror(errno));
-			close(s);
+/* IPv4 clients of a dual stack listener are stored as plain IPv4 */
+static void diag_to_rec(const struct inet_diag_msg *d, struct tickle_rec *rec)
+{
+	const __be32 *src = d->id.idiag_src, *dst = d->id.idiag_dst;
+	int v4 = d->idiag_family == AF_INET;
+
+	if (!v4 && src[0] == 0 && src[1] == 0 && src[2] == htonl(0xffff)) {
+		v4 = 1;
+		src += 3;
+		dst += 3;
+	}
+	memset(rec, 0, sizeof(*rec));
+	rec->family = v4 ? 4 : 6;
+	rec->sport = d->id.idiag_sport;
+	rec->dport = d->id.idiag_dport;
+	memcpy(rec->src, src, v4 ? 4 : 16);
+	memcpy(rec->dst, dst, v4 ? 4 : 16);
+}
+
+static void rec_to_addrs(const struct tickle_rec *rec, sock_addr *src, sock_addr *dst)
+{
+	memset(src, 0, sizeof(*src));
+	memset(dst, 0, sizeof(*dst));
+	if (rec->family == 4) {
+		src->ip.sin_family = dst->ip.sin_family = AF_INET;
+		memcpy(&src->ip.sin_addr, rec->src, 4);
+		memcpy(&dst->ip.sin_addr, rec->dst, 4);
+		src->ip.sin_port = rec->sport;
+		dst->ip.sin_port = rec->dport;
+	} else {
+		src->ip6.sin6_family = dst->ip6.sin6_family = AF_INET6;
+		memcpy(&src->ip6.sin6_addr, rec->src, 16);
+		memcpy(&dst->ip6.sin6_addr, rec->dst, 16);
+		src->ip6.sin6_port = rec->sport;
+		dst->ip6.sin6_port = rec->dport;
+	}
+}
+
+static void addrs_to_rec(const sock_addr *src, const sock_addr *dst,
+			 struct tickle_rec *rec)
+{
+	memset(rec, 0, sizeof(*rec));
+	if (src->sa.sa_family == AF_INET) {
+		rec->family = 4;
+		memcpy(rec->src, &src->ip.sin_addr, 4);
+		memcpy(rec->dst, &dst->ip.sin_addr, 4);
+		rec->sport = src->ip.sin_port;
+		rec->dport = dst->ip.sin_port;
+	} else {
+		rec->family = 6;
+		memcpy(rec->src, &src->ip6.sin6_addr, 16);
+		memcpy(rec->dst, &dst->ip6.sin6_addr, 16);
+		rec->sport = src->ip6.sin6_port;
+		rec->dport = dst->ip6.sin6_port;
+	}
+}
+
+static void print_rec(FILE *out, const struct tickle_rec *rec)
+{
+	char s[INET6_ADDRSTRLEN], d[INET6_ADDRSTRLEN];
+	int family = rec->family == 4 ? AF_INET : AF_INET6;
+
+	inet_ntop(family, rec->src, s, sizeof(s));
+	inet_ntop(family, rec->dst, d, sizeof(d));
+	fprintf(out, "%s:%u\t%s:%u\n", s, ntohs(rec->sport), d, ntohs(rec->dport));
+}
+
+static int dump_family(int fd, int family, const sock_addr *local,
+		       struct tickle_recs *out)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct inet_diag_req_v2 req;
+		struct nlattr nla;
+		struct inet_diag_bc_op op;
+		struct inet_diag_hostcond cond;
+		__be32 addr[4];
+	} __attribute__((packed)) msg;
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	static char buf[32768];
+	int alen = local->sa.sa_family == AF_INET ? 4 : 16;
+	int len = sizeof(msg.op) + sizeof(msg.cond) + alen;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(msg.req)) + NLA_HDRLEN + len;
+	msg.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	msg.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	msg.req.sdiag_family = family;
+	msg.req.sdiag_protocol = IPPROTO_TCP;
+	msg.req.idiag_states = 1 << TCP_ESTABLISHED;
+
+	/* one host condition: match -> jump to the end (accept),
+	 * no match -> jump past it (reject) */
+	msg.nla.nla_type = INET_DIAG_REQ_BYTECODE;
+	msg.nla.nla_len = NLA_HDRLEN + len;
+	msg.op.code = INET_DIAG_BC_S_COND;
+	msg.op.yes = len;
+	msg.op.no = len + 4;
+	msg.cond.family = local->sa.sa_family;
+	msg.cond.prefix_len = alen * 8;
+	msg.cond.port = -1;
+	if (local->sa.sa_family == AF_INET)
+		memcpy(msg.addr, &local->ip.sin_addr, 4);
+	else
+		memcpy(msg.addr, &local->ip6.sin6_addr, 16);
+
+	if (sendto(fd, &msg, msg.nlh.nlmsg_len, 0,
+		   (struct sockaddr *)&nladdr, sizeof(nladdr)) < 0) {
+		fprintf(stderr, "Failed to send sock_diag request (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	for (;;) {
+		struct nlmsghdr *h;
+		int n = recv(fd, buf, sizeof(buf), 0);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Failed to read sock_diag reply (%s)\n", strerror(errno));
 			return -1;
 		}
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, n); h = NLMSG_NEXT(h, n)) {
+			struct tickle_rec rec;
+
+			if (h->nlmsg_type == NLMSG_DONE)
+				return 0;
+			if (h->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *e = NLMSG_DATA(h);
+
+				/* no IPv6 in this kernel: nothing to report */
+				if (family == AF_INET6 && local->sa.sa_family == AF_INET
+				    && e->error == -ENOENT)
+					return 0;
+				fprintf(stderr, "sock_diag dump failed (%s)\n", strerror(-e->error));
+				return -1;
+			}
+			if (h->nlmsg_type != SOCK_DIAG_BY_FAMILY)
+				continue;
+			diag_to_rec(NLMSG_DATA(h), &rec);
+			if (add_rec(out, &rec) < 0)
+				return -1;
+		}
+	}
+}
+
+/* Snapshot of ip's established connections, sorted */
+static int capture_connections(const char *ip, struct tickle_recs *out)
+{
+	sock_addr local;
+	int fd, ret = 0;
+
+	memset(&local, 0, sizeof(local));
+	if (parse_ip(ip, NULL, 0, &local))
+		return -1;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open sock_diag socket (%s)\n", strerror(errno));
+		return -1;
+	}
+	/* an IPv4 address may also be in use by IPv6 sockets, v4-mapped */
+	if (local.sa.sa_family == AF_INET)
+		ret = dump_family(fd, AF_INET, &local, out);
+	if (ret == 0)
+		ret = dump_family(fd, AF_INET6, &local, out);
+	close(fd);
+
+	qsort(out->rec, out->n, sizeof(*out->rec), tickle_rec_cmp);
+	return ret;
+}
+
+/*
+ * A state file, text or binary, mapped into memory.  For binary files
+ * the live connections are the base records not deleted by a delta,
+ * plus the delta additions not deleted later.
+ */
+struct tickle_state {
+	void *map;
+	size_t size;
+	const struct tickle_file_hdr *hdr;	/* NULL: text */
+	const struct tickle_rec *base, *delta;
+	uint32_t nbase, ndelta, generation;
+	unsigned char *dead;			/* per base, then per delta */
+};
+
+static int open_state(const char *path, struct tickle_state *st)
+{
+	struct stat sb;
+	int fd;
+	uint32_t i, j;
+
+	memset(st, 0, sizeof(*st));
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &sb) < 0) {
+		close(fd);
+		return -1;
+	}
+	st->size = sb.st_size;
+	if (st->size == 0) {
+		close(fd);
+		return 0;
+	}
+	st->map = mmap(NULL, st->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (st->map == MAP_FAILED) {
+		st->map = NULL;
+		return -1;
+	}
+	if (st->size < sizeof(*st->hdr)
+	    || memcmp(st->map, TICKLE_MAGIC, sizeof(st->hdr->magic)) != 0)
+		return 0;
+
+	st->hdr = st->map;
+	st->nbase = ntohl(st->hdr->nbase);
+	st->ndelta = ntohl(st->hdr->ndelta);
+	st->generation = ntohl(st->hdr->generation);
+	if (ntohl(st->hdr->version) != TICKLE_VERSION
+	    || (st->size - sizeof(*st->hdr)) / sizeof(struct tickle_rec)
+	       < (uint64_t)st->nbase + st->ndelta) {
+		fprintf(stderr, "%s: unsupported or truncated state file\n", path);
+		return -1;
+	}
+	st->base = (const struct tickle_rec *)(st->hdr + 1);
+	st->delta = st->base + st->nbase;
+
+	st->dead = calloc(st->nbase + st->ndelta + 1, 1);
+	if (!st->dead) {
+		fprintf(stderr, "Failed calloc()\n");
+		return -1;
+	}
+	for (i = 0; i < st->ndelta; i++) {
+		const struct tickle_rec *d = &st->delta[i], *b;
+
+		if (d->op != TICKLE_REC_DEL)
+			continue;
+		st->dead[st->nbase + i] = 1;
+		/* the latest live addition goes first, the base record last */
+		for (j = i; j-- > 0; ) {
+			if (st->delta[j].op == TICKLE_REC_ADD
+			    && !st->dead[st->nbase + j]
+			    && tickle_rec_cmp(&st->delta[j], d) == 0) {
+				st->dead[st->nbase + j] = 1;
+				break;
+			}
+		}
+		if (j != (uint32_t)-1)
+			continue;
+		b = bsearch(d, st->base, st->nbase, sizeof(*d), tickle_rec_cmp);
+		if (b)
+			st->dead[b - st->base] = 1;
+	}
+	return 0;
+}
 
-		set_nonblocking(s);
-		set_close_on_exec(s);
+static void close_state(struct tickle_state *st)
+{
+	if (st->map)
+		munmap(st->map, st->size);
+	free(st->dead);
+	memset(st, 0, sizeof(*st));
+}
 
-		ret = sendto(s, &ip4pkt, sizeof(ip4pkt), 0, 
-			     (const struct sockaddr *)&dst->ip, sizeof(dst->ip));
-		close(s);
-		if (ret != sizeof(ip4pkt)) {
-			fprintf(stderr, "Failed sendto (%s)\n", strerror(errno));
+/* Live connections of a binary state, sorted */
+static int state_recs(const struct tickle_state *st, struct tickle_recs *out)
+{
+	uint32_t i;
+
+	for (i = 0; i < st->nbase + st->ndelta; i++) {
+		if (!st->dead[i] && add_rec(out, &st->base[i]) < 0)
 			return -1;
+	}
+	for (i = 0; i < out->n; i++)
+		out->rec[i].op = TICKLE_REC_ADD;
+	qsort(out->rec, out->n, sizeof(*out->rec), tickle_rec_cmp);
+	return 0;
+}
+
+static void fsync_dir(const char *path)
+{
+	char *dir = strdup(path);
+	int dfd;
+
+	if (!dir)
+		return;
+	dfd = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+	if (dfd >= 0) {
+		fsync(dfd);
+		close(dfd);
+	}
+	free(dir);
+}
+
+/*
+ * Replace path with a full snapshot: written to a temporary file in
+ * the same directory, fsync()ed and renamed over it, so readers see
+ * either the old or the new list in full.
+ */
+static int write_snapshot(const char *path, const struct tickle_recs *r,
+			  int binary, uint32_t generation)
+{
+	struct tickle_file_hdr hdr;
+	char *tmp;
+	FILE *out;
+	size_t i;
+	int fd;
+
+	if (asprintf(&tmp, "%s.XXXXXX", path) < 0) {
+		fprintf(stderr, "Failed asprintf()\n");
+		return -1;
+	}
+	fd = mkstemp(tmp);
+	if (fd < 0 || !(out = fdopen(fd, "w"))) {
+		fprintf(stderr, "Failed to create %s (%s)\n", tmp, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp);
 		}
-		break;
+		free(tmp);
+		return -1;
+	}
+	fchmod(fd, 0644);
+	if (binary) {
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, TICKLE_MAGIC, sizeof(hdr.magic));
+		hdr.version = htonl(TICKLE_VERSION);
+		hdr.generation = htonl(generation);
+		hdr.nbase = htonl(r->n);
+		fwrite(&hdr, sizeof(hdr), 1, out);
+		fwrite(r->rec, sizeof(*r->rec), r->n, out);
+	} else {
+		for (i = 0; i < r->n; i++)
+			print_rec(out, &r->rec[i]);
+	}
+	if (fflush(out) != 0 || fsync(fd) != 0 || fclose(out) != 0
+	    || rename(tmp, path) != 0) {
+		fprintf(stderr, "Failed to write %s (%s)\n", path, strerror(errno));
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+	free(tmp);
+	fsync_dir(path);
+	return 0;
+}
 
-        case AF_INET6:
-		memset(&ip6pkt, 0, sizeof(ip6pkt));
-		ip6pkt.ip6.ip6_vfc  = 0x60;
-		ip6pkt.ip6.ip6_plen = htons(20);
-		ip6pkt.ip6.ip6_nxt  = IPPROTO_TCP;
-		ip6pkt.ip6.ip6_hlim = 64;
-		ip6pkt.ip6.ip6_src  = src->ip6.sin6_addr;
-		ip6pkt.ip6.ip6_dst  = dst->ip6.sin6_addr;
-
-		ip6pkt.tcp.source   = src->ip6.sin6_port;
-		ip6pkt.tcp.dest     = dst->ip6.sin6_port;
-		ip6pkt.tcp.seq      = seq;
-		ip6pkt.tcp.ack_seq  = ack;
-		ip6pkt.tcp.ack      = 1;
-		if (rst)
-			ip6pkt.tcp.rst      = 1;
-		ip6pkt.tcp.doff     = sizeof(ip6pkt.tcp)/4;
-		ip6pkt.tcp.window   = htons(1234);
-		ip6pkt.tcp.check    = tcp_checksum6((uint16_t *)&ip6pkt.tcp, sizeof(ip6pkt.tcp), &ip6pkt.ip6);
-
-		s = socket(PF_INET6, SOCK_RAW, IPPROTO_RAW);
-		if (s == -1) {
-			fprintf(stderr, "Failed to open sending socket\n");
+/*
+ * Bring the binary state file at path up to date with cur by appending
+ * add/delete records for what changed.  Falls back to a full snapshot
+ * if there is no usable binary file yet or the deltas pile up.
+ */
+static int append_delta(const char *path, const struct tickle_recs *cur)
+{
+	struct tickle_state st;
+	struct tickle_recs old = { 0 }, delta = { 0 };
+	struct tickle_file_hdr hdr;
+	size_t i = 0, j = 0;
+	off_t off;
+	int fd, d, ret = -1;
+
+	if (open_state(path, &st) < 0 || !st.hdr) {
+		close_state(&st);
+		return write_snapshot(path, cur, 1, 1);
+	}
+	if (state_recs(&st, &old) < 0)
+		goto out;
+
+	/* merge the two sorted lists */
+	while (i < old.n || j < cur->n) {
+		struct tickle_rec rec;
+
+		d = i == old.n ? 1 : j == cur->n ? -1
+			: tickle_rec_cmp(&old.rec[i], &cur->rec[j]);
+		if (d == 0) {
+			i++;
+			j++;
+			continue;
+		}
+		rec = d < 0 ? old.rec[i++] : cur->rec[j++];
+		rec.op = d < 0 ? TICKLE_REC_DEL : TICKLE_REC_ADD;
+		if (add_rec(&delta, &rec) < 0)
+			goto out;
+	}
+
+	if (delta.n == 0) {
+		ret = 0;
+		goto out;
+	}
+	if (st.ndelta + delta.n > TICKLE_MAX_DELTA(st.nbase)) {
+		ret = write_snapshot(path, cur, 1, st.generation + 1);
+		goto out;
+	}
+
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s (%s)\n", path, strerror(errno));
+		goto out;
+	}
+	/* records first, then the header that makes them visible */
+	hdr = *st.hdr;
+	hdr.generation = htonl(st.generation + 1);
+	hdr.ndelta = htonl(st.ndelta + delta.n);
+	off = sizeof(hdr) + ((off_t)st.nbase + st.ndelta) * sizeof(struct tickle_rec);
+	if (pwrite(fd, delta.rec, delta.n * sizeof(*delta.rec), off)
+	    != (ssize_t)(delta.n * sizeof(*delta.rec))
+	    || fdatasync(fd) != 0
+	    || pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+	    || fdatasync(fd) != 0) {
+		fprintf(stderr, "Failed to append to %s (%s)\n", path, strerror(errno));
+		close(fd);
+		goto out;
+	}
+	close(fd);
+	ret = 0;
+out:
+	free(old.rec);
+	free(delta.rec);
+	close_state(&st);
+	return ret;
+}
+
+enum { SNAP_TEXT, SNAP_BINARY, SNAP_DELTA };
+
+static int save_connections(const char *ip, const char *path, int format)
+{
+	struct tickle_recs r = { 0 };
+	struct tickle_state st;
+	uint32_t generation = 1;
+	size_t i;
+	int ret;
+
+	if (capture_connections(ip, &r) < 0) {
+		free(r.rec);
+		return -1;
+	}
+	if (!path) {
+		for (i = 0; i < r.n; i++)
+			print_rec(stdout, &r.rec[i]);
+		ret = fflush(stdout) == 0 ? 0 : -1;
+	} else if (format == SNAP_DELTA) {
+		ret = append_delta(path, &r);
+	} else {
+		if (format == SNAP_BINARY && open_state(path, &st) == 0 && st.hdr)
+			generation = st.generation + 1;
+		if (format == SNAP_BINARY)
+			close_state(&st);
+		ret = write_snapshot(path, &r, format == SNAP_BINARY, generation);
+	}
+	free(r.rec);
+	return ret;
+}
+
+/*
+ * Replay: all connections are read first, then every round sends one
+ * tickle to each of them, so a long list gets its first tickle
+ * everywhere before anyone gets the second.
+ */
+
+/* One "local_ip:port remote_ip:port" line; blank lines are ignored */
+static int parse_line(const char *line, struct tickle_recs *r, unsigned long *bad)
+{
+	sock_addr src, dst;
+	struct tickle_rec rec;
+	char addr1[64], addr2[64];
+
+	if (sscanf(line, "%63s %63s", addr1, addr2) != 2)
+		return 0;
+	if (parse_ip_port(addr1, &src)) {
+		fprintf(stderr, "Bad IP:port '%s'\n", addr1);
+		(*bad)++;
+		return 0;
+	}
+	if (parse_ip_port(addr2, &dst)) {
+		fprintf(stderr, "Bad IP:port '%s'\n", addr2);
+		(*bad)++;
+		return 0;
+	}
+	if (src.sa.sa_family != dst.sa.sa_family) {
+		fprintf(stderr, "Mixed address families in '%s %s'\n", addr1, addr2);
+		(*bad)++;
+		return 0;
+	}
+	addrs_to_rec(&src, &dst, &rec);
+	return add_rec(r, &rec);
+}
+
+static int read_text(const char *buf, size_t size, struct tickle_recs *r,
+		     unsigned long *bad)
+{
+	char line[128];
+	size_t len;
+
+	while (size > 0) {
+		const char *nl = memchr(buf, '\n', size);
+
+		len = nl ? (size_t)(nl - buf) : size;
+		if (len >= sizeof(line))
+			len = sizeof(line) - 1;
+		memcpy(line, buf, len);
+		line[len] = 0;
+		if (parse_line(line, r, bad) < 0)
 			return -1;
-                }
+		len = nl ? (size_t)(nl - buf) + 1 : size;
+		buf += len;
+		size -= len;
+	}
+	return 0;
+}
 
-		tmpdest = discard_const(dst);
-		tmpport = tmpdest->ip6.sin6_port;
+/* The live connections of a text or binary state file */
+static int read_state_file(const char *path, struct tickle_recs *r,
+			   unsigned long *bad)
+{
+	struct tickle_state st;
+	int ret;
+
+	if (open_state(path, &st) < 0) {
+		fprintf(stderr, "Failed to read %s (%s)\n", path, strerror(errno));
+		close_state(&st);
+		return -1;
+	}
+	if (st.hdr)
+		ret = state_recs(&st, r);
+	else
+		ret = read_text(st.map, st.size, r, bad);
+	close_state(&st);
+	return ret;
+}
 
-		tmpdest->ip6.sin6_port = 0;
-		ret = sendto(s, &ip6pkt, sizeof(ip6pkt), 0, (const struct sockaddr *)&dst->ip6, sizeof(dst->ip6));
-		tmpdest->ip6.sin6_port = tmpport;
-		close(s);
+static int read_stdin(struct tickle_recs *r, unsigned long *bad)
+{
+	char addrline[128];
 
-		if (ret != sizeof(ip6pkt)) {
-			fprintf(stderr, "Failed sendto (%s)\n", strerror(errno));
+	while(fgets(addrline, sizeof(addrline), stdin)) {
+		if (parse_line(addrline, r, bad) < 0)
 			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Token bucket pacer: rate packets per second with bursts of up to
+ * one batch.  When the bucket runs dry the queued packets are sent
+ * before sleeping, so they leave at the paced rate rather than in a
+ * burst after the wait.  A rate of 0 means no limit.
+ */
+struct tickle_pacer {
+	double rate;
+	double tokens;
+	struct timespec last;
+};
+
+static double ts_diff(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) / 1e9;
+}
+
+static void pacer_refill(struct tickle_pacer *p)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	p->tokens += ts_diff(&now, &p->last) * p->rate;
+	if (p->tokens > TICKLE_BATCH)
+		p->tokens = TICKLE_BATCH;
+	p->last = now;
+}
+
+static void pacer_wait(struct tickle_pacer *p)
+{
+	struct timespec ts;
+	double wait;
+
+	if (p->rate <= 0)
+		return;
+	pacer_refill(p);
+	while (p->tokens < 1) {
+		flush_tickle_acks();
+		pacer_refill(p);
+		if (p->tokens >= 1)
+			break;
+		wait = (1 - p->tokens) / p->rate;
+		ts.tv_sec = (time_t)wait;
+		ts.tv_nsec = (long)((wait - ts.tv_sec) * 1e9);
+		nanosleep(&ts, NULL);
+		pacer_refill(p);
+	}
+	p->tokens -= 1;
+}
+
+static int tickle_connections(const struct tickle_recs *r, int num, long rate,
+			      unsigned long bad)
+{
+	struct tickle_pacer pacer = { 0 };
+	struct timespec start, end;
+	sock_addr src, dst;
+	size_t i;
+	int round;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pacer.rate = rate;
+	pacer.tokens = TICKLE_BATCH;
+	pacer.last = start;
+
+	for (round = 1; round <= num; round++) {
+		for (i = 0; i < r->n; i++) {
+			rec_to_addrs(&r->rec[i], &src, &dst);
+			pacer_wait(&pacer);
+			queue_tickle_ack(&dst, &src, 0, 0, 0);
 		}
-		break;
+		flush_tickle_acks();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	default:
-		fprintf(stderr, "Not an ipv4/v6 address\n");
+	printf("%lu tickles sent to %lu connections in %d rounds, "
+	       "%lu errors, %.3f seconds\n", tickles_sent, (unsigned long)r->n,
+	       num > 0 ? num : 0, tickle_errors, ts_diff(&end, &start));
+	if (bad)
+		printf("%lu malformed connections skipped\n", bad);
+	return tickle_errors || bad ? -1 : 0;
+}
+
+static const char *csum_names[] = { "incremental", "full", "bulk" };
+
+static void free_templates(void)
+{
+	free(templates);
+	templates = NULL;
+	ntemplates = 0;
+}
+
+/*
+ * Microbenchmark: generate count tickles per address family from one
+ * VIP to random clients with each checksum mode, check that all modes
+ * agree with tcp_checksum() and report packets per second.  Nothing
+ * is sent.
+ */
+static int benchmark(int count)
+{
+	static const int families[] = { AF_INET, AF_INET6 };
+	union tickle_pkt *pkts;
+	sock_addr src, *dst;
+	uint16_t *ref;
+	int f, mode, i, bad = 0;
+
+	pkts = malloc(count * sizeof(*pkts));
+	dst = malloc(count * sizeof(*dst));
+	ref = malloc(count * sizeof(*ref));
+	if (!pkts || !dst || !ref) {
+		fprintf(stderr, "Failed malloc()\n");
 		return -1;
 	}
+	srand(1);
+
+	for (f = 0; f < 2; f++) {
+		memset(&src, 0, sizeof(src));
+		if (families[f] == AF_INET)
+			parse_ip_port("192.0.2.10:80", &src);
+		else
+			parse_ip_port("2001:db8::10:80", &src);
+		/* a few hundred clients, random ports */
+		for (i = 0; i < count; i++) {
+			dst[i] = src;
+			if (families[f] == AF_INET) {
+				dst[i].ip.sin_addr.s_addr = htonl(0x0a000000 | (rand() % 256) << 8 | rand() % 2);
+				dst[i].ip.sin_port = htons(1024 + rand() % 64000);
+			} else {
+				dst[i].ip6.sin6_addr.s6_addr[14] = rand() % 256;
+				dst[i].ip6.sin6_addr.s6_addr[15] = rand() % 2;
+				dst[i].ip6.sin6_port = htons(1024 + rand() % 64000);
+			}
+		}
+
+		for (mode = CSUM_FULL; ; mode = mode == CSUM_FULL ? CSUM_INCR
+					   : mode == CSUM_INCR ? CSUM_BULK : -1) {
+			struct timespec t0, t1;
+			double secs;
+
+			if (mode < 0)
+				break;
+			csum_mode = mode;
+			free_templates();
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			for (i = 0; i < count; i++) {
+				struct tickle_template *t = get_template(&src, 0);
+
+				if (!t)
+					return -1;
+				build_tickle(t, &pkts[i], &dst[i], &src, 0, 0);
+				if (mode == CSUM_BULK && (i + 1) % TICKLE_BATCH == 0)
+					tcp_checksum_bulk(pkts + i + 1 - TICKLE_BATCH,
+							  TICKLE_BATCH, families[f]);
+			}
+			if (mode == CSUM_BULK && count % TICKLE_BATCH)
+				tcp_checksum_bulk(pkts + count - count % TICKLE_BATCH,
+						  count % TICKLE_BATCH, families[f]);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+
+			for (i = 0; i < count; i++) {
+				uint16_t check = families[f] == AF_INET
+					? pkts[i].p4.tcp.check : pkts[i].p6.tcp.check;
 
+				if (mode == CSUM_FULL)
+					ref[i] = check;
+				else if (check != ref[i])
+					bad++;
+			}
+			secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+			printf("%s %-11s %d pkts in %.3f ms, %.0f pkts/s\n",
+			       families[f] == AF_INET ? "IPv4" : "IPv6",
+			       csum_names[mode], count, secs * 1000,
+			       secs > 0 ? count / secs : 0);
+		}
+	}
+	free_templates();
+	free(pkts);
+	free(dst);
+	free(ref);
+	if (bad) {
+		fprintf(stderr, "%d checksums differ from tcp_checksum()\n", bad);
+		return -1;
+	}
 	return 0;
 }
 
 static void usage(void)
 {
-	printf("Usage: /usr/lib/heartbeat/tickle_tcp [ -n num ]\n");
+	printf("Usage: /usr/lib/heartbeat/tickle_tcp [ -n num ] [ -r pps ] [ -C incremental|full|bulk ] [ -f file ]\n");
+	printf("       /usr/lib/heartbeat/tickle_tcp -s local_ip [ -o file [ -B | -d ] ]\n");
+	printf("       /usr/lib/heartbeat/tickle_tcp -b count\n");
 	printf("Please note that this program need to read the list of\n");
-	printf("{local_ip:port remote_ip:port} from stdin.\n");
+	printf("{local_ip:port remote_ip:port} from stdin, or from a text or\n");
+	printf("binary state file given with -f.\n");
+	printf("-n sends num rounds, each tickling every connection once,\n");
+	printf("-r limits the rate to pps packets per second (default no limit),\n");
+	printf("-C selects how TCP checksums are computed (default incremental),\n");
+	printf("-s lists the established connections of local_ip in that format,\n");
+	printf("   to stdout or atomically replacing file; -B writes the binary\n");
+	printf("   state format, -d only appends the changes to a binary file.\n");
+	printf("-b benchmarks the checksum modes on count generated packets.\n");
 	exit(1);
 }
 
-#define OPTION_STRING "n:h"
+#define OPTION_STRING "n:r:C:b:s:o:Bdf:h"
 
 int main(int argc, char *argv[])
 {
-	int optchar, i, num = 1, cont = 1;
-	sock_addr src, dst;
-	char addrline[128], addr1[64], addr2[64];
+	int optchar, i, num = 1, cont = 1, ret;
+	int snapshot_format = SNAP_TEXT;
+	const char *snapshot_ip = NULL, *snapshot_file = NULL, *state_file = NULL;
+	struct tickle_recs conns = { 0 };
+	unsigned long bad = 0;
+	long rate = 0;
 
 	while(cont) {
 		optchar = getopt(argc, argv, OPTION_STRING);
@@ -340,6 +1483,38 @@ int main(int argc, char *argv[])
 		case 'n':
 			num = atoi(optarg);
 			break;
+		case 'r':
+			rate = atol(optarg);
+			break;
+		case 'C':
+			for (i = 0; i < 3; i++) {
+				if (strcmp(optarg, csum_names[i]) == 0)
+					break;
+			}
+			if (i == 3) {
+				fprintf(stderr, "unknown checksum mode '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			csum_mode = i;
+			break;
+		case 'b':
+			exit(benchmark(atoi(optarg)) ? EXIT_FAILURE : EXIT_SUCCESS);
+			break;
+		case 's':
+			snapshot_ip = optarg;
+			break;
+		case 'o':
+			snapshot_file = optarg;
+			break;
+		case 'B':
+			snapshot_format = SNAP_BINARY;
+			break;
+		case 'd':
+			snapshot_format = SNAP_DELTA;
+			break;
+		case 'f':
+			state_file = optarg;
+			break;
 		case 'h':
 			usage();
 			exit(EXIT_SUCCESS);
@@ -354,26 +1529,18 @@ int main(int argc, char *argv[])
 		};
 	}
 
-	while(fgets(addrline, sizeof(addrline), stdin)) {
-		sscanf(addrline, "%s %s", addr1, addr2);
-
-		if (parse_ip_port(addr1, &src)) {
-			fprintf(stderr, "Bad IP:port '%s'\n", addr1);
-			return -1;
-		}
-		if (parse_ip_port(addr2, &dst)) {
-			fprintf(stderr, "Bad IP:port '%s'\n", addr2);
-			return -1;
-		}
-	
-		for (i = 1; i <= num; i++) {
-			if (send_tickle_ack(&dst, &src, 0, 0, 0)) {
-				fprintf(stderr, "Error while sending tickle ack from '%s' to '%s'\n",
-					addr1, addr2);
-				return -1;
-			}
-		}
-
+	if (snapshot_ip) {
+		if (save_connections(snapshot_ip, snapshot_file, snapshot_format))
+			return EXIT_FAILURE;
+		return EXIT_SUCCESS;
 	}
-	return 0;
+
+	if (state_file)
+		ret = read_state_file(state_file, &conns, &bad);
+	else
+		ret = read_stdin(&conns, &bad);
+	if (ret == 0)
+		ret = tickle_connections(&conns, num, rate, bad);
+	free(conns.rec);
+	return ret;
 }